@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include "srpc/rpc_buffer.h"
+
+using namespace srpc;
+
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+#define IOV_MAX_COUNT	8
+
+static volatile size_t sink;
+
+// write like RPCOutputStream: acquire() piece by piece, as protobuf does
+static void bench_encode(const std::string& payload, int times)
+{
+	struct iovec iov[IOV_MAX_COUNT];
+	int64_t ns_st = GET_CURRENT_NS;
+
+	for (int i = 0; i < times; i++)
+	{
+		RPCBuffer buf;
+		const char *p = payload.data();
+		size_t left = payload.size();
+
+		while (left > 0)
+		{
+			void *data;
+			size_t sz = left;
+
+			if (!buf.acquire(&data, &sz))
+				abort();
+
+			memcpy(data, p, sz);
+			p += sz;
+			left -= sz;
+		}
+
+		sink += buf.encode(iov, IOV_MAX_COUNT);
+	}
+
+	int64_t ns = GET_CURRENT_NS - ns_st;
+
+	fprintf(stderr, "encode\t%zu\tbytes\t%.1lf\tns/op\t%.1lf\tMB/s\n",
+			payload.size(), ns * 1.0 / times,
+			payload.size() * 1000.0 * times / ns);
+}
+
+// read like RPCInputStream: fetch() piece by piece after seek() the header
+static void bench_read(const std::string& payload, int times)
+{
+	RPCBuffer buf;
+	int64_t ns_st;
+
+	// small pieces as what we get from network
+	buf.set_piece_max_size(BUFFER_PIECE_MIN_SIZE);
+	buf.write(payload.data(), payload.size());
+	ns_st = GET_CURRENT_NS;
+
+	for (int i = 0; i < times; i++)
+	{
+		const void *data;
+		size_t sz;
+
+		buf.rewind();
+		buf.seek(16);
+		while ((sz = buf.fetch(&data)) > 0)
+			sink += *(const char *)data;
+
+		buf.seek(-(long)payload.size());
+	}
+
+	int64_t ns = GET_CURRENT_NS - ns_st;
+
+	fprintf(stderr, "read\t%zu\tbytes\t%.1lf\tns/op\t%.1lf\tMB/s\n",
+			payload.size(), ns * 1.0 / times,
+			payload.size() * 1000.0 * times / ns);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t sizes[] = { 64, 4096, 1024 * 1024 };
+	long total = 1024L * 1024 * 1024;
+
+	if (argc > 1)
+		total = atol(argv[1]) * 1024 * 1024;
+
+	for (size_t size : sizes)
+	{
+		std::string payload(size, 'x');
+		int times = total / size > 1000000 ? 1000000 : total / size;
+
+		bench_encode(payload, times);
+		bench_read(payload, times);
+	}
+
+	return 0;
+}
+
@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "srpc/rpc_buffer.h"
+#include "srpc/rpc_allocator.h"
+#include "srpc/rpc_compress.h"
+
+using namespace srpc;
+
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+// bytes run through each codec for one size, small messages repeat more
+static const size_t ROUND_BYTES = 16 * 1024 * 1024;
+static const size_t ROUND_MAX = 10000;
+
+static const char *type_name[RPCCompressMax] = {
+	"none", "snappy", "gzip", "zlib", "lz4", "zstd"
+};
+
+// count operator new, snappy allocates with it
+static size_t new_count = 0;
+
+void *operator new(size_t size)
+{
+	void *ptr = malloc(size ? size : 1);
+
+	if (!ptr)
+		abort();
+
+	new_count++;
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+// count every piece the buffers ask for
+class CountingAllocator : public RPCBufferAllocator
+{
+public:
+	void *allocate(size_t size) override
+	{
+		this->allocated += size;
+		this->count++;
+		return malloc(size);
+	}
+
+	void deallocate(void *ptr, size_t size) override
+	{
+		free(ptr);
+	}
+
+	void reset()
+	{
+		this->allocated = 0;
+		this->count = 0;
+	}
+
+	size_t allocated = 0;
+	size_t count = 0;
+};
+
+struct Corpus
+{
+	std::string name;
+	std::string data;
+};
+
+static void put_varint(std::string& out, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+
+	out.push_back((char)v);
+}
+
+static void put_bytes(std::string& out, int field, const std::string& s)
+{
+	put_varint(out, (uint64_t)(field << 3 | 2));
+	put_varint(out, s.size());
+	out += s;
+}
+
+static std::string random_word(size_t len)
+{
+	std::string word;
+
+	for (size_t i = 0; i < len; i++)
+		word.push_back('a' + rand() % 26);
+
+	return word;
+}
+
+// repeated records as serialized by protobuf: ids, names, scores, tags
+static std::string make_protobuf(size_t size)
+{
+	std::string payload;
+	std::string record;
+	double score;
+
+	srand(1);
+	payload.reserve(size + 256);
+	while (payload.size() < size)
+	{
+		record.clear();
+		put_varint(record, 1 << 3 | 0);
+		put_varint(record, 100000 + rand() % 1000000);
+		put_bytes(record, 2, "user_" + random_word(4 + rand() % 8));
+		put_varint(record, 3 << 3 | 1);
+		score = rand() / 1000.0;
+		record.append((const char *)&score, sizeof score);
+
+		std::string tags;
+		for (int i = rand() % 8; i >= 0; i--)
+			put_varint(tags, rand() % 300);
+
+		put_bytes(record, 4, tags);
+		put_bytes(payload, 1, record);
+	}
+
+	payload.resize(size);
+	return payload;
+}
+
+// the same records printed as json
+static std::string make_json(size_t size)
+{
+	std::string payload;
+	char record[256];
+
+	srand(1);
+	payload.reserve(size + 256);
+	payload = "[";
+	while (payload.size() < size)
+	{
+		snprintf(record, sizeof record,
+				 "{\"id\":%d,\"name\":\"user_%s\",\"score\":%.3lf,"
+				 "\"tags\":[%d,%d,%d],\"active\":%s},",
+				 100000 + rand() % 1000000,
+				 random_word(4 + rand() % 8).c_str(),
+				 rand() / 1000.0, rand() % 300, rand() % 300, rand() % 300,
+				 rand() % 2 ? "true" : "false");
+		payload += record;
+	}
+
+	payload.resize(size);
+	return payload;
+}
+
+// incompressible
+static std::string make_random(size_t size)
+{
+	std::string payload(size, 0);
+
+	srand(1);
+	for (size_t i = 0; i < size; i++)
+		payload[i] = (char)(rand() & 0xFF);
+
+	return payload;
+}
+
+// semi-compressible: words with random letters between
+static std::string make_text(size_t size)
+{
+	static const char *words[] = { "alpha ", "beta ", "gamma ", "delta " };
+	std::string payload;
+
+	srand(1);
+	payload.reserve(size + 8);
+	while (payload.size() < size)
+	{
+		payload += words[rand() % 4];
+		if (rand() % 3 == 0)
+			payload.push_back('a' + rand() % 26);
+	}
+
+	payload.resize(size);
+	return payload;
+}
+
+static bool load_file(const char *path, std::string& data)
+{
+	FILE *fp = fopen(path, "rb");
+	char tmp[65536];
+	size_t n;
+
+	if (!fp)
+		return false;
+
+	while ((n = fread(tmp, 1, sizeof tmp, fp)) > 0)
+		data.append(tmp, n);
+
+	fclose(fp);
+	return true;
+}
+
+// write like the network does: many small pieces
+static void fill(RPCBuffer *buf, const char *data, size_t size)
+{
+	buf->set_piece_max_size(BUFFER_PIECE_MIN_SIZE);
+	buf->write(data, size);
+	buf->set_piece_max_size(BUFFER_PIECE_MAX_SIZE);
+}
+
+static double mb_per_sec(size_t bytes, int64_t ns)
+{
+	return ns > 0 ? bytes * 1000.0 / ns : 0;
+}
+
+static void report(const char *corpus, size_t size, int type,
+				   const char *variant, size_t compressed_size,
+				   size_t rounds, int64_t compress_ns, int64_t decompress_ns,
+				   size_t pieces, size_t piece_bytes, size_t news,
+				   const char *check)
+{
+	printf("%s\t%zu\t%s\t%s\t%.3lf\t%.1lf\t%.1lf\t%.1lf\t%zu\t%.1lf\t%s\n",
+		   corpus, size, type_name[type], variant,
+		   (double)compressed_size / size,
+		   mb_per_sec(size * rounds, compress_ns),
+		   mb_per_sec(size * rounds, decompress_ns),
+		   (double)pieces / rounds, piece_bytes / rounds,
+		   (double)news / rounds, check);
+}
+
+static bool bench_contiguous(const Corpus& corpus, size_t size, int type,
+							 size_t rounds)
+{
+	RPCCompressor *compressor = RPCCompressor::get_instance();
+	int lease = compressor->lease_compressed_size(type, size);
+	std::vector<char> buf(lease > 0 ? lease : 0);
+	std::vector<char> msg(size);
+	int64_t compress_ns;
+	int64_t decompress_ns;
+	size_t news;
+	int ret = 0;
+
+	if (lease <= 0)
+		return false;
+
+	news = new_count;
+	compress_ns = GET_CURRENT_NS;
+	for (size_t i = 0; i < rounds; i++)
+	{
+		ret = compressor->serialize_to_compressed(corpus.data.data(), size,
+												  buf.data(), buf.size(), type);
+		if (ret <= 0)
+		{
+			fprintf(stderr, "%s %s compress failed %d\n",
+					corpus.name.c_str(), type_name[type], ret);
+			return false;
+		}
+	}
+
+	compress_ns = GET_CURRENT_NS - compress_ns;
+	size_t compressed_size = ret;
+
+	decompress_ns = GET_CURRENT_NS;
+	for (size_t i = 0; i < rounds; i++)
+	{
+		ret = compressor->parse_from_compressed(buf.data(), compressed_size,
+												msg.data(), size, type);
+		if (ret != (int)size)
+		{
+			fprintf(stderr, "%s %s decompress failed %d\n",
+					corpus.name.c_str(), type_name[type], ret);
+			return false;
+		}
+	}
+
+	decompress_ns = GET_CURRENT_NS - decompress_ns;
+	news = new_count - news;
+
+	if (memcmp(msg.data(), corpus.data.data(), size) != 0)
+	{
+		fprintf(stderr, "%s %s data mismatch\n",
+				corpus.name.c_str(), type_name[type]);
+		return false;
+	}
+
+	report(corpus.name.c_str(), size, type, "contiguous", compressed_size,
+		   rounds, compress_ns, decompress_ns, 0, 0, news, "-");
+	return true;
+}
+
+/*
+ * Allocated bytes should follow the output, never another whole copy.
+ * Only checked for large messages, small ones are one piece anyway.
+ */
+static bool linearized(size_t out_size, size_t allocated)
+{
+	size_t slack = 2 * BUFFER_PIECE_MAX_SIZE + out_size / 4;
+
+	return out_size >= 1024 * 1024 && allocated > out_size + slack;
+}
+
+static bool bench_iovec(const Corpus& corpus, size_t size, int type,
+						size_t rounds)
+{
+	RPCCompressor *compressor = RPCCompressor::get_instance();
+	CountingAllocator counter;
+	RPCBuffer src;
+	std::string data;
+	int64_t compress_ns = 0;
+	int64_t decompress_ns = 0;
+	int64_t ns_st;
+	size_t pieces = 0;
+	size_t piece_bytes = 0;
+	size_t compressed_size = 0;
+	size_t news = 0;
+	size_t news_st;
+	bool ok = true;
+	int ret;
+
+	fill(&src, corpus.data.data(), size);
+	for (size_t i = 0; i < rounds; i++)
+	{
+		RPCBuffer compressed;
+
+		compressed.set_allocator(&counter);
+		src.rewind();
+		counter.reset();
+		news_st = new_count;
+		ns_st = GET_CURRENT_NS;
+		ret = compressor->serialize_to_compressed(&src, &compressed, type);
+		compress_ns += GET_CURRENT_NS - ns_st;
+		news += new_count - news_st;
+		if (ret <= 0)
+		{
+			fprintf(stderr, "%s %s compress failed %d\n",
+					corpus.name.c_str(), type_name[type], ret);
+			return false;
+		}
+
+		pieces += counter.count;
+		piece_bytes += counter.allocated;
+		compressed_size = compressed.size();
+		ok = !linearized(compressed_size, counter.allocated) && ok;
+
+		// decompress from small pieces too
+		RPCBuffer in;
+		RPCBuffer out;
+
+		data.resize(compressed_size);
+		compressed.read(&data[0], data.size());
+		fill(&in, data.data(), data.size());
+		out.set_allocator(&counter);
+		counter.reset();
+		news_st = new_count;
+		ns_st = GET_CURRENT_NS;
+		ret = compressor->parse_from_compressed(&in, &out, type);
+		decompress_ns += GET_CURRENT_NS - ns_st;
+		news += new_count - news_st;
+		if (ret != (int)size || out.size() != size)
+		{
+			fprintf(stderr, "%s %s decompress failed %d\n",
+					corpus.name.c_str(), type_name[type], ret);
+			return false;
+		}
+
+		pieces += counter.count;
+		piece_bytes += counter.allocated;
+		ok = !linearized(size, counter.allocated) && ok;
+
+		if (i == 0)
+		{
+			data.resize(size);
+			out.read(&data[0], data.size());
+			if (memcmp(data.data(), corpus.data.data(), size) != 0)
+			{
+				fprintf(stderr, "%s %s data mismatch\n",
+						corpus.name.c_str(), type_name[type]);
+				return false;
+			}
+		}
+	}
+
+	report(corpus.name.c_str(), size, type, "iovec", compressed_size,
+		   rounds, compress_ns, decompress_ns, pieces, piece_bytes, news,
+		   ok ? "ok" : "LINEARIZED");
+	return ok;
+}
+
+/*
+ * Usage: compress_bench [MAX_SIZE] [CORPUS_FILE]...
+ * Every registered compress type runs on every corpus, from 64B to
+ * MAX_SIZE (64MB by default) by 16 times. A file is cut into the sizes
+ * not larger than itself. Exit with 1 if any codec failed or copied the
+ * whole message into one piece.
+ */
+int main(int argc, char *argv[])
+{
+	RPCCompressor *compressor = RPCCompressor::get_instance();
+	size_t max_size = 64 * 1024 * 1024;
+	std::vector<Corpus> corpora;
+	bool ok = true;
+
+	if (argc > 1)
+		max_size = strtoul(argv[1], NULL, 10);
+
+	corpora.push_back({"protobuf", make_protobuf(max_size)});
+	corpora.push_back({"json", make_json(max_size)});
+	corpora.push_back({"random", make_random(max_size)});
+	corpora.push_back({"text", make_text(max_size)});
+	for (int i = 2; i < argc; i++)
+	{
+		Corpus corpus = {argv[i], ""};
+
+		if (!load_file(argv[i], corpus.data))
+		{
+			fprintf(stderr, "can not read %s\n", argv[i]);
+			return 1;
+		}
+
+		corpora.push_back(std::move(corpus));
+	}
+
+	printf("corpus\tsize\ttype\tvariant\tratio\tcomp_MB/s\tdecomp_MB/s"
+		   "\tpieces/op\tpiece_bytes/op\tnews/op\tcheck\n");
+	for (const Corpus& corpus : corpora)
+	{
+		for (size_t size = 64; size <= max_size && size <= corpus.data.size();
+			 size *= 16)
+		{
+			size_t rounds = ROUND_BYTES / size;
+
+			if (rounds > ROUND_MAX)
+				rounds = ROUND_MAX;
+			else if (rounds == 0)
+				rounds = 1;
+
+			for (int type = RPCCompressNone + 1; type < RPCCompressMax; type++)
+			{
+				if (!compressor->find_handler(type))
+					continue;
+
+				ok = bench_contiguous(corpus, size, type, rounds) && ok;
+				ok = bench_iovec(corpus, size, type, rounds) && ok;
+			}
+
+			fflush(stdout);
+		}
+	}
+
+	return ok ? 0 : 1;
+}
+
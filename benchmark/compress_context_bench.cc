@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include <zlib.h>
+#include "lz4frame.h"
+#include "srpc/rpc_buffer.h"
+#include "srpc/rpc_compress.h"
+
+using namespace srpc;
+
+#define GET_CURRENT_NS	std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+
+static const size_t MESSAGE_SIZE = 1024;
+static const size_t OUT_SIZE = 4096;
+
+static const char *type_name[RPCCompressMax] = {
+	"none", "snappy", "gzip", "zlib", "lz4", "zstd"
+};
+
+static LZ4F_preferences_t lz4_prefs;
+
+// semi-compressible: words with random letters between
+static std::string make_payload(size_t size)
+{
+	static const char *words[] = { "alpha ", "beta ", "gamma ", "delta " };
+	std::string payload;
+
+	srand(1);
+	payload.reserve(size + 8);
+	while (payload.size() < size)
+	{
+		payload += words[rand() % 4];
+		if (rand() % 3 == 0)
+			payload.push_back('a' + rand() % 26);
+	}
+
+	payload.resize(size);
+	return payload;
+}
+
+/*
+ * one message with z_stream, init and end for every message
+ * as zlib/gzip of srpc did before, or reset only when reused
+ */
+static int zlib_compress(z_stream *stream, bool fresh, int format,
+						 const std::string& in, char *out)
+{
+	if (fresh)
+	{
+		memset(stream, 0, sizeof (z_stream));
+		if (deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+						 15 | format, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return -1;
+	}
+	else if (deflateReset(stream) != Z_OK)
+		return -1;
+
+	stream->next_in = (Bytef *)in.data();
+	stream->avail_in = (uInt)in.size();
+	stream->next_out = (Bytef *)out;
+	stream->avail_out = (uInt)OUT_SIZE;
+	if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+		return -1;
+
+	if (fresh && deflateEnd(stream) != Z_OK)
+		return -1;
+
+	return (int)stream->total_out;
+}
+
+static int zlib_decompress(z_stream *stream, bool fresh,
+						   const char *in, size_t in_len, char *out)
+{
+	if (fresh)
+	{
+		memset(stream, 0, sizeof (z_stream));
+		if (inflateInit2(stream, 15 | 32) != Z_OK)
+			return -1;
+	}
+	else if (inflateReset(stream) != Z_OK)
+		return -1;
+
+	stream->next_in = (Bytef *)in;
+	stream->avail_in = (uInt)in_len;
+	stream->next_out = (Bytef *)out;
+	stream->avail_out = (uInt)OUT_SIZE;
+	if (inflate(stream, Z_FINISH) != Z_STREAM_END)
+		return -1;
+
+	if (fresh && inflateEnd(stream) != Z_OK)
+		return -1;
+
+	return (int)stream->total_out;
+}
+
+// one LZ4 frame, with a new cctx for every message or the same one
+static int lz4_compress(LZ4F_cctx **ctx, bool fresh,
+						const std::string& in, char *out)
+{
+	size_t total;
+	size_t ret;
+
+	if (fresh && LZ4F_isError(LZ4F_createCompressionContext(ctx, LZ4F_VERSION)))
+		return -1;
+
+	ret = LZ4F_compressBegin(*ctx, out, OUT_SIZE, &lz4_prefs);
+	if (LZ4F_isError(ret))
+		return -1;
+
+	total = ret;
+	ret = LZ4F_compressUpdate(*ctx, out + total, OUT_SIZE - total,
+							  in.data(), in.size(), NULL);
+	if (LZ4F_isError(ret))
+		return -1;
+
+	total += ret;
+	ret = LZ4F_compressEnd(*ctx, out + total, OUT_SIZE - total, NULL);
+	if (LZ4F_isError(ret))
+		return -1;
+
+	total += ret;
+	if (fresh)
+		LZ4F_freeCompressionContext(*ctx);
+
+	return (int)total;
+}
+
+static int lz4_decompress(LZ4F_dctx **ctx, bool fresh,
+						  const char *in, size_t in_len, char *out)
+{
+	size_t out_len = OUT_SIZE;
+	size_t ret;
+
+	if (fresh)
+	{
+		if (LZ4F_isError(LZ4F_createDecompressionContext(ctx, LZ4F_VERSION)))
+			return -1;
+	}
+	else
+		LZ4F_resetDecompressionContext(*ctx);
+
+	ret = LZ4F_decompress(*ctx, out, &out_len, in, &in_len, NULL);
+	if (ret != 0)
+		return -1;
+
+	if (fresh)
+		LZ4F_freeDecompressionContext(*ctx);
+
+	return (int)out_len;
+}
+
+static void report(const char *name, const char *op, const char *mode,
+				   int64_t ns, int times)
+{
+	fprintf(stderr, "%s\t%s\t%s\t%.1lf\tns/msg\n",
+			name, op, mode, (double)ns / times);
+}
+
+static bool bench_zlib(int type, int format, const std::string& payload,
+					   int times)
+{
+	char out[OUT_SIZE];
+	char back[OUT_SIZE];
+	z_stream c_stream;
+	z_stream d_stream;
+	int64_t ns_st;
+	int len = 0;
+	bool ok = true;
+
+	for (int fresh = 1; fresh >= 0; fresh--)
+	{
+		memset(&c_stream, 0, sizeof (z_stream));
+		memset(&d_stream, 0, sizeof (z_stream));
+		if (!fresh)
+		{
+			deflateInit2(&c_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+						 15 | format, 8, Z_DEFAULT_STRATEGY);
+			inflateInit2(&d_stream, 15 | 32);
+		}
+
+		ns_st = GET_CURRENT_NS;
+		for (int i = 0; i < times; i++)
+			len = zlib_compress(&c_stream, fresh, format, payload, out);
+
+		report(type_name[type], "compress", fresh ? "fresh" : "reused",
+			   GET_CURRENT_NS - ns_st, times);
+		ok = len > 0 && ok;
+
+		ns_st = GET_CURRENT_NS;
+		for (int i = 0; i < times && ok; i++)
+			ok = zlib_decompress(&d_stream, fresh, out, len, back) == (int)payload.size();
+
+		report(type_name[type], "decompress", fresh ? "fresh" : "reused",
+			   GET_CURRENT_NS - ns_st, times);
+		ok = ok && memcmp(back, payload.data(), payload.size()) == 0;
+
+		if (!fresh)
+		{
+			deflateEnd(&c_stream);
+			inflateEnd(&d_stream);
+		}
+	}
+
+	return ok;
+}
+
+static bool bench_lz4(const std::string& payload, int times)
+{
+	char out[OUT_SIZE];
+	char back[OUT_SIZE];
+	LZ4F_cctx *cctx = NULL;
+	LZ4F_dctx *dctx = NULL;
+	int64_t ns_st;
+	int len = 0;
+	bool ok = true;
+
+	memset(&lz4_prefs, 0, sizeof lz4_prefs);
+	lz4_prefs.frameInfo.blockSizeID = LZ4F_max256KB;
+	lz4_prefs.autoFlush = 1;
+
+	for (int fresh = 1; fresh >= 0; fresh--)
+	{
+		if (!fresh)
+		{
+			LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+			LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+		}
+
+		ns_st = GET_CURRENT_NS;
+		for (int i = 0; i < times; i++)
+			len = lz4_compress(&cctx, fresh, payload, out);
+
+		report("lz4", "compress", fresh ? "fresh" : "reused",
+			   GET_CURRENT_NS - ns_st, times);
+		ok = len > 0 && ok;
+
+		ns_st = GET_CURRENT_NS;
+		for (int i = 0; i < times && ok; i++)
+			ok = lz4_decompress(&dctx, fresh, out, len, back) == (int)payload.size();
+
+		report("lz4", "decompress", fresh ? "fresh" : "reused",
+			   GET_CURRENT_NS - ns_st, times);
+		ok = ok && memcmp(back, payload.data(), payload.size()) == 0;
+
+		if (!fresh)
+		{
+			LZ4F_freeCompressionContext(cctx);
+			LZ4F_freeDecompressionContext(dctx);
+		}
+	}
+
+	return ok;
+}
+
+// the whole path of srpc, with contexts of this thread reused
+static bool bench_srpc(int type, const std::string& payload, int times)
+{
+	RPCCompressor *compressor = RPCCompressor::get_instance();
+	int64_t ns_st;
+	int64_t ns_compress = 0;
+	int64_t ns_decompress = 0;
+	int ret;
+
+	for (int i = 0; i < times; i++)
+	{
+		RPCBuffer src;
+		RPCBuffer compressed;
+		RPCBuffer out;
+
+		src.append(payload.data(), payload.size(), BUFFER_MODE_NOCOPY);
+		ns_st = GET_CURRENT_NS;
+		ret = compressor->serialize_to_compressed(&src, &compressed, type);
+		ns_compress += GET_CURRENT_NS - ns_st;
+		if (ret <= 0)
+			return false;
+
+		ns_st = GET_CURRENT_NS;
+		ret = compressor->parse_from_compressed(&compressed, &out, type);
+		ns_decompress += GET_CURRENT_NS - ns_st;
+		if (ret != (int)payload.size())
+			return false;
+	}
+
+	report(type_name[type], "compress", "srpc", ns_compress, times);
+	report(type_name[type], "decompress", "srpc", ns_decompress, times);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int times = argc > 1 ? atoi(argv[1]) : 100000;
+	std::string payload = make_payload(MESSAGE_SIZE);
+	bool ok = true;
+
+	if (times <= 0)
+	{
+		fprintf(stderr, "Usage: %s [TIMES]\n", argv[0]);
+		return 1;
+	}
+
+	fprintf(stderr, "%zu bytes message, %d times\n", payload.size(), times);
+	ok = bench_zlib(RPCCompressGzip, 16, payload, times) && ok;
+	ok = bench_zlib(RPCCompressZlib, 0, payload, times) && ok;
+	ok = bench_lz4(payload, times) && ok;
+
+	for (int type = RPCCompressNone + 1; type < RPCCompressMax; type++)
+	{
+		if (RPCCompressor::get_instance()->find_handler(type))
+			ok = bench_srpc(type, payload, times) && ok;
+	}
+
+	return ok ? 0 : 1;
+}
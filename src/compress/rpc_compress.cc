@@ -18,6 +18,7 @@
 #include "rpc_compress_gzip.h"
 #include "rpc_compress_snappy.h"
 #include "rpc_compress_lz4.h"
+#include "rpc_compress_zstd.h"
 
 namespace srpc
 {
@@ -52,6 +53,8 @@ int RPCCompressor::add(RPCCompressType type)
 		this->handler[type].decompress = GzipDecompress;
 		this->handler[type].compress_iovec = GzipCompressIOVec;
 		this->handler[type].decompress_iovec = GzipDecompressIOVec;
+		this->handler[type].decompress_stream_begin = GzipDecompressStreamBegin;
+		this->handler[type].decompress_stream = GzipDecompressStream;
 		this->handler[type].lease_size = GzipLeaseSize;
 		break;
 	case RPCCompressZlib:
@@ -59,6 +62,8 @@ int RPCCompressor::add(RPCCompressType type)
 		this->handler[type].decompress = ZlibDecompress;
 		this->handler[type].compress_iovec = ZlibCompressIOVec;
 		this->handler[type].decompress_iovec = ZlibDecompressIOVec;
+		this->handler[type].decompress_stream_begin = ZlibDecompressStreamBegin;
+		this->handler[type].decompress_stream = ZlibDecompressStream;
 		this->handler[type].lease_size = ZlibLeaseSize;
 		break;
 	case RPCCompressLz4:
@@ -66,8 +71,27 @@ int RPCCompressor::add(RPCCompressType type)
 		this->handler[type].decompress = LZ4Decompress;
 		this->handler[type].compress_iovec = LZ4CompressIOVec;
 		this->handler[type].decompress_iovec = LZ4DecompressIOVec;
+		this->handler[type].decompress_stream_begin = LZ4DecompressStreamBegin;
+		this->handler[type].decompress_stream = LZ4DecompressStream;
 		this->handler[type].lease_size = LZ4LeaseSize;
 		break;
+	case RPCCompressZstd:
+#ifdef SRPC_HAS_ZSTD
+		this->handler[type].compress = ZstdManager::ZstdCompress;
+		this->handler[type].decompress = ZstdManager::ZstdDecompress;
+		this->handler[type].compress_iovec = ZstdManager::ZstdCompressIOVec;
+		this->handler[type].decompress_iovec = ZstdManager::ZstdDecompressIOVec;
+		this->handler[type].lease_size = ZstdManager::ZstdLeaseSize;
+		this->handler[type].add_dict = ZstdManager::ZstdAddDict;
+		this->handler[type].compress_iovec_dict = ZstdManager::ZstdCompressIOVecDict;
+		this->handler[type].decompress_iovec_dict = ZstdManager::ZstdDecompressIOVecDict;
+		this->handler[type].decompress_stream_begin = ZstdManager::ZstdDecompressStreamBegin;
+		this->handler[type].decompress_stream = ZstdManager::ZstdDecompressStream;
+#else
+		// built without libzstd
+		ret = -2;
+#endif
+		break;
 	default:
 		ret = -2;
 		break;
@@ -76,5 +100,31 @@ int RPCCompressor::add(RPCCompressType type)
 	return ret;
 }
 
+int RPCCompressor::set_level(int type, int level)
+{
+	switch (type)
+	{
+#ifdef SRPC_HAS_ZSTD
+	case RPCCompressZstd:
+		return ZstdManager::set_level(level);
+#endif
+	default:
+		return -2;
+	}
+}
+
+int RPCCompressor::set_chunk_size(int type, size_t chunk_size)
+{
+	switch (type)
+	{
+#ifdef SRPC_HAS_ZSTD
+	case RPCCompressZstd:
+		return ZstdManager::set_chunk_size(chunk_size);
+#endif
+	default:
+		return -2;
+	}
+}
+
 } // namespace srpc
 
@@ -28,6 +28,11 @@ using DecompressFunction = int (*)(const char *, size_t, char *, size_t);
 using CompressIOVecFunction = int (*)(RPCBuffer *, RPCBuffer *);
 using DempressIOVecFunction = int (*)(RPCBuffer *, RPCBuffer *);
 using LeaseSizeFunction = int (*)(size_t);
+using AddDictFunction = int (*)(unsigned int, const void *, size_t);
+using CompressIOVecDictFunction = int (*)(RPCBuffer *, RPCBuffer *, unsigned int);
+using DecompressIOVecDictFunction = int (*)(RPCBuffer *, RPCBuffer *, unsigned int);
+using DecompressStreamBeginFunction = void *(*)(RPCBuffer *, unsigned int);
+using DecompressStreamFunction = int (*)(void *, const void *, size_t *, void *, size_t *);
 
 class CompressHandler
 {
@@ -40,6 +45,11 @@ public:
 		this->compress_iovec = nullptr;
 		this->decompress_iovec = nullptr;
 		this->lease_size = nullptr;
+		this->add_dict = nullptr;
+		this->compress_iovec_dict = nullptr;
+		this->decompress_iovec_dict = nullptr;
+		this->decompress_stream_begin = nullptr;
+		this->decompress_stream = nullptr;
 	}
 
 	//int type;
@@ -48,6 +58,17 @@ public:
 	CompressIOVecFunction compress_iovec;
 	DempressIOVecFunction decompress_iovec;
 	LeaseSizeFunction lease_size;	
+	// optional, for the types support dictionaries
+	AddDictFunction add_dict;
+	CompressIOVecDictFunction compress_iovec_dict;
+	DecompressIOVecDictFunction decompress_iovec_dict;
+	// optional, for the types can be decompressed piece by piece by parser.
+	// begin returns the context of this thread for the data in src and
+	// dict_id, NULL if failed or the data is better decompressed at once.
+	// stream updates in/out lengths to the consumed and produced,
+	// returns 0 at the end of data, 1 for more, -1 if failed
+	DecompressStreamBeginFunction decompress_stream_begin;
+	DecompressStreamFunction decompress_stream;
 };
 
 class RPCCompressor
@@ -65,12 +86,17 @@ public:
 	// 		-2, invalid compress type or decompress function
 	int parse_from_compressed(const char *buf, size_t buflen, char *msg, size_t msglen, int type) const;
 	int parse_from_compressed(RPCBuffer *src, RPCBuffer *dest, int type) const;
+	// dict_id 0 means no dictionary
+	int parse_from_compressed(RPCBuffer *src, RPCBuffer *dest, int type,
+							  unsigned int dict_id) const;
 
 	// serialized to compressed data
 	// 		-1: error
 	// 		-2, invalid compress type or compress function
 	int serialize_to_compressed(const char *msg, size_t msglen, char *buf, size_t buflen, int type) const;
 	int serialize_to_compressed(RPCBuffer *src, RPCBuffer *dest, int type) const;
+	int serialize_to_compressed(RPCBuffer *src, RPCBuffer *dest, int type,
+								unsigned int dict_id) const;
 
 	/*
 	 * ret: >0: the theoretically lease size of compressed data
@@ -95,6 +121,36 @@ public:
 	 */
 	int add_handler(int type, CompressHandler&& handler);
 
+	/*
+	 * Set compression level of the types which have levels, now only zstd
+	 * ret:  0, success
+	 * 		-1, invalid level for this type
+	 * 		-2, invalid compress type or type without level
+	 */
+	int set_level(int type, int level);
+
+	/*
+	 * Compress the payloads larger than chunk_size in independent chunks
+	 * on compute threads in parallel, and decompress the received chunks
+	 * in parallel too. Now only zstd, whose chunks are standard frames
+	 * after a skippable one, so any zstd decoder reads them in order.
+	 * chunk_size 0 means never, which is the default.
+	 * ret:  0, success
+	 * 		-1, invalid chunk_size for this type
+	 * 		-2, invalid compress type or type without chunks
+	 */
+	int set_chunk_size(int type, size_t chunk_size);
+
+	/*
+	 * Load a dictionary for type, both sides load the same one by dict_id.
+	 * The dictionary is copied, and stays until the process exits.
+	 * dict_id 0 means the id inside the dictionary, such as zstd's.
+	 * ret: >0, dict_id loaded
+	 * 		-1, invalid or existed dictionary
+	 * 		-2, invalid compress type or type without dictionary
+	 */
+	int add_dict(int type, unsigned int dict_id, const void *dict, size_t size);
+
 	const CompressHandler *find_handler(int type) const;
 
 	// clear all the registed handler
@@ -107,6 +163,7 @@ private:
 		this->add(RPCCompressZlib);
 		this->add(RPCCompressSnappy);
 		this->add(RPCCompressLz4);
+		this->add(RPCCompressZstd);
 	}
 
 	CompressHandler handler[RPCCompressMax];
@@ -199,7 +256,7 @@ inline int RPCCompressor::serialize_to_compressed(RPCBuffer *src, RPCBuffer *des
 {
 	if (type >= RPCCompressMax
 		|| type <= RPCCompressNone
-		|| !this->handler[type].compress)
+		|| !this->handler[type].compress_iovec)
 	{
 		return -2;
 	}
@@ -207,6 +264,51 @@ inline int RPCCompressor::serialize_to_compressed(RPCBuffer *src, RPCBuffer *des
 	return this->handler[type].compress_iovec(src, dest);
 }
 
+inline int RPCCompressor::parse_from_compressed(RPCBuffer *src, RPCBuffer *dest,
+												int type, unsigned int dict_id) const
+{
+	if (dict_id == 0)
+		return this->parse_from_compressed(src, dest, type);
+
+	if (type >= RPCCompressMax
+		|| type <= RPCCompressNone
+		|| !this->handler[type].decompress_iovec_dict)
+	{
+		return -2;
+	}
+
+	return this->handler[type].decompress_iovec_dict(src, dest, dict_id);
+}
+
+inline int RPCCompressor::serialize_to_compressed(RPCBuffer *src, RPCBuffer *dest,
+												  int type, unsigned int dict_id) const
+{
+	if (dict_id == 0)
+		return this->serialize_to_compressed(src, dest, type);
+
+	if (type >= RPCCompressMax
+		|| type <= RPCCompressNone
+		|| !this->handler[type].compress_iovec_dict)
+	{
+		return -2;
+	}
+
+	return this->handler[type].compress_iovec_dict(src, dest, dict_id);
+}
+
+inline int RPCCompressor::add_dict(int type, unsigned int dict_id,
+								   const void *dict, size_t size)
+{
+	if (type >= RPCCompressMax
+		|| type <= RPCCompressNone
+		|| !this->handler[type].add_dict)
+	{
+		return -2;
+	}
+
+	return this->handler[type].add_dict(dict_id, dict, size);
+}
+
 inline int RPCCompressor::lease_compressed_size(int type, size_t origin_size) const
 {
 	if (type >= RPCCompressMax
@@ -227,6 +329,11 @@ inline void RPCCompressor::clear()
 		this->handler[i].compress = nullptr;
 		this->handler[i].decompress = nullptr;
 		this->handler[i].lease_size = nullptr;
+		this->handler[i].add_dict = nullptr;
+		this->handler[i].compress_iovec_dict = nullptr;
+		this->handler[i].decompress_iovec_dict = nullptr;
+		this->handler[i].decompress_stream_begin = nullptr;
+		this->handler[i].decompress_stream = nullptr;
 	}
 }
 
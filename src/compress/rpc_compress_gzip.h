@@ -19,6 +19,7 @@
 
 //#include <google/protobuf/io/gzip_stream.h>
 //#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <string.h>
 #include <zlib.h>
 #include "rpc_basic.h"
 
@@ -31,6 +32,11 @@
 #define GzipDecompressIOVec CommonDecompressIOVec
 #define ZlibDecompressIOVec CommonDecompressIOVec
 
+#define GzipDecompressStreamBegin CommonDecompressStreamBegin
+#define ZlibDecompressStreamBegin CommonDecompressStreamBegin
+#define GzipDecompressStream CommonDecompressStream
+#define ZlibDecompressStream CommonDecompressStream
+
 namespace srpc
 {
 
@@ -40,6 +46,82 @@ static constexpr int OPTION_FORMAT_ZLIB		= 0;
 static constexpr int OPTION_FORMAT_GZIP		= 16;
 static constexpr int OPTION_FORMAT_AUTO		= 32;
 
+/*
+ * z_streams of each thread, reset between messages
+ * instead of init and end for every message
+ */
+class RPCZlibContext
+{
+public:
+	static RPCZlibContext *get_instance()
+	{
+		static thread_local RPCZlibContext kInstance;
+		return &kInstance;
+	}
+
+	// ret: NULL if failed, or a deflate stream ready for a new message
+	z_stream *get_deflate(int option_format)
+	{
+		int i = (option_format == OPTION_FORMAT_GZIP) ? 1 : 0;
+		z_stream *stream = &this->c_stream[i];
+
+		if (this->c_inited[i])
+			return deflateReset(stream) == Z_OK ? stream : NULL;
+
+		memset(stream, 0, sizeof (z_stream));
+		if (deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+						 WINDOW_BITS | option_format, 8,
+						 Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			return NULL;
+		}
+
+		this->c_inited[i] = true;
+		return stream;
+	}
+
+	// ret: NULL if failed, or an inflate stream ready for a new message
+	z_stream *get_inflate()
+	{
+		z_stream *stream = &this->d_stream;
+
+		if (this->d_inited)
+			return inflateReset(stream) == Z_OK ? stream : NULL;
+
+		memset(stream, 0, sizeof (z_stream));
+		if (inflateInit2(stream, WINDOW_BITS | OPTION_FORMAT_AUTO) != Z_OK)
+			return NULL;
+
+		this->d_inited = true;
+		return stream;
+	}
+
+private:
+	RPCZlibContext()
+	{
+		this->c_inited[0] = false;
+		this->c_inited[1] = false;
+		this->d_inited = false;
+	}
+
+	~RPCZlibContext()
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			if (this->c_inited[i])
+				deflateEnd(&this->c_stream[i]);
+		}
+
+		if (this->d_inited)
+			inflateEnd(&this->d_stream);
+	}
+
+	z_stream c_stream[2];
+	z_stream d_stream;
+	bool c_inited[2];
+	bool d_inited;
+};
+
 /*
 static int protobuf_stream_compress(const ProtobufIDLMessage* msg, char *buf, size_t buflen,
 									int compress_type)
@@ -104,54 +186,37 @@ static int CommonCompress(const char *msg, size_t msglen,
 	if (!msg)
 		return 0;
 
-	z_stream c_stream;
+	z_stream *c_stream = RPCZlibContext::get_instance()->get_deflate(option_format);
 
-	c_stream.zalloc = (alloc_func)0;
-	c_stream.zfree = (free_func)0;
-	c_stream.opaque = (voidpf)0;
-
-	if(deflateInit2(&c_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-					WINDOW_BITS | option_format, 8,
-					Z_DEFAULT_STRATEGY) != Z_OK)
-	{
+	if (!c_stream)
 		return -1;
-	}
 
-	c_stream.next_in = (Bytef *)msg;
-	c_stream.avail_in = msglen;
-	c_stream.next_out = (Bytef *)buf;
-	c_stream.avail_out = (uInt)buflen;
+	c_stream->next_in = (Bytef *)msg;
+	c_stream->avail_in = msglen;
+	c_stream->next_out = (Bytef *)buf;
+	c_stream->avail_out = (uInt)buflen;
 
-	while (c_stream.avail_in != 0 && c_stream.total_in < buflen) 
+	while (c_stream->avail_in != 0 && c_stream->total_in < buflen) 
 	{
-		if (deflate(&c_stream, Z_NO_FLUSH) != Z_OK)
-		{
-			deflateEnd(&c_stream);
+		if (deflate(c_stream, Z_NO_FLUSH) != Z_OK)
 			return -1;
-		}
 	}
 
-	if (c_stream.avail_in != 0)
-		return c_stream.avail_in;
+	if (c_stream->avail_in != 0)
+		return c_stream->avail_in;
 
 	for (;;)
 	{
-		int err = deflate(&c_stream, Z_FINISH);
+		int err = deflate(c_stream, Z_FINISH);
 
 		if(err == Z_STREAM_END)
 			break;
 
 		if(err != Z_OK)
-		{
-			deflateEnd(&c_stream);
 			return -1;
-		}
 	}
 
-	if (deflateEnd(&c_stream) != Z_OK)
-		return -1;
-
-	return c_stream.total_out;
+	return c_stream->total_out;
 }
 
 /*
@@ -188,51 +253,40 @@ static constexpr unsigned char dummy_head[2] =
 static int CommonDecompress(const char *buf, size_t buflen, char *msg, size_t msglen)
 {
 	int err;
-	z_stream d_stream = {0}; /* decompression stream */
-
-	d_stream.zalloc = (alloc_func)0;
-	d_stream.zfree = (free_func)0;
-	d_stream.opaque = (voidpf)0;
-	d_stream.next_in = (Bytef *)buf;
-	d_stream.avail_in = 0;
-	d_stream.next_out = (Bytef *)msg;
-	if (inflateInit2(&d_stream, WINDOW_BITS | OPTION_FORMAT_AUTO) != Z_OK)
+	z_stream *d_stream = RPCZlibContext::get_instance()->get_inflate();
+
+	if (!d_stream)
 		return -1;
 
-	while (d_stream.total_out < msglen && d_stream.total_in < buflen)
+	d_stream->next_in = (Bytef *)buf;
+	d_stream->avail_in = 0;
+	d_stream->next_out = (Bytef *)msg;
+
+	while (d_stream->total_out < msglen && d_stream->total_in < buflen)
 	{
-		d_stream.avail_in = d_stream.avail_out = (uInt)msglen;
-		err = inflate(&d_stream, Z_NO_FLUSH);
+		d_stream->avail_in = d_stream->avail_out = (uInt)msglen;
+		err = inflate(d_stream, Z_NO_FLUSH);
 		if(err == Z_STREAM_END)
 			break;
 
 		if (err != Z_OK)
 		{
 			if (err != Z_DATA_ERROR)
-			{
-				inflateEnd(&d_stream);
 				return -1;
-			}
 
-			d_stream.next_in = (Bytef*) dummy_head;
-			d_stream.avail_in = sizeof (dummy_head);
-			if (inflate(&d_stream, Z_NO_FLUSH) != Z_OK)
-			{
-				inflateEnd(&d_stream);
+			d_stream->next_in = (Bytef*) dummy_head;
+			d_stream->avail_in = sizeof (dummy_head);
+			if (inflate(d_stream, Z_NO_FLUSH) != Z_OK)
 				return -1;
-			}
 		}
 	}
 
-	if (inflateEnd(&d_stream) != Z_OK)
-		return -1;
-
-	return d_stream.total_out;
+	return d_stream->total_out;
 }
 
 static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format)
 {
-	z_stream c_stream;
+	z_stream *c_stream = RPCZlibContext::get_instance()->get_deflate(option_format);
 	int err;
 	size_t total_alloc = 0;
 	const void *in;
@@ -240,84 +294,58 @@ static int CommonCompressIOVec(RPCBuffer *src, RPCBuffer *dst, int option_format
 	size_t buflen = src->size();
 	size_t out_len = buflen;
 
-	c_stream.zalloc = (alloc_func)0;
-	c_stream.zfree = (free_func)0;
-	c_stream.opaque = (voidpf)0;
-
-	if (deflateInit2(&c_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 
-					 WINDOW_BITS | option_format, 8,
-					 Z_DEFAULT_STRATEGY) != Z_OK)
-	{
+	if (!c_stream)
 		return -1;
-	}
 
-	c_stream.avail_in = 0;
-	c_stream.avail_out = 0;
+	c_stream->avail_in = 0;
+	c_stream->avail_out = 0;
 
-	while (c_stream.total_in < buflen)
+	while (c_stream->total_in < buflen)
 	{
-		if (c_stream.avail_in == 0)
+		if (c_stream->avail_in == 0)
 		{
-			if ((c_stream.avail_in = (uInt)src->fetch(&in)) == 0)
-			{
-				deflateEnd(&c_stream);
+			if ((c_stream->avail_in = (uInt)src->fetch(&in)) == 0)
 				return -1;
-			}
 
-			c_stream.next_in = static_cast<Bytef *>(const_cast<void *>(in));
+			c_stream->next_in = static_cast<Bytef *>(const_cast<void *>(in));
 		}
 
-		if (c_stream.avail_out == 0)
+		if (c_stream->avail_out == 0)
 		{
 			if (dst->acquire(&out, &out_len) == false)
-			{
-				deflateEnd(&c_stream);
 				return -1;
-			}
 
 			total_alloc += out_len;
-			c_stream.next_out = static_cast<Bytef *>(out);
-			c_stream.avail_out = (uInt)out_len;
+			c_stream->next_out = static_cast<Bytef *>(out);
+			c_stream->avail_out = (uInt)out_len;
 		}
 
-		if (deflate(&c_stream, Z_NO_FLUSH) != Z_OK)
-		{
-			deflateEnd(&c_stream);
+		if (deflate(c_stream, Z_NO_FLUSH) != Z_OK)
 			return -1;
-		}
 	}
 
-//	if (c_stream.avail_in != 0)
-//		return c_stream.avail_in;
-
 	for (;;)
 	{
-		if (c_stream.avail_out == 0)
+		if (c_stream->avail_out == 0)
 		{
 			if (dst->acquire(&out, &out_len) == false)
 				return -1;
 
 			total_alloc += out_len;
-			c_stream.next_out  = static_cast<Bytef *>(out);
-			c_stream.avail_out = (uInt)out_len;
+			c_stream->next_out  = static_cast<Bytef *>(out);
+			c_stream->avail_out = (uInt)out_len;
 		}
 
-		err = deflate(&c_stream, Z_FINISH);
+		err = deflate(c_stream, Z_FINISH);
 		if(err == Z_STREAM_END)
 			break;
 
 		if(err != Z_OK)
-		{
-			deflateEnd(&c_stream);
 			return -1;
-		}
 	}
 
-	if (deflateEnd(&c_stream) != Z_OK)
-		return -1;
-
-	dst->backup(total_alloc - c_stream.total_out);
-	return c_stream.total_out;
+	dst->backup(total_alloc - c_stream->total_out);
+	return c_stream->total_out;
 }
 
 /*
@@ -347,77 +375,105 @@ static int ZlibCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
  */
 static int CommonDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 {
+	z_stream *d_stream = RPCZlibContext::get_instance()->get_inflate();
 	int err;
-	z_stream d_stream = { 0 }; /* decompression stream */
 	size_t total_alloc = 0;
 	const void *in;
 	void *out;
 	size_t buflen = src->size();
 	size_t out_len = buflen;
 
-	d_stream.zalloc = (alloc_func)0;
-	d_stream.zfree = (free_func)0;
-	d_stream.opaque = (voidpf)0;
-
-	if (inflateInit2(&d_stream, WINDOW_BITS | OPTION_FORMAT_AUTO) != Z_OK)
+	if (!d_stream)
 		return -1;
 
-	d_stream.avail_in = 0;
-	d_stream.avail_out = 0;
+	d_stream->avail_in = 0;
+	d_stream->avail_out = 0;
 
-	while (d_stream.total_in < buflen)
+	// piece by piece until the end of stream, output may be left in
+	// d_stream after all the input consumed
+	for (;;)
 	{
-		if (d_stream.avail_in == 0)
+		if (d_stream->avail_in == 0 && d_stream->total_in < buflen)
 		{
-			if ((d_stream.avail_in = (uInt)src->fetch(&in)) == 0)
-			{
-				inflateEnd(&d_stream);
+			if ((d_stream->avail_in = (uInt)src->fetch(&in)) == 0)
 				return -1;
-			}
 
-			d_stream.next_in = static_cast<Bytef *>(const_cast<void *>(in));
+			d_stream->next_in = static_cast<Bytef *>(const_cast<void *>(in));
 		}
 
-		if (d_stream.avail_out == 0)
+		if (d_stream->avail_out == 0)
 		{
 			if (dst->acquire(&out, &out_len) == false)
-			{
-				inflateEnd(&d_stream);
 				return -1;
-			}
 
 			total_alloc += out_len;
-			d_stream.next_out = static_cast<Bytef *>(out);
-			d_stream.avail_out = (uInt)out_len;
+			d_stream->next_out = static_cast<Bytef *>(out);
+			d_stream->avail_out = (uInt)out_len;
 		}
 
-		err = inflate(&d_stream, Z_NO_FLUSH);
+		err = inflate(d_stream, Z_NO_FLUSH);
 		if (err == Z_STREAM_END)
 			break;
 
 		if (err != Z_OK)
 		{
+			// Z_BUF_ERROR if the stream is truncated
 			if (err != Z_DATA_ERROR)
-			{
-				inflateEnd(&d_stream);
 				return -1;
-			}
 
-			d_stream.next_in = (Bytef*) dummy_head;
-			d_stream.avail_in = sizeof (dummy_head);
-			if (inflate(&d_stream, Z_NO_FLUSH) != Z_OK)
-			{
-				inflateEnd(&d_stream);
+			d_stream->next_in = (Bytef*) dummy_head;
+			d_stream->avail_in = sizeof (dummy_head);
+			if (inflate(d_stream, Z_NO_FLUSH) != Z_OK)
 				return -1;
-			}
 		}
 	}
 
-	if (inflateEnd(&d_stream) != Z_OK)
-		return -1;
+	dst->backup(total_alloc - d_stream->total_out);
+	return d_stream->total_out;
+}
+
+/*
+ * begin to inflate one message piece by piece, no dictionary for gzip/zlib
+ * ret: NULL if failed, or z_stream of this thread
+ */
+static void *CommonDecompressStreamBegin(RPCBuffer *src, unsigned int dict_id)
+{
+	if (dict_id != 0)
+		return NULL;
+
+	return RPCZlibContext::get_instance()->get_inflate();
+}
+
+/*
+ * inflate from in into out, in_len and out_len become consumed and produced
+ * ret: -1: failed
+ * 		 0: end of stream
+ * 		 1: need more input or output
+ */
+static int CommonDecompressStream(void *ctx, const void *in, size_t *in_len,
+								  void *out, size_t *out_len)
+{
+	z_stream *d_stream = static_cast<z_stream *>(ctx);
+	uInt avail_in = *in_len > 0x40000000 ? 0x40000000 : (uInt)*in_len;
+	uInt avail_out = *out_len > 0x40000000 ? 0x40000000 : (uInt)*out_len;
+	int err;
+
+	d_stream->next_in = static_cast<Bytef *>(const_cast<void *>(in));
+	d_stream->avail_in = avail_in;
+	d_stream->next_out = static_cast<Bytef *>(out);
+	d_stream->avail_out = avail_out;
+	err = inflate(d_stream, Z_NO_FLUSH);
+	*in_len = avail_in - d_stream->avail_in;
+	*out_len = avail_out - d_stream->avail_out;
+
+	if (err == Z_STREAM_END)
+		return 0;
+
+	// Z_BUF_ERROR is only no progress, the caller checks the lengths
+	if (err == Z_OK || err == Z_BUF_ERROR)
+		return 1;
 
-	dst->backup(total_alloc - d_stream.total_out);
-	return d_stream.total_out;
+	return -1;
 }
 
 /*
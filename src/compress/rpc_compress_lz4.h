@@ -24,7 +24,8 @@
 namespace srpc
 {
 
-//#define IN_CHUNK_SIZE  (16*1024)
+// bound of this size fits in one piece of RPCBuffer
+static constexpr size_t LZ4_IN_CHUNK_SIZE = 64 * 1024;
 
 static constexpr LZ4F_preferences_t kPrefs = {
 	{
@@ -37,11 +38,77 @@ static constexpr LZ4F_preferences_t kPrefs = {
 		LZ4F_noBlockChecksum
 	},
 	0,   /* compression level; 0 == default */
-	0,   /* autoflush */
+	1,   /* autoflush, keep nothing inside ctx */
 	0,   /* favor decompression speed */
 	{ 0, 0, 0 },  /* reserved, must be set to 0 */
 };
 
+/*
+ * with autoflush nothing is buffered inside ctx, so each chunk
+ * needs only itself, one block header and the room of end mark,
+ * which is much smaller than LZ4F_compressBound()
+ */
+static inline size_t __lz4_chunk_bound(size_t in_len)
+{
+	return in_len + 4 + 4;
+}
+
+/*
+ * LZ4F contexts of each thread, compressBegin() starts a new frame
+ * on the same cctx and dctx is reset before every message
+ */
+class RPCLZ4Context
+{
+public:
+	static RPCLZ4Context *get_instance()
+	{
+		static thread_local RPCLZ4Context kInstance;
+		return &kInstance;
+	}
+
+	// ret: NULL if failed
+	LZ4F_cctx *get_cctx()
+	{
+		if (!this->cctx &&
+			LZ4F_isError(LZ4F_createCompressionContext(&this->cctx, LZ4F_VERSION)))
+		{
+			this->cctx = NULL;
+		}
+
+		return this->cctx;
+	}
+
+	// ret: NULL if failed, or a dctx ready for a new frame
+	LZ4F_dctx *get_dctx()
+	{
+		if (this->dctx)
+			LZ4F_resetDecompressionContext(this->dctx);
+		else if (LZ4F_isError(LZ4F_createDecompressionContext(&this->dctx,
+															   LZ4F_VERSION)))
+		{
+			this->dctx = NULL;
+		}
+
+		return this->dctx;
+	}
+
+private:
+	RPCLZ4Context()
+	{
+		this->cctx = NULL;
+		this->dctx = NULL;
+	}
+
+	~RPCLZ4Context()
+	{
+		LZ4F_freeCompressionContext(this->cctx);
+		LZ4F_freeDecompressionContext(this->dctx);
+	}
+
+	LZ4F_cctx *cctx;
+	LZ4F_dctx *dctx;
+};
+
 /*
 static size_t get_block_size(const LZ4F_frameInfo_t* info)
 {
@@ -103,74 +170,54 @@ static int LZ4CompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 	size_t total_out;
 	size_t header_size;
 	size_t compressed_size;
-	LZ4F_cctx *ctx = NULL;
-	size_t const ctx_status = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
+	LZ4F_cctx *ctx = RPCLZ4Context::get_instance()->get_cctx();
 
-	if (LZ4F_isError(ctx_status))
-	{
-		LZ4F_freeCompressionContext(ctx);
+	if (!ctx)
 		return -1;
-	}
 
 	out_len = LZ4F_HEADER_SIZE_MAX;
-	if (dst->acquire(&out_buf, &out_len) == false)
-	{
-		LZ4F_freeCompressionContext(ctx);
+	out_buf = dst->acquire_contiguous(out_len);
+	if (!out_buf)
 		return -1;
-	}
 
 	// write frame header
 	header_size = LZ4F_compressBegin(ctx, out_buf, out_len, &kPrefs);
 	if (LZ4F_isError(header_size))
-	{
-		LZ4F_freeCompressionContext(ctx);
 		return -1;
-	}
 
 	dst->backup(out_len - header_size);
 	total_out = header_size;
-	//int count = 0;
-	// write every in_buf
-	while ((in_len = src->fetch(&in_buf)) != 0)
+	// write every in_buf, large piece is cut into chunks
+	in_len = LZ4_IN_CHUNK_SIZE;
+	while (src->fetch(&in_buf, &in_len) && in_len != 0)
 	{
-		//count++;
-		out_len = LZ4F_compressBound(in_len, &kPrefs);
-		if (dst->acquire(&out_buf, &out_len) == false)
-		{
-			LZ4F_freeCompressionContext(ctx);
+		out_len = __lz4_chunk_bound(in_len);
+		out_buf = dst->acquire_contiguous(out_len);
+		if (!out_buf)
 			return -1;
-		}
 
 		compressed_size = LZ4F_compressUpdate(ctx, out_buf, out_len,
 												   in_buf, in_len, NULL);
 		if (LZ4F_isError(compressed_size))
-		{
-			LZ4F_freeCompressionContext(ctx);
 			return -1;
-		}
 
 		dst->backup(out_len - compressed_size);
 		total_out += compressed_size;
+		in_len = LZ4_IN_CHUNK_SIZE;
 	}
 
 	// flush whatever remains within internal buffers
-	out_len = LZ4F_compressBound(0, &kPrefs);
-	if (dst->acquire(&out_buf, &out_len) == false)
-	{
-		LZ4F_freeCompressionContext(ctx);
+	out_len = __lz4_chunk_bound(0);
+	out_buf = dst->acquire_contiguous(out_len);
+	if (!out_buf)
 		return -1;
-	}
 
 	compressed_size = LZ4F_compressEnd(ctx, out_buf, out_len, NULL);
 	if (LZ4F_isError(compressed_size))
-	{
-		LZ4F_freeCompressionContext(ctx);
 		return -1;
-	}
 
 	dst->backup(out_len - compressed_size);
 	total_out += compressed_size;
-	LZ4F_freeCompressionContext(ctx);
 	return (int)total_out;
 }
 
@@ -188,14 +235,10 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 	size_t consumed_len;
 	size_t decompressed_size;
 	size_t total_out = 0;
-	LZ4F_dctx *dctx = NULL;
-	size_t const dctx_status = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+	LZ4F_dctx *dctx = RPCLZ4Context::get_instance()->get_dctx();
 
-	if (LZ4F_isError(dctx_status))
-	{
-		LZ4F_freeDecompressionContext(dctx);
+	if (!dctx)
 		return -1;
-	}
 
 	// get framed info
 	LZ4F_frameInfo_t info;
@@ -207,18 +250,12 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 														 &consumed_len);
 
 	if (LZ4F_isError(frame_info_ret))
-	{
-		LZ4F_freeDecompressionContext(dctx);
 		return -1;
-	}
 
 /*
 	size_t const dest_capacity = get_block_size(&info);
 	if (dest_capacity == 0)
-	{
-		LZ4F_freeDecompressionContext(ctx);
 		return -1;
-	}
 	fprintf(stderr, "get_block_size=%d\n", dest_capacity);
 */
 	size_t ret = 1;
@@ -235,19 +272,20 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 			first_chunk = false;
 		} else {
 			in_len = src->fetch(&in_buf);
+			// frame is not finished
+			if (in_len == 0)
+				return -1;
 		}
 
-		out_len = in_len;
 		start = (const char *)in_buf;
 		end = (const char *)in_buf + in_len;
 		consumed_len = 0;
 		while (start != end && ret != 0)
 		{
+			// output is larger than input, let it fill a whole piece
+			out_len = BUFFER_PIECE_MAX_SIZE;
 			if (dst->acquire(&out_buf, &out_len) == false)
-			{
-				LZ4F_freeDecompressionContext(dctx);
 				return -1;
-			}
 
  			decompressed_size = out_len;
 			consumed_len = end - start;
@@ -255,10 +293,7 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 			ret = LZ4F_decompress(dctx, out_buf, &decompressed_size,
 									   start, &consumed_len, NULL);
 			if (LZ4F_isError(ret))
-			{
-				LZ4F_freeDecompressionContext(dctx);
 				return -1;
-			}
 
 			start = start + consumed_len;
 
@@ -267,16 +302,42 @@ static int LZ4DecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 		}
 
 		if (start != end)
-		{
-			LZ4F_freeDecompressionContext(dctx);
 			return -1;
-		}
 	}
 
-	LZ4F_freeDecompressionContext(dctx);
 	return (int)total_out;
 }
 
+/*
+ * begin to decompress one message piece by piece, no dictionary for lz4
+ * ret: NULL if failed, or LZ4F_dctx of this thread
+ */
+static void *LZ4DecompressStreamBegin(RPCBuffer *src, unsigned int dict_id)
+{
+	if (dict_id != 0)
+		return NULL;
+
+	return RPCLZ4Context::get_instance()->get_dctx();
+}
+
+/*
+ * decompress from in into out, in_len and out_len become consumed and produced
+ * ret: -1: failed
+ * 		 0: end of frame
+ * 		 1: need more input or output
+ */
+static int LZ4DecompressStream(void *ctx, const void *in, size_t *in_len,
+							   void *out, size_t *out_len)
+{
+	size_t ret = LZ4F_decompress(static_cast<LZ4F_dctx *>(ctx), out, out_len,
+								 in, in_len, NULL);
+
+	if (LZ4F_isError(ret))
+		return -1;
+
+	return ret == 0 ? 0 : 1;
+}
+
 /*
  * lease size after compress origin_size data
  */
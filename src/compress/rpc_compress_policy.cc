@@ -0,0 +1,210 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <tuple>
+#include "rpc_compress.h"
+#include "rpc_compress_policy.h"
+
+namespace srpc
+{
+
+// average of the first messages, then moving average of the recent ones
+static constexpr unsigned int COMPRESS_STATS_DECAY = 16;
+
+RPCCompressStats::RPCCompressStats(const RPCCompressPolicyParams *params,
+								   const std::string& service,
+								   const std::string& method) :
+	service(service),
+	method(method)
+{
+	this->params = params;
+	this->messages = 0;
+	this->probe_next = 0;
+	for (int i = 0; i < RPCCompressMax; i++)
+	{
+		this->stats[i].samples = 0;
+		this->stats[i].ratio = 0;
+		this->stats[i].ns_per_byte = 0;
+	}
+}
+
+int RPCCompressStats::best_type(unsigned int types) const
+{
+	int best = RPCCompressNone;
+	double best_score = 0;
+	double score;
+
+	for (int i = RPCCompressNone + 1; i < RPCCompressMax; i++)
+	{
+		const TypeStats& s = this->stats[i];
+
+		if (!(types & (1U << i)) || s.samples == 0 ||
+			s.ratio > this->params->max_ratio)
+		{
+			continue;
+		}
+
+		score = 1.0 - s.ratio;
+		if (this->params->ns_per_byte_saved > 0)
+			score = score * this->params->ns_per_byte_saved - s.ns_per_byte;
+
+		if (score > best_score)
+		{
+			best = i;
+			best_score = score;
+		}
+	}
+
+	return best;
+}
+
+int RPCCompressStats::select(int type, size_t size)
+{
+	unsigned int types = this->params->adaptive_types;
+	int ret = RPCCompressNone;
+	int i;
+
+	if (size < this->params->min_size)
+		return RPCCompressNone;
+
+	if (types == 0)
+		types = 1U << type;
+
+	this->mutex.lock();
+	this->messages++;
+	// learn every type before choosing
+	for (i = RPCCompressNone + 1; i < RPCCompressMax; i++)
+	{
+		if ((types & (1U << i)) &&
+			this->stats[i].samples < this->params->min_samples)
+		{
+			ret = i;
+			break;
+		}
+	}
+
+	if (i == RPCCompressMax)
+	{
+		ret = this->best_type(types);
+		// messages may become compressible, or another type better
+		if (this->params->probe_interval != 0 &&
+			this->messages % this->params->probe_interval == 0)
+		{
+			for (i = 0; i < RPCCompressMax; i++)
+			{
+				int next = this->probe_next++ % RPCCompressMax;
+
+				if (types & (1U << next))
+				{
+					ret = next;
+					break;
+				}
+			}
+		}
+	}
+
+	this->mutex.unlock();
+	return ret;
+}
+
+void RPCCompressStats::observe(int type, size_t origin_size,
+							   size_t compressed_size, long long cost_ns)
+{
+	double ratio;
+	double ns_per_byte;
+	double weight;
+
+	if (type <= RPCCompressNone || type >= RPCCompressMax || origin_size == 0)
+		return;
+
+	ratio = (double)compressed_size / origin_size;
+	ns_per_byte = cost_ns > 0 ? (double)cost_ns / origin_size : 0;
+
+	this->mutex.lock();
+	TypeStats& s = this->stats[type];
+
+	// no need to count more than both of them
+	if (s.samples < COMPRESS_STATS_DECAY || s.samples < this->params->min_samples)
+		s.samples++;
+
+	weight = 1.0 / (s.samples < COMPRESS_STATS_DECAY ? s.samples
+													 : COMPRESS_STATS_DECAY);
+	s.ratio += (ratio - s.ratio) * weight;
+	s.ns_per_byte += (ns_per_byte - s.ns_per_byte) * weight;
+	this->mutex.unlock();
+}
+
+double RPCCompressStats::get_ratio(int type) const
+{
+	double ratio = 0;
+
+	if (type <= RPCCompressNone || type >= RPCCompressMax)
+		return 0;
+
+	this->mutex.lock();
+	if (this->stats[type].samples != 0)
+		ratio = this->stats[type].ratio;
+
+	this->mutex.unlock();
+	return ratio;
+}
+
+RPCCompressPolicy::RPCCompressPolicy() :
+	RPCCompressPolicy(&RPC_COMPRESS_POLICY_PARAMS_DEFAULT)
+{
+}
+
+RPCCompressPolicy::RPCCompressPolicy(const RPCCompressPolicyParams *params)
+{
+	const RPCCompressor *compressor = RPCCompressor::get_instance();
+
+	this->params = *params;
+	// only the types can be compressed here
+	this->params.adaptive_types &= ~(1U << RPCCompressNone);
+	for (int i = RPCCompressNone + 1; i < RPCCompressMax; i++)
+	{
+		if (!compressor->find_handler(i))
+			this->params.adaptive_types &= ~(1U << i);
+	}
+
+	this->params.adaptive_types &= (1U << RPCCompressMax) - 1;
+}
+
+RPCCompressStats *RPCCompressPolicy::find_stats(const std::string& service,
+												const std::string& method)
+{
+	RPCCompressStats *stats;
+
+	this->mutex.lock();
+	auto& service_methods = this->methods[service];
+	auto it = service_methods.find(method);
+
+	if (it == service_methods.end())
+	{
+		it = service_methods.emplace(std::piecewise_construct,
+									 std::forward_as_tuple(method),
+									 std::forward_as_tuple(&this->params,
+														   service,
+														   method)).first;
+	}
+
+	stats = &it->second;
+	this->mutex.unlock();
+	return stats;
+}
+
+} // end namespace srpc
+
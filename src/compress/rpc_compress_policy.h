@@ -0,0 +1,155 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_COMPRESS_POLICY_H__
+#define __RPC_COMPRESS_POLICY_H__
+
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "rpc_basic.h"
+
+namespace srpc
+{
+
+struct RPCCompressPolicyParams
+{
+	// messages smaller than this are sent without compression
+	size_t min_size;
+	// compressed / origin above this means the method does not shrink
+	double max_ratio;
+	// messages compressed with a type before trusting its stats
+	unsigned int min_samples;
+	// still try one of every probe_interval messages of a method
+	// whose compression was stopped or not chosen, 0 means never
+	unsigned int probe_interval;
+	// bitmask of (1 << RPCCompressType) to choose from for each method
+	// by the observed cost, 0 means keep the type set by user
+	unsigned int adaptive_types;
+	// CPU nanoseconds one byte saved is worth, to weigh the types.
+	// 0 means CPU cost is not counted, the smallest output wins
+	double ns_per_byte_saved;
+};
+
+static constexpr struct RPCCompressPolicyParams RPC_COMPRESS_POLICY_PARAMS_DEFAULT =
+{
+/*	.min_size			=	*/	256,
+/*	.max_ratio			=	*/	0.9,
+/*	.min_samples		=	*/	16,
+/*	.probe_interval		=	*/	1024,
+/*	.adaptive_types		=	*/	0,
+/*	.ns_per_byte_saved	=	*/	0.0
+};
+
+/**
+ * @brief   Compression stats of one method, learned from its messages
+ * @details
+ * - Thread Safety : YES
+ * - Set to RPCMessage by RPCClient and RPCServer with a policy, and used
+ *   in compress() of the messages
+ */
+class RPCCompressStats
+{
+public:
+	/**
+	 * @brief      Choose the type before compressing a message
+	 * @param[in]  type   compress type set by user, not RPCCompressNone
+	 * @param[in]  size   serialized size of the message
+	 * @return     compress type to use, RPCCompressNone to skip
+	 */
+	int select(int type, size_t size);
+
+	/**
+	 * @brief      Tell the result after compressing with type
+	 */
+	void observe(int type, size_t origin_size, size_t compressed_size,
+				 long long cost_ns);
+
+	/**
+	 * @brief      Average compressed / origin of type, 0 if not learned
+	 */
+	double get_ratio(int type) const;
+
+	const std::string& get_service_name() const { return this->service; }
+	const std::string& get_method_name() const { return this->method; }
+
+public:
+	RPCCompressStats(const RPCCompressPolicyParams *params,
+					 const std::string& service, const std::string& method);
+
+	RPCCompressStats(const RPCCompressStats&) = delete;
+	RPCCompressStats& operator=(const RPCCompressStats&) = delete;
+
+private:
+	// ret: the best type learned, RPCCompressNone if none is worth it
+	int best_type(unsigned int types) const;
+
+	struct TypeStats
+	{
+		unsigned int samples;
+		double ratio;
+		double ns_per_byte;
+	};
+
+	const RPCCompressPolicyParams *params;
+	mutable std::mutex mutex;
+	unsigned int messages;
+	unsigned int probe_next;
+	TypeStats stats[RPCCompressMax];
+	std::string service;
+	std::string method;
+};
+
+/**
+ * @brief   Decide whether and how to compress each message by its method
+ * @details
+ * - Thread Safety : YES
+ * - Set by RPCClient::set_compress_policy() or RPCServer::set_compress_policy(),
+ *   then messages of a task with compress type are checked by the policy:
+ *   small ones and the methods do not shrink are sent uncompressed
+ * - With adaptive_types, each method uses the type which saves the most
+ *   with its CPU cost. The peer must be able to decompress all of them
+ * - Created by user and should live longer than the client or server
+ */
+class RPCCompressPolicy
+{
+public:
+	RPCCompressPolicy();
+	RPCCompressPolicy(const RPCCompressPolicyParams *params);
+
+	RPCCompressPolicy(const RPCCompressPolicy&) = delete;
+	RPCCompressPolicy& operator=(const RPCCompressPolicy&) = delete;
+
+	const RPCCompressPolicyParams *get_params() const { return &this->params; }
+
+	/**
+	 * @brief      Stats of a method, created at the first time
+	 */
+	RPCCompressStats *find_stats(const std::string& service,
+								 const std::string& method);
+
+private:
+	RPCCompressPolicyParams params;
+	std::mutex mutex;
+	std::unordered_map<std::string,
+					   std::unordered_map<std::string, RPCCompressStats>> methods;
+};
+
+} // end namespace srpc
+
+#endif
+
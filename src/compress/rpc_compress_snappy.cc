@@ -14,33 +14,78 @@
   limitations under the License.
 */
 
+#include <vector>
 #include "snappy.h"
 #include "snappy-sinksource.h"
+#include "rpc_basic.h"
 #include "rpc_compress_snappy.h"
 
 namespace srpc
 {
 
+// snappy writes into the pieces of RPCBuffer directly
 class RPCSnappySink : public snappy::Sink
 {
 public:
 	RPCSnappySink(RPCBuffer *buf)
 	{
 		this->buf = buf;
+		this->acquired = NULL;
+		this->acquired_len = 0;
+		this->total = 0;
 	}
 
 	void Append(const char *bytes, size_t n) override
 	{
-		this->buf->append(bytes, n, BUFFER_MODE_COPY);
+		if (bytes == this->acquired && n <= this->acquired_len)
+		{
+			this->buf->backup(this->acquired_len - n);
+			this->acquired = NULL;
+		}
+		else
+		{
+			this->give_back();
+			this->buf->append(bytes, n, BUFFER_MODE_COPY);
+		}
+
+		this->total += n;
+	}
+
+	char *GetAppendBuffer(size_t length, char *scratch) override
+	{
+		this->give_back();
+		this->acquired = (char *)this->buf->acquire_contiguous(length);
+		if (!this->acquired)
+			return scratch;
+
+		this->acquired_len = length;
+		return this->acquired;
 	}
 
 	size_t size() const
 	{
-		return this->buf->size();
+		return this->total;
+	}
+
+	~RPCSnappySink()
+	{
+		this->give_back();
 	}
 
 private:
+	void give_back()
+	{
+		if (this->acquired)
+		{
+			this->buf->backup(this->acquired_len);
+			this->acquired = NULL;
+		}
+	}
+
 	RPCBuffer *buf;
+	char *acquired;
+	size_t acquired_len;
+	size_t total;
 };
 
 class RPCSnappySource : public snappy::Source
@@ -71,6 +116,13 @@ public:
 		this->pos += this->buf->seek(n);
 	}
 
+	// back to where it begins, after reading the header
+	void rewind()
+	{
+		this->buf->seek(0 - (long)this->pos);
+		this->pos = 0;
+	}
+
 private:
 	RPCBuffer *buf;
 	size_t buf_size;
@@ -109,17 +161,43 @@ int SnappyManager::SnappyCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 	RPCSnappySource source(src);
 	RPCSnappySink sink(dst);
 
-	return (int)snappy::Compress(&source, &sink);
+	snappy::Compress(&source, &sink);
+	return (int)sink.size();
 }
 
+/*
+ * Uncompress into the pieces acquired from dst as an iovec, in the size of
+ * allocator like the others, not one whole piece or the blocks of snappy.
+ */
 int SnappyManager::SnappyDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
 {
 	RPCSnappySource source(src);
-	RPCSnappySink sink(dst);
+	std::vector<struct iovec> iov;
+	uint32_t origin_len;
+	size_t left;
+	void *buf;
+	size_t size;
+
+	if (!snappy::GetUncompressedLength(&source, &origin_len) ||
+		origin_len > RPC_BODY_SIZE_LIMIT)
+	{
+		return -1;
+	}
+
+	source.rewind();
+	for (left = origin_len; left > 0; left -= size)
+	{
+		size = left;
+		if (!dst->acquire(&buf, &size))
+			return -1;
+
+		iov.push_back({buf, size});
+	}
+
+	if (!snappy::RawUncompressToIOVec(&source, iov.data(), iov.size()))
+		return -1;
 
-//	if (snappy::IsValidCompressed(&source))
-//	if (snappy::GetUncompressedLength(&source, &origin_len))
-	return (int)snappy::Uncompress(&source, &sink) ? sink.size() : -1;
+	return (int)origin_len;
 }
 
 int SnappyManager::SnappyLeaseSize(size_t origin_size)
@@ -47,7 +47,7 @@ public:
 	static int SnappyCompressIOVec(RPCBuffer *src, RPCBuffer *dst);
 
 	/*
-	 * decompress RPCBuffer src(Source) into RPCBuffer dst(Sink)
+	 * decompress RPCBuffer src(Source) into the pieces of RPCBuffer dst
 	 * ret: -1: failed
 	 * 		>0: byte count of compressed data
 	 */
@@ -0,0 +1,705 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <workflow/WFGlobal.h>
+#include <workflow/WFTaskFactory.h>
+#include "zstd.h"
+#include "rpc_compress_zstd.h"
+
+namespace srpc
+{
+
+int ZstdManager::level_ = 0;
+size_t ZstdManager::chunk_size_ = 0;
+
+/*
+ * Chunked payload is a skippable frame with the chunk table, then one
+ * standard frame for each chunk, so any zstd decoder reads it in order.
+ * Table: chunk count, then compressed and origin size of each chunk,
+ * all 4 bytes little-endian.
+ */
+static constexpr unsigned int ZSTD_CHUNK_TABLE_MAGIC = 0x184D2A5C;
+static constexpr size_t ZSTD_CHUNK_SIZE_MIN = 64 * 1024;
+static constexpr size_t ZSTD_CHUNK_NUM_MAX = 64 * 1024;
+
+// dictionaries are never removed, so the pointers found stay valid
+class ZstdDictMap
+{
+public:
+	static ZstdDictMap *get_instance()
+	{
+		static ZstdDictMap kInstance;
+		return &kInstance;
+	}
+
+	int add(unsigned int dict_id, const void *dict, size_t size, int level)
+	{
+		ZSTD_CDict *cdict;
+		ZSTD_DDict *ddict;
+		int ret = -1;
+
+		if (dict_id == 0)
+			dict_id = ZSTD_getDictID_fromDict(dict, size);
+
+		if (dict_id == 0 || dict_id > 0x7FFFFFFF)
+			return -1;
+
+		cdict = ZSTD_createCDict(dict, size, level);
+		ddict = ZSTD_createDDict(dict, size);
+		this->mutex.lock();
+		if (cdict && ddict && this->dicts.count(dict_id) == 0)
+		{
+			this->dicts.emplace(dict_id, std::make_pair(cdict, ddict));
+			cdict = NULL;
+			ddict = NULL;
+			ret = (int)dict_id;
+		}
+
+		this->mutex.unlock();
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+		return ret;
+	}
+
+	bool find(unsigned int dict_id, const ZSTD_CDict **cdict,
+			  const ZSTD_DDict **ddict)
+	{
+		bool ret = false;
+
+		this->mutex.lock();
+		auto it = this->dicts.find(dict_id);
+
+		if (it != this->dicts.end())
+		{
+			*cdict = it->second.first;
+			*ddict = it->second.second;
+			ret = true;
+		}
+
+		this->mutex.unlock();
+		return ret;
+	}
+
+private:
+	~ZstdDictMap()
+	{
+		for (auto& kv : this->dicts)
+		{
+			ZSTD_freeCDict(kv.second.first);
+			ZSTD_freeDDict(kv.second.second);
+		}
+	}
+
+	std::mutex mutex;
+	std::unordered_map<unsigned int,
+					   std::pair<ZSTD_CDict *, ZSTD_DDict *>> dicts;
+};
+
+// contexts of each thread, reset with parameters before every message
+class ZstdContext
+{
+public:
+	static ZstdContext *get_instance()
+	{
+		static thread_local ZstdContext kInstance;
+		return &kInstance;
+	}
+
+	ZSTD_CCtx *get_cctx()
+	{
+		if (!this->cctx)
+			this->cctx = ZSTD_createCCtx();
+		else
+			ZSTD_CCtx_reset(this->cctx, ZSTD_reset_session_and_parameters);
+
+		return this->cctx;
+	}
+
+	ZSTD_DCtx *get_dctx()
+	{
+		if (!this->dctx)
+			this->dctx = ZSTD_createDCtx();
+		else
+			ZSTD_DCtx_reset(this->dctx, ZSTD_reset_session_and_parameters);
+
+		return this->dctx;
+	}
+
+private:
+	ZstdContext()
+	{
+		this->cctx = NULL;
+		this->dctx = NULL;
+	}
+
+	~ZstdContext()
+	{
+		ZSTD_freeCCtx(this->cctx);
+		ZSTD_freeDCtx(this->dctx);
+	}
+
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+};
+
+int ZstdManager::set_level(int level)
+{
+	if (level != 0 && (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()))
+		return -1;
+
+	level_ = level;
+	return 0;
+}
+
+int ZstdManager::ZstdCompress(const char *msg, size_t msglen,
+							  char *buf, size_t buflen)
+{
+	ZSTD_CCtx *ctx = ZstdContext::get_instance()->get_cctx();
+	size_t ret;
+
+	if (!ctx)
+		return -1;
+
+	ret = ZSTD_compressCCtx(ctx, buf, buflen, msg, msglen, level_);
+	if (ZSTD_isError(ret))
+		return -1;
+
+	return (int)ret;
+}
+
+int ZstdManager::ZstdDecompress(const char *buf, size_t buflen,
+								char *msg, size_t msglen)
+{
+	ZSTD_DCtx *ctx = ZstdContext::get_instance()->get_dctx();
+	size_t ret;
+
+	if (!ctx)
+		return -1;
+
+	ret = ZSTD_decompressDCtx(ctx, msg, msglen, buf, buflen);
+	if (ZSTD_isError(ret))
+		return -1;
+
+	return (int)ret;
+}
+
+// with cdict, the level is the one when the dictionary was loaded
+static int __zstd_compress_iovec(RPCBuffer *src, RPCBuffer *dst,
+								 const ZSTD_CDict *cdict, int level,
+								 unsigned long long pledged_size =
+													ZSTD_CONTENTSIZE_UNKNOWN)
+{
+	ZSTD_CCtx *ctx = ZstdContext::get_instance()->get_cctx();
+	ZSTD_EndDirective mode = ZSTD_e_continue;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	const void *in_buf;
+	void *out_buf;
+	size_t out_len;
+	size_t total_out = 0;
+	size_t ret;
+
+	if (!ctx)
+		return -1;
+
+	if (cdict)
+		ret = ZSTD_CCtx_refCDict(ctx, cdict);
+	else
+		ret = ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level);
+
+	// the size is written in frame header
+	if (!ZSTD_isError(ret) && pledged_size != ZSTD_CONTENTSIZE_UNKNOWN)
+		ret = ZSTD_CCtx_setPledgedSrcSize(ctx, pledged_size);
+
+	while (!ZSTD_isError(ret) && mode != ZSTD_e_end)
+	{
+		in.size = src->fetch(&in_buf);
+		in.src = in_buf;
+		in.pos = 0;
+		// no more piece, then flush the end of frame
+		if (in.size == 0)
+			mode = ZSTD_e_end;
+
+		do
+		{
+			// zstd keeps a block inside, so any room of the piece is fine
+			out_len = BUFFER_PIECE_MAX_SIZE;
+			if (!dst->acquire(&out_buf, &out_len))
+				return -1;
+
+			out.dst = out_buf;
+			out.size = out_len;
+			out.pos = 0;
+			ret = ZSTD_compressStream2(ctx, &out, &in, mode);
+			dst->backup(out_len - out.pos);
+			total_out += out.pos;
+			if (ZSTD_isError(ret))
+				break;
+
+		} while (mode == ZSTD_e_end ? ret != 0 : in.pos != in.size);
+	}
+
+	if (ZSTD_isError(ret))
+		return -1;
+
+	return (int)total_out;
+}
+
+static int __zstd_decompress_iovec(RPCBuffer *src, RPCBuffer *dst,
+								   const ZSTD_DDict *ddict)
+{
+	ZSTD_DCtx *ctx = ZstdContext::get_instance()->get_dctx();
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	const void *in_buf;
+	void *out_buf;
+	size_t out_len;
+	size_t total_out = 0;
+	size_t ret = 1;
+
+	if (!ctx)
+		return -1;
+
+	if (ddict && ZSTD_isError(ZSTD_DCtx_refDDict(ctx, ddict)))
+		return -1;
+
+	while ((in.size = src->fetch(&in_buf)) != 0)
+	{
+		in.src = in_buf;
+		in.pos = 0;
+		do
+		{
+			// output is larger than input, let it fill a whole piece
+			out_len = BUFFER_PIECE_MAX_SIZE;
+			if (!dst->acquire(&out_buf, &out_len))
+				return -1;
+
+			out.dst = out_buf;
+			out.size = out_len;
+			out.pos = 0;
+			ret = ZSTD_decompressStream(ctx, &out, &in);
+			dst->backup(out_len - out.pos);
+			total_out += out.pos;
+			if (ZSTD_isError(ret))
+				return -1;
+
+			// a full output may leave more inside ctx, unless frame ends
+		} while (in.pos != in.size || (out.pos == out.size && ret != 0));
+	}
+
+	// frame is not finished
+	if (ret != 0)
+		return -1;
+
+	return (int)total_out;
+}
+
+/*
+ * Every chunk is taken by the caller or by a go task on compute threads.
+ * The caller waits only for the chunks being worked on, never for a task
+ * not started, so it is fine to call it in a compute thread.
+ */
+class ZstdChunkJob
+{
+public:
+	ZstdChunkJob(size_t n, std::function<bool (size_t)>&& work) :
+		work(std::move(work))
+	{
+		this->n = n;
+		this->next = 0;
+		this->done = 0;
+		this->failed = false;
+	}
+
+	void work_loop()
+	{
+		size_t i;
+		bool ok;
+
+		while ((i = this->next++) < this->n)
+		{
+			ok = this->work(i);
+			this->mutex.lock();
+			if (!ok)
+				this->failed = true;
+
+			if (++this->done == this->n)
+				this->cond.notify_one();
+
+			this->mutex.unlock();
+		}
+	}
+
+	// ret: false if any chunk failed
+	bool wait()
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+
+		while (this->done != this->n)
+			this->cond.wait(lock);
+
+		return !this->failed;
+	}
+
+private:
+	std::function<bool (size_t)> work;
+	std::atomic<size_t> next;
+	size_t n;
+	size_t done;
+	bool failed;
+	std::mutex mutex;
+	std::condition_variable cond;
+};
+
+static bool __zstd_run_chunks(size_t n, std::function<bool (size_t)>&& work)
+{
+	auto job = std::make_shared<ZstdChunkJob>(n, std::move(work));
+	long threads = WFGlobal::get_global_settings()->compute_threads;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (long i = 1; i < threads && (size_t)i < n; i++)
+	{
+		WFGoTask *task = WFTaskFactory::create_go_task("srpc_zstd_chunk",
+			[job]() { job->work_loop(); });
+
+		task->start();
+	}
+
+	job->work_loop();
+	return job->wait();
+}
+
+static inline void __zstd_write_le32(char *p, size_t v)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (char)((v >> (8 * i)) & 0xFF);
+}
+
+static inline size_t __zstd_read_le32(const char *p)
+{
+	const unsigned char *q = (const unsigned char *)p;
+
+	return (size_t)q[0] | ((size_t)q[1] << 8) |
+		   ((size_t)q[2] << 16) | ((size_t)q[3] << 24);
+}
+
+// cut the pieces of src into chunks by the sizes after offset, no copy
+static bool __zstd_split(const RPCBuffer *src, size_t offset,
+						 const std::vector<size_t>& sizes,
+						 std::vector<RPCBuffer>& chunks)
+{
+	RPCBuffer head;
+
+	if (src->share(&head) != src->size())
+		return false;
+
+	if (offset != 0 && head.cut(offset, &chunks[0]) == 0)
+		return false;
+	else if (offset == 0 && chunks[0].append(&head) < 0)
+		return false;
+
+	for (size_t i = 0; i + 1 < sizes.size(); i++)
+	{
+		if (chunks[i].cut(sizes[i], &chunks[i + 1]) == 0)
+			return false;
+	}
+
+	return true;
+}
+
+static int __zstd_compress_chunks(RPCBuffer *src, RPCBuffer *dst,
+								  size_t chunk_size, int level)
+{
+	size_t size = src->size();
+	size_t n = (size + chunk_size - 1) / chunk_size;
+	std::vector<size_t> sizes(n, chunk_size);
+	std::vector<RPCBuffer> chunks(n);
+	std::vector<RPCBuffer> outs(n);
+	std::string table(8 + 4 + 8 * n, '\0');
+	size_t total_out;
+
+	if (n > ZSTD_CHUNK_NUM_MAX)
+		return __zstd_compress_iovec(src, dst, NULL, level);
+
+	sizes[n - 1] = size - chunk_size * (n - 1);
+	if (!__zstd_split(src, 0, sizes, chunks))
+		return -1;
+
+	for (size_t i = 0; i < n; i++)
+		outs[i].set_allocator(dst->get_allocator());
+
+	if (!__zstd_run_chunks(n, [&](size_t i) -> bool {
+			return __zstd_compress_iovec(&chunks[i], &outs[i], NULL, level,
+										 sizes[i]) > 0;
+		}))
+	{
+		return -1;
+	}
+
+	__zstd_write_le32(&table[0], ZSTD_CHUNK_TABLE_MAGIC);
+	__zstd_write_le32(&table[4], table.size() - 8);
+	__zstd_write_le32(&table[8], n);
+	for (size_t i = 0; i < n; i++)
+	{
+		__zstd_write_le32(&table[12 + 8 * i], outs[i].size());
+		__zstd_write_le32(&table[16 + 8 * i], sizes[i]);
+	}
+
+	if (!dst->write(table.data(), table.size()))
+		return -1;
+
+	total_out = table.size();
+	for (size_t i = 0; i < n; i++)
+	{
+		size_t size = outs[i].size();
+
+		if (dst->append(&outs[i]) < 0)
+			return -1;
+
+		total_out += size;
+	}
+
+	if (total_out > 0x7FFFFFFF)
+		return -1;
+
+	return (int)total_out;
+}
+
+/*
+ * ret: size of the chunk table with its frame header,
+ * 		0 if src is not chunked, which is read as usual
+ */
+static size_t __zstd_chunk_table(RPCBuffer *src,
+								 std::vector<size_t>& compressed_sizes,
+								 std::vector<size_t>& origin_sizes)
+{
+	char header[12];
+	std::string table;
+	size_t table_size;
+	size_t compressed_total = 0;
+	size_t origin_total = 0;
+	size_t n;
+
+	if (!src->read(header, sizeof header) ||
+		__zstd_read_le32(header) != ZSTD_CHUNK_TABLE_MAGIC)
+	{
+		src->rewind();
+		return 0;
+	}
+
+	table_size = __zstd_read_le32(header + 4);
+	n = __zstd_read_le32(header + 8);
+	if (n == 0 || n > ZSTD_CHUNK_NUM_MAX || table_size != 4 + 8 * n)
+	{
+		src->rewind();
+		return 0;
+	}
+
+	table.resize(8 * n);
+	if (!src->read(&table[0], table.size()))
+	{
+		src->rewind();
+		return 0;
+	}
+
+	compressed_sizes.resize(n);
+	origin_sizes.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		compressed_sizes[i] = __zstd_read_le32(&table[8 * i]);
+		origin_sizes[i] = __zstd_read_le32(&table[8 * i + 4]);
+		if (compressed_sizes[i] == 0)
+			break;
+
+		compressed_total += compressed_sizes[i];
+		origin_total += origin_sizes[i];
+	}
+
+	src->rewind();
+	if (compressed_total + 8 + table_size != src->size() ||
+		origin_total > 0x7FFFFFFF)
+	{
+		return 0;
+	}
+
+	return 8 + table_size;
+}
+
+static int __zstd_decompress_chunks(RPCBuffer *src, RPCBuffer *dst,
+									size_t table_size,
+									const std::vector<size_t>& compressed_sizes,
+									const std::vector<size_t>& origin_sizes)
+{
+	size_t n = compressed_sizes.size();
+	std::vector<RPCBuffer> chunks(n);
+	std::vector<RPCBuffer> outs(n);
+	size_t total_out = 0;
+
+	if (!__zstd_split(src, table_size, compressed_sizes, chunks))
+		return -1;
+
+	for (size_t i = 0; i < n; i++)
+		outs[i].set_allocator(dst->get_allocator());
+
+	if (!__zstd_run_chunks(n, [&](size_t i) -> bool {
+			return __zstd_decompress_iovec(&chunks[i], &outs[i], NULL) ==
+				   (int)origin_sizes[i];
+		}))
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		size_t size = outs[i].size();
+
+		if (dst->append(&outs[i]) < 0)
+			return -1;
+
+		total_out += size;
+	}
+
+	return (int)total_out;
+}
+
+int ZstdManager::ZstdCompressIOVec(RPCBuffer *src, RPCBuffer *dst)
+{
+	size_t chunk_size = chunk_size_;
+
+	if (chunk_size != 0 && src->size() > chunk_size)
+		return __zstd_compress_chunks(src, dst, chunk_size, level_);
+
+	return __zstd_compress_iovec(src, dst, NULL, level_);
+}
+
+int ZstdManager::ZstdDecompressIOVec(RPCBuffer *src, RPCBuffer *dst)
+{
+	std::vector<size_t> compressed_sizes;
+	std::vector<size_t> origin_sizes;
+	size_t table_size = __zstd_chunk_table(src, compressed_sizes, origin_sizes);
+
+	if (table_size != 0)
+	{
+		return __zstd_decompress_chunks(src, dst, table_size,
+										compressed_sizes, origin_sizes);
+	}
+
+	return __zstd_decompress_iovec(src, dst, NULL);
+}
+
+int ZstdManager::set_chunk_size(size_t chunk_size)
+{
+	if (chunk_size != 0 &&
+		(chunk_size < ZSTD_CHUNK_SIZE_MIN || chunk_size > 0x7FFFFFFF))
+	{
+		return -1;
+	}
+
+	chunk_size_ = chunk_size;
+	return 0;
+}
+
+int ZstdManager::ZstdLeaseSize(size_t origin_size)
+{
+	return (int)ZSTD_compressBound(origin_size);
+}
+
+int ZstdManager::ZstdAddDict(unsigned int dict_id, const void *dict, size_t size)
+{
+	return ZstdDictMap::get_instance()->add(dict_id, dict, size, level_);
+}
+
+int ZstdManager::ZstdCompressIOVecDict(RPCBuffer *src, RPCBuffer *dst,
+									   unsigned int dict_id)
+{
+	const ZSTD_CDict *cdict;
+	const ZSTD_DDict *ddict;
+
+	if (!ZstdDictMap::get_instance()->find(dict_id, &cdict, &ddict))
+		return -2;
+
+	return __zstd_compress_iovec(src, dst, cdict, level_);
+}
+
+int ZstdManager::ZstdDecompressIOVecDict(RPCBuffer *src, RPCBuffer *dst,
+										 unsigned int dict_id)
+{
+	const ZSTD_CDict *cdict;
+	const ZSTD_DDict *ddict;
+
+	if (!ZstdDictMap::get_instance()->find(dict_id, &cdict, &ddict))
+		return -2;
+
+	return __zstd_decompress_iovec(src, dst, ddict);
+}
+
+void *ZstdManager::ZstdDecompressStreamBegin(RPCBuffer *src, unsigned int dict_id)
+{
+	ZSTD_DCtx *ctx;
+	const ZSTD_CDict *cdict;
+	const ZSTD_DDict *ddict;
+	const void *buf;
+
+	// chunks are faster decompressed in parallel
+	if (src->peek(&buf) >= 4 &&
+		__zstd_read_le32((const char *)buf) == ZSTD_CHUNK_TABLE_MAGIC)
+	{
+		return NULL;
+	}
+
+	ctx = ZstdContext::get_instance()->get_dctx();
+	if (!ctx || dict_id == 0)
+		return ctx;
+
+	if (!ZstdDictMap::get_instance()->find(dict_id, &cdict, &ddict) ||
+		ZSTD_isError(ZSTD_DCtx_refDDict(ctx, ddict)))
+	{
+		return NULL;
+	}
+
+	return ctx;
+}
+
+int ZstdManager::ZstdDecompressStream(void *ctx, const void *in, size_t *in_len,
+									  void *out, size_t *out_len)
+{
+	ZSTD_inBuffer in_buf = { in, *in_len, 0 };
+	ZSTD_outBuffer out_buf = { out, *out_len, 0 };
+	size_t ret;
+
+	// frames after the end go on, as the chunks of a large payload
+	ret = ZSTD_decompressStream(static_cast<ZSTD_DCtx *>(ctx), &out_buf, &in_buf);
+	*in_len = in_buf.pos;
+	*out_len = out_buf.pos;
+	if (ZSTD_isError(ret))
+		return -1;
+
+	return ret == 0 ? 0 : 1;
+}
+
+} // end namespace srpc
+
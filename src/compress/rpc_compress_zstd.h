@@ -0,0 +1,122 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_COMPRESS_ZSTD_H__
+#define __RPC_COMPRESS_ZSTD_H__
+
+#include "rpc_buffer.h"
+
+namespace srpc
+{
+
+class ZstdManager
+{
+public:
+	/*
+	 * compress serialized msg into buf.
+	 * ret: -1: failed
+	 * 		>0: byte count of compressed data
+	 */
+	static int ZstdCompress(const char *msg, size_t msglen, char *buf, size_t buflen);
+
+	/*
+	 * decompress and parse buf into msg
+	 * ret: -1: failed
+	 * 		>0: byte count of compressed data
+	 */
+	static int ZstdDecompress(const char *buf, size_t buflen, char *msg, size_t msglen);
+
+	/*
+	 * compress RPCBuffer src into RPCBuffer dst, piece by piece
+	 * ret: -1: failed
+	 * 		>0: byte count of compressed data
+	 */
+	static int ZstdCompressIOVec(RPCBuffer *src, RPCBuffer *dst);
+
+	/*
+	 * decompress RPCBuffer src into RPCBuffer dst, piece by piece
+	 * ret: -1: failed
+	 * 		>0: byte count of compressed data
+	 */
+	static int ZstdDecompressIOVec(RPCBuffer *src, RPCBuffer *dst);
+
+	/*
+	 * lease size after compress origin_size data
+	 */
+	static int ZstdLeaseSize(size_t origin_size);
+
+	/*
+	 * load a dictionary, dict_id 0 means the id inside it
+	 * ret: -1: failed or dict_id existed
+	 * 		>0: dict_id
+	 */
+	static int ZstdAddDict(unsigned int dict_id, const void *dict, size_t size);
+
+	/*
+	 * same as IOVec ones with the dictionary of dict_id
+	 * ret: -2: dict_id not loaded
+	 * 		-1: failed
+	 * 		>0: byte count of compressed data
+	 */
+	static int ZstdCompressIOVecDict(RPCBuffer *src, RPCBuffer *dst,
+									 unsigned int dict_id);
+	static int ZstdDecompressIOVecDict(RPCBuffer *src, RPCBuffer *dst,
+									   unsigned int dict_id);
+
+	/*
+	 * begin to decompress src piece by piece,
+	 * with the dictionary of dict_id if not 0
+	 * ret: NULL if failed, dict_id not loaded or src is chunked,
+	 * 		or ZSTD_DCtx of this thread
+	 */
+	static void *ZstdDecompressStreamBegin(RPCBuffer *src, unsigned int dict_id);
+
+	/*
+	 * decompress from in into out, in_len and out_len become
+	 * consumed and produced
+	 * ret: -1: failed
+	 * 		 0: end of frame
+	 * 		 1: need more input or output
+	 */
+	static int ZstdDecompressStream(void *ctx, const void *in, size_t *in_len,
+									void *out, size_t *out_len);
+
+	/*
+	 * level of all the compressions after, 0 means the default of zstd
+	 * ret:  0, success
+	 * 		-1, out of the range of zstd
+	 */
+	static int set_level(int level);
+	static int get_level() { return level_; }
+
+	/*
+	 * payloads larger than chunk_size are compressed in chunks
+	 * on compute threads in parallel, 0 means never
+	 * ret:  0, success
+	 * 		-1, out of the range from 64KB to 2GB
+	 */
+	static int set_chunk_size(size_t chunk_size);
+	static size_t get_chunk_size() { return chunk_size_; }
+
+private:
+	static int level_;
+	static size_t chunk_size_;
+};
+
+} // end namespace srpc
+
+#endif
+
@@ -60,6 +60,7 @@ Available options(linux):\n\
     -o, --output_dir    : Output directory.\n\
     -i, --input_dir     : Specify the directory in which to search for imports.\n\
     -s, --skip_skeleton : Skip generating skeleton file. (default: generate)\n\
+    -S, --skip_stream   : Skip streaming methods of services. (default: fail)\n\
     -v, --version       : Show version.\n\
     -h, --help          : Show usage.\n";
 
@@ -116,7 +117,9 @@ int main(int argc, const char *argv[])
 	Generator gen(idl_type == TYPE_THRIFT ? true : false);
 
 	fprintf(stdout, "[Generator Begin]\n");
-	gen.generate(params);
+	if (!gen.generate(params))
+		return 1;
+
 	fprintf(stdout, "[Generator Done]\n");
 	return 0;
 }
@@ -172,10 +175,11 @@ int parse_getopt(int argc, char * const *argv,
 		{ "output_dir",    required_argument, NULL, 'o'},
 		{ "input_dir",     required_argument, NULL, 'i'},
 		{ "skip_skeleton", no_argument,       NULL, 's'},
+		{ "skip_stream",   no_argument,       NULL, 'S'},
 		{ "help",          no_argument,       NULL, 'h'}
 	};
 
-	while ((ch = getopt_long(argc, argv, "vf:o:i:sh", longopts, NULL)) != -1)
+	while ((ch = getopt_long(argc, argv, "vf:o:i:sSh", longopts, NULL)) != -1)
 	{
 		switch (ch)
 		{
@@ -208,6 +212,9 @@ int parse_getopt(int argc, char * const *argv,
 		case 's':
 			params.generate_skeleton = false;
 			break;
+		case 'S':
+			params.skip_stream = true;
+			break;
 		case 'h':
 			break;
 		default:
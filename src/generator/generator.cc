@@ -77,6 +77,7 @@ bool Generator::init_file_names(const std::string& idl_file, const char *out_dir
 bool Generator::generate(struct GeneratorParams& params)
 {
 	this->info.input_dir = params.input_dir;
+	this->parser.set_skip_stream(params.skip_stream);
 
 	if (this->parser.parse(params.idl_file, this->info) == false)
 	{
@@ -359,6 +360,7 @@ bool Generator::generate_srpc_file(const idl_info& cur_info)
 		for (const auto& type : rpc_list)
 		{
 			this->printer.print_client_constructor(type, desc.block_name,
+												   desc.rpcs,
 												   cur_info.package_name);
 			this->printer.print_client_methods(type, desc.block_name, desc.rpcs,
 											   cur_info.package_name);
@@ -33,10 +33,16 @@ struct GeneratorParams
 {
 	const char *out_dir;
 	bool generate_skeleton;
+	bool skip_stream;
 	std::string idl_file;
 	std::string input_dir;
 
-	GeneratorParams() : out_dir(NULL), generate_skeleton(true) { }
+	GeneratorParams() :
+		out_dir(NULL),
+		generate_skeleton(true),
+		skip_stream(false)
+	{
+	}
 };
 
 class Generator
@@ -1067,6 +1067,23 @@ bool Parser::parse_struct_thrift(const std::string& file_name_prefix,
 	return true;
 }
 
+// [ret] true if the type of request or response is "stream type"
+static bool strip_stream_type(std::string& name)
+{
+	size_t len = strlen("stream");
+
+	name = SGenUtil::strip(name);
+	// "stream" then spaces or tabs, a type such as streamRequest is not
+	if (name.length() <= len || name.compare(0, len, "stream") != 0 ||
+		!isspace(name[len]))
+	{
+		return false;
+	}
+
+	name = SGenUtil::strip(name.substr(len));
+	return true;
+}
+
 bool Parser::parse_service_pb(const std::string& block, Descriptor& desc)
 {
 	size_t pos = block.find("{");
@@ -1146,12 +1163,32 @@ bool Parser::parse_service_pb(const std::string& block, Descriptor& desc)
 
 		rpc_desc.response_name = std::string(&block[response_name_pos + 1],
 											 &block[response_name_end]);
+		pos = response_name_end;
+
+		bool req_stream = strip_stream_type(rpc_desc.request_name);
+		bool resp_stream = strip_stream_type(rpc_desc.response_name);
+
+		// one request with one response on a connection
+		if (req_stream || resp_stream)
+		{
+			if (!this->skip_stream)
+			{
+				fprintf(stderr, "streaming method %s is not supported, "
+						"use --skip_stream to generate the others\n",
+						rpc_desc.method_name.c_str());
+				return false;
+			}
+
+			fprintf(stderr, "skip streaming method:%s\n",
+					rpc_desc.method_name.c_str());
+			continue;
+		}
+
 		fprintf(stdout, "Successfully parse method:%s req:%s resp:%s\n",
 				rpc_desc.method_name.c_str(),
 				rpc_desc.request_name.c_str(),
 				rpc_desc.response_name.c_str());
 		desc.rpcs.emplace_back(std::move(rpc_desc));
-		pos = response_name_end;
 	}
 	return true;
 }
@@ -81,10 +81,17 @@ public:
 	bool check_multi_comments_begin(std::string& line);
 	bool check_multi_comments_end(std::string& line);
 	int parse_pb_rpc_option(const std::string& line);
-	Parser(bool is_thrift) { this->is_thrift = is_thrift; }
+	Parser(bool is_thrift)
+	{
+		this->is_thrift = is_thrift;
+		this->skip_stream = false;
+	}
+
+	void set_skip_stream(bool skip) { this->skip_stream = skip; }
 
 private:
 	bool is_thrift;
+	bool skip_stream;
 };
 
 #endif
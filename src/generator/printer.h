@@ -87,6 +87,46 @@ static inline std::string make_srpc_service_prefix(const std::vector<std::string
 	return name;
 }
 
+// FNV-1a of the full service name or the method name, never 0
+static inline unsigned int make_srpc_id(const std::string& name)
+{
+	unsigned int id = 2166136261U;
+
+	for (unsigned char c : name)
+	{
+		id ^= c;
+		id *= 16777619U;
+	}
+
+	return id ? id : 1;
+}
+
+// 0 for the methods with the same hash, which are called by names
+static inline std::vector<unsigned int>
+make_srpc_method_ids(const std::vector<rpc_descriptor>& rpcs)
+{
+	std::vector<unsigned int> ids;
+	std::vector<bool> same(rpcs.size(), false);
+
+	for (size_t i = 0; i < rpcs.size(); i++)
+	{
+		ids.push_back(make_srpc_id(rpcs[i].method_name));
+		for (size_t j = 0; j < i; j++)
+		{
+			if (ids[j] == ids[i])
+				same[i] = same[j] = true;
+		}
+	}
+
+	for (size_t i = 0; i < rpcs.size(); i++)
+	{
+		if (same[i])
+			ids[i] = 0;
+	}
+
+	return ids;
+}
+
 static inline std::string make_trpc_service_prefix(const std::vector<std::string>& package,
 												   const std::string& service)
 {
@@ -715,23 +755,27 @@ public:
 
 	void print_server_constructor(const std::string& service, const std::vector<rpc_descriptor>& rpcs)
 	{
+		std::vector<unsigned int> ids = make_srpc_method_ids(rpcs);
+
 		fprintf(this->out_file, this->server_constructor_method_format.c_str(),
-				service.c_str());
+				service.c_str(), make_srpc_id(service));
 
-		for (const auto& rpc : rpcs)
+		for (size_t i = 0; i < rpcs.size(); i++)
 		{
 			fprintf(this->out_file, this->server_constructor_add_method_format.c_str(),
-					rpc.method_name.c_str(), rpc.method_name.c_str());
+					rpcs[i].method_name.c_str(), ids[i],
+					rpcs[i].method_name.c_str());
 		}
 		fprintf(this->out_file, "}\n");
 	}
 
 	void print_client_constructor(const std::string& type, const std::string& service,
+								  const std::vector<rpc_descriptor>& rpcs,
 								  const std::vector<std::string>& package)
 	{
 		bool is_srpc_thrift = (this->is_thrift && (type == "SRPC" || type == "SRPCHttp"));
-		const char *method_ip = is_srpc_thrift ? client_constructor_methods_ip_srpc_thrift_format.c_str() : "";
-		const char *method_params = is_srpc_thrift ? client_constructor_methods_params_srpc_thrift_format.c_str() : "";
+		std::string method_ip = is_srpc_thrift ? client_constructor_methods_ip_srpc_thrift_format : "";
+		std::string method_params = is_srpc_thrift ? client_constructor_methods_params_srpc_thrift_format : "";
 
 		std::string full_service = service;
 
@@ -742,14 +786,39 @@ public:
 		else if (type == "SRPCHttp")
 			full_service = make_srpc_service_prefix(package, service, '/');
 
+		// only SRPC meta carries the IDs
+		if (type == "SRPC")
+		{
+			std::vector<unsigned int> method_ids = make_srpc_method_ids(rpcs);
+			char buf[256];
+			std::string ids;
+
+			snprintf(buf, sizeof buf, this->client_constructor_service_id_format.c_str(),
+					 make_srpc_id(full_service));
+			ids.append(buf);
+			for (size_t i = 0; i < rpcs.size(); i++)
+			{
+				// called by names
+				if (method_ids[i] == 0)
+					continue;
+
+				snprintf(buf, sizeof buf, this->client_constructor_method_id_format.c_str(),
+						 rpcs[i].method_name.c_str(), method_ids[i]);
+				ids.append(buf);
+			}
+
+			method_ip.append(ids);
+			method_params.append(ids);
+		}
+
 		fprintf(this->out_file, this->client_constructor_methods_format.c_str(),
 				type.c_str(), type.c_str(),
 				type.c_str(), full_service.c_str(),
-				method_ip, type.c_str(),
+				method_ip.c_str(), type.c_str(),
 
 				type.c_str(), type.c_str(),
 				type.c_str(), full_service.c_str(),
-				method_params, type.c_str());
+				method_params.c_str(), type.c_str());
 	}
 
 	void print_client_methods(const std::string& type,
@@ -1237,11 +1306,11 @@ inline %s Service::%s(%s) {%s}
 )";
 
 	std::string server_constructor_method_format = R"(
-inline Service::Service(): srpc::RPCService("%s")
+inline Service::Service(): srpc::RPCService("%s", %uU)
 {)";
 
 	std::string server_constructor_add_method_format = R"(
-	this->srpc::RPCService::add_method("%s",
+	this->srpc::RPCService::add_method("%s", %uU,
 		[this](srpc::RPCWorker& worker) ->int {
 			return ServiceRPCCallImpl(this, worker, &Service::%s);
 		});
@@ -1283,6 +1352,12 @@ inline %sClient::%sClient(const struct srpc::RPCClientParams *params):
 }
 )";
 
+	std::string client_constructor_service_id_format = R"(
+	this->srpc::SRPCClient::set_service_id(%uU);)";
+
+	std::string client_constructor_method_id_format = R"(
+	this->srpc::SRPCClient::add_method_id("%s", %uU);)";
+
 	std::string client_constructor_methods_ip_srpc_thrift_format = R"(
 	params.task_params.data_type = srpc::RPCDataThrift;
 )";
@@ -0,0 +1 @@
+../../rpc_allocator.h
\ No newline at end of file
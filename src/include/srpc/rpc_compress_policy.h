@@ -0,0 +1 @@
+../../compress/rpc_compress_policy.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../compress/rpc_compress_zstd.h
\ No newline at end of file
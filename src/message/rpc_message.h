@@ -21,6 +21,7 @@
 #include <string>
 #include <workflow/ProtocolMessage.h>
 #include "rpc_basic.h"
+#include "rpc_compress_policy.h"
 #include "rpc_filter.h"
 #include "rpc_thrift_idl.h"
 
@@ -42,7 +43,14 @@ public:
 	virtual bool get_meta_module_data(RPCModuleData& data) const = 0;
 	virtual bool set_meta_module_data(const RPCModuleData& data) = 0;
 
+	// ID of the request on its connection, for the protocols carrying one
 	virtual void set_seqid(long long seqid) {}
+	virtual long long get_seqid() const { return -1; }
+
+	// IDs from generator, 0 if not carried and dispatched by names
+	virtual void set_method_id(unsigned int service_id, unsigned int method_id) {}
+	virtual unsigned int get_service_id() const { return 0; }
+	virtual unsigned int get_method_id() const { return 0; }
 
 public:
 	virtual ~RPCRequest() { }
@@ -63,6 +71,9 @@ public:
 
 	virtual bool set_http_code(int code) { return false; }
 
+	// ID of the request echoed, -1 if not carried
+	virtual long long get_seqid() const { return -1; }
+
 public:
 	virtual ~RPCResponse() { }
 };
@@ -75,6 +86,10 @@ public:
 	virtual int get_compress_type() const = 0;
 	virtual int get_data_type() const = 0;
 
+	// dictionary loaded by RPCCompressor::add_dict(), 0 means none
+	virtual void set_compress_dict(unsigned int dict_id) { }
+	virtual unsigned int get_compress_dict() const { return 0; }
+
 public:
 	//return RPCStatus
 	virtual int compress() = 0;
@@ -134,11 +149,71 @@ public:
 	}
 
 public:
-	RPCMessage() { this->flags = 0; }
-	virtual ~RPCMessage() { }
+	// learn the size of serialized message, set by RPCServer and RPCClient
+	void set_buffer_sizer(RPCBufferSizer *sizer) { this->sizer = sizer; }
+	// where the pieces of buffers come from, set before append or serialize
+	virtual void set_buffer_allocator(RPCBufferAllocator *allocator) { }
+	// bytes in flight of the connection, set by RPCServer before append
+	void set_buffer_quota(RPCBufferQuota *quota)
+	{
+		quota->incref();
+		this->quota = quota;
+	}
+
+	// body is dropped without allocating for it, reply RPCStatusOverloaded
+	bool is_overloaded() const { return this->overloaded; }
+	// bytes of the body received or serialized, 0 if unknown
+	virtual size_t get_body_size() const { return 0; }
+	// decide the compress type by method, set by RPCServer and RPCClient
+	void set_compress_stats(RPCCompressStats *stats)
+	{
+		this->compress_stats = stats;
+	}
+
+protected:
+	// take the quota before allocating a received body
+	bool take_quota(size_t size)
+	{
+		if (!this->quota)
+			return true;
+
+		if (!this->quota->take(size))
+		{
+			this->overloaded = true;
+			return false;
+		}
+
+		this->quota_taken += size;
+		return true;
+	}
+
+public:
+	RPCMessage()
+	{
+		this->flags = 0;
+		this->sizer = NULL;
+		this->compress_stats = NULL;
+		this->quota = NULL;
+		this->quota_taken = 0;
+		this->overloaded = false;
+	}
+
+	virtual ~RPCMessage()
+	{
+		if (this->quota)
+		{
+			this->quota->give_back(this->quota_taken);
+			this->quota->decref();
+		}
+	}
 
 protected:
 	uint32_t flags;
+	RPCBufferSizer *sizer;
+	RPCCompressStats *compress_stats;
+	RPCBufferQuota *quota;
+	size_t quota_taken;
+	bool overloaded;
 };
 
 // implementation
@@ -15,6 +15,9 @@
 */
 
 #include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include <vector>
 #include <string>
 #include <workflow/HttpUtil.h>
@@ -34,20 +37,33 @@ static constexpr int BRPC_EREQUEST		= 1003;
 static constexpr int BRPC_EINTERNAL		= 2001;
 static constexpr int BRPC_ERESPONSE		= 2002;
 static constexpr int BRPC_ELOGOFF		= 2003;
+static constexpr int BRPC_ELIMIT		= 2004;
 
 BRPCMessage::BRPCMessage()
 {
 	this->nreceived = 0;
 	this->meta_buf = NULL;
+	this->body_taken = false;
+	this->spill_fd = -1;
+	this->spill_len = 0;
 	this->meta_len = 0;
 	this->message_len = 0;
 	this->attachment_len = 0;
+	this->decompress_pending = false;
 	memset(this->header, 0, sizeof (this->header));
-	this->meta = new BrpcMeta();
+	this->meta = RPCObjectRecycler<BrpcMeta>::get();
 	this->message = new RPCBuffer();
 	this->attachment = NULL;
 }
 
+BRPCMessage::~BRPCMessage()
+{
+	delete this->message;
+	delete this->attachment;
+	delete []this->meta_buf;
+	RPCObjectRecycler<BrpcMeta>::put(static_cast<BrpcMeta *>(this->meta));
+}
+
 bool BRPCRequest::deserialize_meta()
 {
 	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
@@ -58,8 +74,12 @@ bool BRPCRequest::deserialize_meta()
 		{
 			this->attachment_len = meta->attachment_size();
 			this->message_len -= this->attachment_len;
-			this->attachment = new RPCBuffer();
-			this->message->cut(this->message_len, this->attachment);
+			// spilled attachment never comes into message
+			if (this->spill_fd < 0)
+			{
+				this->attachment = new RPCBuffer();
+				this->message->cut(this->message_len, this->attachment);
+			}
 		}
 
 		return true;
@@ -79,8 +99,12 @@ bool BRPCResponse::deserialize_meta()
 		{
 			this->attachment_len = meta->attachment_size();
 			this->message_len -= this->attachment_len;
-			this->attachment = new RPCBuffer();
-			this->message->cut(this->message_len, this->attachment);
+			// spilled attachment never comes into message
+			if (this->spill_fd < 0)
+			{
+				this->attachment = new RPCBuffer();
+				this->message->cut(this->message_len, this->attachment);
+			}
 		}
 
 		this->srpc_status_code = RPCStatusOK;
@@ -100,6 +124,108 @@ bool BRPCResponse::deserialize_meta()
 	return false;
 }
 
+int BRPCMessage::prepare_spill(size_t size_limit)
+{
+	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
+	size_t body_len;
+
+	// attachment_size is needed before the body, parse it again later
+	if (!meta->ParseFromArray(this->meta_buf, (int)this->meta_len) ||
+		meta->attachment_size() < 0 ||
+		(size_t)meta->attachment_size() > this->message_len)
+	{
+		errno = EBADMSG;
+		return -1;
+	}
+
+	this->spill_len = meta->attachment_size();
+	body_len = this->message_len - this->spill_len;
+	if (this->meta_len + body_len >= size_limit)
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (body_len > 0 && this->take_quota(body_len))
+		this->body_taken = true;
+
+	return 0;
+}
+
+int BRPCMessage::append_body(const char *buf, size_t size, size_t size_limit)
+{
+	size_t body_received = this->nreceived - BRPC_HEADER_SIZE;
+	size_t body_len = this->message_len - this->spill_len;
+	size_t len;
+
+	this->nreceived += size;
+	if (body_received < this->meta_len)
+	{
+		len = this->meta_len - body_received;
+		if (len > size)
+			len = size;
+
+		memcpy(this->meta_buf + body_received, buf, len);
+		body_received += len;
+		buf += len;
+		size -= len;
+
+		if (body_received == this->meta_len && this->spill_fd >= 0)
+		{
+			if (this->prepare_spill(size_limit) < 0)
+				return -1;
+
+			body_len = this->message_len - this->spill_len;
+		}
+	}
+
+	if (size == 0)
+		return 0;
+
+	body_received -= this->meta_len;
+	if (body_received < body_len)
+	{
+		len = body_len - body_received;
+		if (len > size)
+			len = size;
+
+		if (this->body_taken &&
+			!this->message->write_message(buf, len, body_len - body_received))
+		{
+			return -1;
+		}
+
+		body_received += len;
+		buf += len;
+		size -= len;
+	}
+
+#ifndef _WIN32
+	// only the attachment to be spilled is left, write from the beginning
+	// of the file so that a retry overwrites the data of last time
+	off_t offset = body_received - body_len;
+
+	while (size > 0)
+	{
+		ssize_t ret = pwrite(this->spill_fd, buf, size, offset);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		buf += ret;
+		size -= ret;
+		offset += ret;
+	}
+#endif
+
+	return 0;
+}
+
 int BRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 {
 	uint32_t *p;
@@ -120,8 +246,15 @@ int BRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 			this->meta_len = ntohl(*p);
 			this->message_len = buf_len - this->meta_len; // msg_len + attachment_len
 
-			if (buf_len >= size_limit)
+			if (this->meta_len > buf_len)
+			{
+				errno = EBADMSG;
+				return -1;
+			}
+			else if (buf_len >= size_limit &&
+					 (this->spill_fd < 0 || this->meta_len == 0))
 			{
+				// spilled attachment is not limited, check it after meta
 				errno = EMSGSIZE;
 				return -1;
 			}
@@ -131,30 +264,21 @@ int BRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 					*size = header_left + buf_len;
 
 				this->meta_buf = new char[this->meta_len];
-//				this->buf = new char[this->message_len];
-
-				if (*size - header_left <= this->meta_len)
+				// over the quota, receive meta only and drop the body
+				if (this->message_len > 0 &&
+					(this->spill_fd < 0 || this->meta_len == 0) &&
+					this->take_quota(this->message_len))
 				{
-					memcpy(this->meta_buf, (const char *)buf + header_left,
-						   *size - header_left);
+					this->body_taken = true;
 				}
-				else
+
+				if (this->append_body((const char *)buf + header_left,
+									  *size - header_left, size_limit) < 0)
 				{
-					memcpy(this->meta_buf, (const char *)buf + header_left,
-						   this->meta_len);
-//					memcpy(this->buf,
-//						   (const char *)buf + header_left + this->meta_len,
-//						   *size - header_left - this->meta_len);
-					this->message->append((const char *)buf + header_left + this->meta_len,
-										  *size - header_left - this->meta_len,
-										  BUFFER_MODE_COPY);
+					return -1;
 				}
 
-				this->nreceived += *size - header_left;
-				if (this->nreceived == BRPC_HEADER_SIZE + buf_len)
-					return 1;
-				else
-					return 0;
+				return this->nreceived == BRPC_HEADER_SIZE + buf_len;
 			}
 			else if (*size == header_left)
 			{
@@ -183,29 +307,9 @@ int BRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 		if (body_received + *size > buf_len)
 			*size = buf_len - body_received;
 
-		if (body_received + *size <= this->meta_len)
-		{
-			memcpy(this->meta_buf + body_received, buf, *size);
-		}
-		else if (body_received < this->meta_len)
-		{
-			memcpy(this->meta_buf + body_received, buf,
-				   this->meta_len - body_received);
-
-			if (body_received + *size > this->meta_len)// useless. always true
-//				memcpy(this->buf, (const char *)buf + this->meta_len - body_received,
-//					   *size - this->meta_len + body_received);
-				this->message->append((const char *)buf + this->meta_len - body_received,
-									  *size - this->meta_len + body_received,
-									  BUFFER_MODE_COPY);
-		}
-		else
-		{
-//			memcpy(this->buf + body_received - this->meta_len, buf, *size);
-			this->message->append((const char *)buf, *size, BUFFER_MODE_COPY);
-		}
+		if (this->append_body((const char *)buf, *size, size_limit) < 0)
+			return -1;
 
-		this->nreceived += *size;
 		return this->nreceived == BRPC_HEADER_SIZE + buf_len;
 	}
 }
@@ -252,10 +356,29 @@ void BRPCMessage::set_attachment_nocopy(const char *attachment, size_t len)
 {
 	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
 
+	if (!this->attachment)
+		this->attachment = new RPCBuffer();
+
+	if (this->attachment->append(attachment, len, BUFFER_MODE_NOCOPY))
+	{
+		this->attachment_len += len;
+		meta->set_attachment_size(this->attachment_len);
+	}
+}
+
+bool BRPCMessage::set_attachment_file(int fd, size_t offset, size_t len)
+{
+	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
+
+	if (!this->attachment)
+		this->attachment = new RPCBuffer();
+
+	if (!this->attachment->append_file(fd, offset, len))
+		return false;
+
 	this->attachment_len += len;
 	meta->set_attachment_size(this->attachment_len);
-	this->attachment = new RPCBuffer();
-	this->attachment->append(attachment, len, BUFFER_MODE_NOCOPY);
+	return true;
 }
 
 bool BRPCMessage::get_attachment_nocopy(const char **attachment, size_t *len) const
@@ -312,6 +435,13 @@ int64_t BRPCRequest::get_correlation_id() const
 	return -1;
 }
 
+void BRPCRequest::set_correlation_id(int64_t cid)
+{
+	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
+
+	meta->set_correlation_id(cid);
+}
+
 int BRPCResponse::get_status_code() const
 {
 	return this->srpc_status_code;
@@ -387,6 +517,8 @@ const char *BRPCResponse::get_errmsg() const
 		return "URI Invalid";
 	case RPCStatusUpstreamFailed:
 		return "Upstream Failed";
+	case RPCStatusOverloaded:
+		return "Server Overloaded";
 	case RPCStatusSystemError:
 		return "System Error. Use get_error() to get errno";
 	case RPCStatusSSLError:
@@ -407,6 +539,16 @@ void BRPCResponse::set_error(int error)
 	meta->mutable_response()->set_error_code(error);
 }
 
+int64_t BRPCResponse::get_correlation_id() const
+{
+	const BrpcMeta *meta = static_cast<const BrpcMeta *>(this->meta);
+
+	if (meta->has_correlation_id())
+		return meta->correlation_id();
+
+	return -1;
+}
+
 void BRPCResponse::set_correlation_id(int64_t cid)
 {
 	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
@@ -422,6 +564,10 @@ int BRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 	BrpcMeta *meta = static_cast<BrpcMeta *>(this->meta);
 	bool is_resp = !meta->has_request();
 	int msg_len = pb_msg->ByteSizeLong();
+
+	if (this->sizer)
+		this->sizer->prepare(this->message);
+
 	RPCOutputStream stream(this->message, pb_msg->ByteSizeLong());
 	int ret = pb_msg->SerializeToZeroCopyStream(&stream) ? 0 : -1;
 
@@ -429,6 +575,9 @@ int BRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 		return is_resp ? RPCStatusRespSerializeError : RPCStatusReqSerializeError;
 
 	this->message_len = msg_len;
+	if (this->sizer)
+		this->sizer->observe(this->message_len);
+
 	return RPCStatusOK;
 }
 
@@ -436,6 +585,38 @@ int BRPCMessage::deserialize(ProtobufIDLMessage *pb_msg)
 {
 	const BrpcMeta *meta = static_cast<const BrpcMeta *>(this->meta);
 	bool is_resp = !meta->has_request();
+	int status_code;
+
+	if (this->decompress_pending)
+	{
+		RPCDecompressStream stream(this->message);
+		bool ret;
+
+		if (stream.begin(meta->compress_type(), 0))
+		{
+			ret = pb_msg->ParseFromZeroCopyStream(&stream);
+			if (!stream.finish())
+				return is_resp ? RPCStatusRespDecompressError : RPCStatusReqDecompressError;
+
+			if (stream.ByteCount() == 0)
+				return is_resp ? RPCStatusRespDecompressSizeInvalid : RPCStatusReqDecompressSizeInvalid;
+
+			if (ret == false)
+				return is_resp ? RPCStatusRespDeserializeError : RPCStatusReqDeserializeError;
+
+			return RPCStatusOK;
+		}
+	}
+
+	// chunks a stream can not begin with are decompressed whole
+	if (this->decompress_pending)
+	{
+		this->decompress_pending = false;
+		status_code = this->decompress_buffer();
+		if (status_code != RPCStatusOK)
+			return status_code;
+	}
+
 	RPCInputStream stream(this->message);
 
 	if (pb_msg->ParseFromZeroCopyStream(&stream) == false)
@@ -458,6 +639,14 @@ int BRPCMessage::compress()
 	if (type == RPCCompressNone)
 		return status_code;
 
+	if (this->compress_stats)
+	{
+		type = this->compress_stats->select(type, buflen);
+		this->set_compress_type(type);
+		if (type == RPCCompressNone)
+			return status_code;
+	}
+
 	static RPCCompressor *compressor = RPCCompressor::get_instance();
 	int ret = compressor->lease_compressed_size(type, buflen);
 
@@ -468,7 +657,23 @@ int BRPCMessage::compress()
 
 	//buflen = ret;
 	RPCBuffer *dst_buf = new RPCBuffer();
+	long long ns_st = this->compress_stats ? GET_CURRENT_NS() : 0;
+
+	dst_buf->set_allocator(this->message->get_allocator());
 	ret = compressor->serialize_to_compressed(this->message, dst_buf, type);
+	if (this->compress_stats && ret > 0)
+	{
+		this->compress_stats->observe(type, buflen, ret,
+									  GET_CURRENT_NS() - ns_st);
+		// send this one as it is if not shrinking
+		if ((size_t)ret >= buflen)
+		{
+			this->message->rewind();
+			this->set_compress_type(RPCCompressNone);
+			delete dst_buf;
+			return status_code;
+		}
+	}
 
 	if (ret == -2)
 		status_code = is_resp ? RPCStatusRespCompressNotSupported : RPCStatusReqCompressNotSupported;
@@ -501,7 +706,25 @@ int BRPCMessage::decompress()
 	if (this->message_len == 0 || type == RPCCompressNone)
 		return status_code;
 
+	// parse from the compressed pieces without a decompressed copy
+	if (RPCDecompressStream::is_supported(type))
+	{
+		this->decompress_pending = true;
+		return status_code;
+	}
+
+	return this->decompress_buffer();
+}
+
+int BRPCMessage::decompress_buffer()
+{
+	const BrpcMeta *meta = static_cast<const BrpcMeta *>(this->meta);
+	bool is_resp = !meta->has_request();
+	int type = meta->compress_type();
+	int status_code = RPCStatusOK;
 	RPCBuffer *dst_buf = new RPCBuffer();
+
+	dst_buf->set_allocator(this->message->get_allocator());
 	static RPCCompressor *compressor = RPCCompressor::get_instance();
 	int ret = compressor->parse_from_compressed(this->message, dst_buf, type);
 
@@ -553,6 +776,8 @@ inline int BRPCMessage::error_code_srpc_brpc(int srpc_status_code) const
 		return BRPC_ERESPONSE;
 	case RPCStatusProcessTerminated:
 		return BRPC_ELOGOFF;
+	case RPCStatusOverloaded:
+		return BRPC_ELIMIT;
 	default:
 		return BRPC_EINTERNAL;
 	}
@@ -572,6 +797,8 @@ inline int BRPCMessage::error_code_brpc_srpc(int brpc_error_code) const
 		return RPCStatusRespDeserializeError;
 	case BRPC_ELOGOFF:
 		return RPCStatusProcessTerminated;
+	case BRPC_ELIMIT:
+		return RPCStatusOverloaded;
 	default:
 		return RPCStatusSystemError;
 	}
@@ -45,6 +45,15 @@ public:
 
 	bool get_attachment_nocopy(const char **attachment, size_t *len) const;
 	void set_attachment_nocopy(const char *attachment, size_t len);
+	bool set_attachment_file(int fd, size_t offset, size_t len);
+	void set_attachment_spill(int fd);
+
+	void set_buffer_allocator(RPCBufferAllocator *allocator) override
+	{
+		this->message->set_allocator(allocator);
+	}
+
+	size_t get_body_size() const override { return this->message->size(); }
 
 	int get_data_type() const override { return RPCDataProtobuf; }
 	void set_data_type(int type) override { }
@@ -69,11 +78,20 @@ protected:
 	size_t message_len;
 	size_t attachment_len;
 	char *meta_buf;
+	bool body_taken;	// quota taken, receive body as it arrives
+	int spill_fd;
+	size_t spill_len;	// size of attachment written to spill_fd
 	RPCBuffer *message;
 	RPCBuffer *attachment;
+	// still compressed, decompressed by deserialize() while parsing
+	bool decompress_pending;
 	ProtobufIDLMessage *meta;
 
 protected:
+	// decompress the whole message into a new buffer
+	int decompress_buffer();
+	int append_body(const char *buf, size_t size, size_t size_limit);
+	int prepare_spill(size_t size_limit);
 	int error_code_srpc_brpc(int srpc_status_code) const;
 	int error_code_brpc_srpc(int brpc_error_code) const;
 };
@@ -91,6 +109,7 @@ public:
 	void set_method_name(const std::string& method_name);
 
 	int64_t get_correlation_id() const;
+	void set_correlation_id(int64_t cid);
 };
 
 class BRPCResponse : public BRPCMessage
@@ -106,6 +125,7 @@ public:
 	void set_status_code(int code);
 	void set_error(int error);
 
+	int64_t get_correlation_id() const;
 	void set_correlation_id(int64_t cid);
 
 protected:
@@ -158,6 +178,16 @@ public:
 		return this->BRPCRequest::set_method_name(method_name);
 	}
 
+	void set_seqid(long long seqid) override
+	{
+		this->BRPCRequest::set_correlation_id(seqid);
+	}
+
+	long long get_seqid() const override
+	{
+		return this->BRPCRequest::get_correlation_id();
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->BRPCMessage::set_meta_module_data(data);
@@ -222,6 +252,11 @@ public:
 		return this->BRPCResponse::set_error(error);
 	}
 
+	long long get_seqid() const override
+	{
+		return this->BRPCResponse::get_correlation_id();
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->BRPCMessage::set_meta_module_data(data);
@@ -239,12 +274,12 @@ public:
 ////////
 // inl
 
-inline BRPCMessage::~BRPCMessage()
+inline void BRPCMessage::set_attachment_spill(int fd)
 {
-	delete this->message;
-	delete this->attachment;
-	delete []this->meta_buf;
-	delete this->meta;
+#ifndef _WIN32
+	// write the attachment received to fd instead of memory
+	this->spill_fd = fd;
+#endif
 }
 
 inline int BRPCMessage::encode(struct iovec vectors[], int max, size_t size_limit)
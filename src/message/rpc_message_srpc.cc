@@ -15,6 +15,9 @@
 */
 
 #include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include <vector>
 #include <string>
 #include <google/protobuf/stubs/common.h>
@@ -42,6 +45,7 @@ struct SRPCHttpHeadersString
 	const std::string DataType			=	"Content-Type";
 	const std::string SRPCStatus		=	"SRPC-Status";
 	const std::string SRPCError			=	"SRPC-Error";
+	const std::string CompressDict		=	"SRPC-Compress-Dict";
 };
 
 struct CaseCmp
@@ -61,7 +65,8 @@ static const std::map<const std::string, int, CaseCmp> SRPCHttpHeadersCode =
 	{SRPCHttpHeaders.CompressdSize,		3},
 	{SRPCHttpHeaders.DataType,			4},
 	{SRPCHttpHeaders.SRPCStatus,		5},
-	{SRPCHttpHeaders.SRPCError,			6}
+	{SRPCHttpHeaders.SRPCError,			6},
+	{SRPCHttpHeaders.CompressDict,		7}
 };
 
 static const std::vector<std::string> RPCDataTypeString =
@@ -77,7 +82,8 @@ static const std::vector<std::string> RPCRPCCompressTypeString =
 	"x-snappy",
 	"gzip",
 	"deflate",
-	"x-lz4"
+	"x-lz4",
+	"zstd"
 };
 
 static constexpr const char *kTypePrefix = "type.googleapis.com";
@@ -113,11 +119,127 @@ SRPCMessage::SRPCMessage()
 {
 	this->nreceived = 0;
 	this->meta_buf = NULL;
+	this->body_taken = false;
+	this->spill_fd = -1;
+	this->spill_len = 0;
 	this->meta_len = 0;
 	this->message_len = 0;
+	this->attachment_len = 0;
+	this->decompress_pending = false;
 	memset(this->header, 0, sizeof (this->header));
-	this->meta = new RPCMeta();
+	this->meta = RPCObjectRecycler<RPCMeta>::get();
 	this->buf = new RPCBuffer();
+	this->attachment = NULL;
+}
+
+SRPCMessage::~SRPCMessage()
+{
+	delete []this->meta_buf;
+	RPCObjectRecycler<RPCMeta>::put(static_cast<RPCMeta *>(this->meta));
+	delete this->buf;
+	delete this->attachment;
+}
+
+int SRPCMessage::prepare_spill(size_t size_limit)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+	size_t body_len;
+
+	// attachment_size is needed before the body, parse it again later
+	if (!meta->ParseFromArray(this->meta_buf, (int)this->meta_len) ||
+		meta->attachment_size() < 0 ||
+		(size_t)meta->attachment_size() > this->message_len)
+	{
+		errno = EBADMSG;
+		return -1;
+	}
+
+	this->spill_len = meta->attachment_size();
+	body_len = this->message_len - this->spill_len;
+	if (this->meta_len + body_len >= size_limit)
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (body_len > 0 && this->take_quota(body_len))
+		this->body_taken = true;
+
+	return 0;
+}
+
+int SRPCMessage::append_body(const char *buf, size_t size, size_t size_limit)
+{
+	size_t body_received = this->nreceived - SRPC_HEADER_SIZE;
+	size_t body_len = this->message_len - this->spill_len;
+	size_t len;
+
+	this->nreceived += size;
+	if (body_received < this->meta_len)
+	{
+		len = this->meta_len - body_received;
+		if (len > size)
+			len = size;
+
+		memcpy(this->meta_buf + body_received, buf, len);
+		body_received += len;
+		buf += len;
+		size -= len;
+
+		if (body_received == this->meta_len && this->spill_fd >= 0)
+		{
+			if (this->prepare_spill(size_limit) < 0)
+				return -1;
+
+			body_len = this->message_len - this->spill_len;
+		}
+	}
+
+	if (size == 0)
+		return 0;
+
+	body_received -= this->meta_len;
+	if (body_received < body_len)
+	{
+		len = body_len - body_received;
+		if (len > size)
+			len = size;
+
+		if (this->body_taken &&
+			!this->buf->write_message(buf, len, body_len - body_received))
+		{
+			return -1;
+		}
+
+		body_received += len;
+		buf += len;
+		size -= len;
+	}
+
+#ifndef _WIN32
+	// only the attachment to be spilled is left, write from the beginning
+	// of the file so that a retry overwrites the data of last time
+	off_t offset = body_received - body_len;
+
+	while (size > 0)
+	{
+		ssize_t ret = pwrite(this->spill_fd, buf, size, offset);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		buf += ret;
+		size -= ret;
+		offset += ret;
+	}
+#endif
+
+	return 0;
 }
 
 int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
@@ -137,11 +259,13 @@ int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 			p = (uint32_t *)this->header + 1;
 			this->meta_len = ntohl(*p);
 			p = (uint32_t *)this->header + 2;
-			this->message_len = ntohl(*p);
+			this->message_len = ntohl(*p); // msg_len + attachment_len
 			buf_len = this->meta_len + this->message_len;
 
-			if (buf_len >= size_limit)
+			if (buf_len >= size_limit &&
+				(this->spill_fd < 0 || this->meta_len == 0))
 			{
+				// spilled attachment is not limited, check it after meta
 				errno = EMSGSIZE;
 				return -1;
 			}
@@ -151,25 +275,21 @@ int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 					*size = header_left + buf_len;
 
 				this->meta_buf = new char[this->meta_len];
+				// over the quota, receive meta only and drop the body
+				if (this->message_len > 0 &&
+					(this->spill_fd < 0 || this->meta_len == 0) &&
+					this->take_quota(this->message_len))
+				{
+					this->body_taken = true;
+				}
 
-				if (*size - header_left <= this->meta_len)
+				if (this->append_body((const char *)buf + header_left,
+									  *size - header_left, size_limit) < 0)
 				{
-					memcpy(this->meta_buf, (const char *)buf + header_left,
-						   *size - header_left);
-				} else {
-					memcpy(this->meta_buf, (const char *)buf + header_left,
-						   this->meta_len);
-
-					this->buf->append((const char *)buf + header_left + this->meta_len,
-									  *size - header_left - this->meta_len,
-									  BUFFER_MODE_COPY);
+					return -1;
 				}
 
-				this->nreceived += *size - header_left;
-				if (this->nreceived == SRPC_HEADER_SIZE + buf_len)
-					return 1;
-				else
-					return 0;
+				return this->nreceived == SRPC_HEADER_SIZE + buf_len;
 			}
 			else if (*size == header_left)
 			{
@@ -198,28 +318,39 @@ int SRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 		if (body_received + *size > buf_len)
 			*size = buf_len - body_received;
 
-		if (body_received + *size <= this->meta_len)
+		if (this->append_body((const char *)buf, *size, size_limit) < 0)
+			return -1;
+
+		return this->nreceived == SRPC_HEADER_SIZE + buf_len;
+	}
+}
+
+bool SRPCMessage::deserialize_meta()
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	if (!meta->ParseFromArray(this->meta_buf, (int)this->meta_len))
+		return false;
+
+	if (meta->has_attachment_size())
+	{
+		if (meta->attachment_size() < 0 ||
+			(size_t)meta->attachment_size() > this->message_len)
 		{
-			// 100 + 3 <= 106
-			memcpy(this->meta_buf + body_received, buf, *size);
-		} else if (body_received < this->meta_len) {
-			// 100 + ? > 106, 100 < 106
-			memcpy(this->meta_buf + body_received, buf,
-				   this->meta_len - body_received);
-
-			if (body_received + *size > this->meta_len)// useless. always true
-				// 100 + 10 > 106
-				this->buf->append((const char *)buf + this->meta_len - body_received,
-								  *size - this->meta_len + body_received,
-								  BUFFER_MODE_COPY);
-		} else {
-			// 110 > 106
-			this->buf->append((const char *)buf, *size, BUFFER_MODE_COPY);
+			return false;
 		}
 
-		this->nreceived += *size;
-		return this->nreceived == SRPC_HEADER_SIZE + buf_len;
+		this->attachment_len = meta->attachment_size();
+		this->message_len -= this->attachment_len;
+		// spilled attachment never comes into buf
+		if (this->spill_fd < 0)
+		{
+			this->attachment = new RPCBuffer();
+			this->buf->cut(this->message_len, this->attachment);
+		}
 	}
+
+	return true;
 }
 
 int SRPCMessage::get_compress_type() const
@@ -243,6 +374,23 @@ void SRPCMessage::set_compress_type(int type)
 	meta->set_compress_type(type);
 }
 
+void SRPCMessage::set_compress_dict(unsigned int dict_id)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	if (dict_id)
+		meta->set_compress_dict(dict_id);
+	else
+		meta->clear_compress_dict();
+}
+
+unsigned int SRPCMessage::get_compress_dict() const
+{
+	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
+
+	return meta->compress_dict();
+}
+
 void SRPCMessage::set_data_type(int type)
 {
 	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
@@ -252,13 +400,47 @@ void SRPCMessage::set_data_type(int type)
 
 void SRPCMessage::set_attachment_nocopy(const char *attachment, size_t len)
 {
-	//TODO:
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	if (!this->attachment)
+		this->attachment = new RPCBuffer();
+
+	if (this->attachment->append(attachment, len, BUFFER_MODE_NOCOPY))
+	{
+		this->attachment_len += len;
+		meta->set_attachment_size(this->attachment_len);
+	}
+}
+
+bool SRPCMessage::set_attachment_file(int fd, size_t offset, size_t len)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	if (!this->attachment)
+		this->attachment = new RPCBuffer();
+
+	if (!this->attachment->append_file(fd, offset, len))
+		return false;
+
+	this->attachment_len += len;
+	meta->set_attachment_size(this->attachment_len);
+	return true;
 }
 
 bool SRPCMessage::get_attachment_nocopy(const char **attachment, size_t *len) const
 {
-	//TODO:
-	return false;
+	size_t tmp_len = (size_t)-1;
+	const void *tmp_buf;
+
+	if (this->attachment == NULL ||
+		this->attachment->fetch(&tmp_buf, &tmp_len) == false)
+	{
+		return false;
+	}
+
+	*attachment = (const char *)tmp_buf;
+	*len = tmp_len;
+	return true;
 }
 
 bool SRPCMessage::set_meta_module_data(const RPCModuleData& data)
@@ -339,6 +521,45 @@ void SRPCRequest::set_method_name(const std::string& method_name)
 	meta->mutable_request()->set_method_name(method_name);
 }
 
+unsigned int SRPCRequest::get_service_id() const
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	return meta->request().service_id();
+}
+
+unsigned int SRPCRequest::get_method_id() const
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	return meta->request().method_id();
+}
+
+void SRPCRequest::set_method_id(unsigned int service_id, unsigned int method_id)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	meta->mutable_request()->set_service_id(service_id);
+	meta->mutable_request()->set_method_id(method_id);
+}
+
+int64_t SRPCMessage::get_correlation_id() const
+{
+	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
+
+	if (meta->has_correlation_id())
+		return meta->correlation_id();
+
+	return -1;
+}
+
+void SRPCMessage::set_correlation_id(int64_t cid)
+{
+	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
+
+	meta->set_correlation_id(cid);
+}
+
 int SRPCResponse::get_status_code() const
 {
 	RPCMeta *meta = static_cast<RPCMeta *>(this->meta);
@@ -416,6 +637,8 @@ const char *SRPCResponse::get_errmsg() const
 		return "URI Invalid";
 	case RPCStatusUpstreamFailed:
 		return "Upstream Failed";
+	case RPCStatusOverloaded:
+		return "Server Overloaded";
 	case RPCStatusSystemError:
 		return "System Error. Use get_error() to get errno";
 	case RPCStatusSSLError:
@@ -447,6 +670,9 @@ int SRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 	if (!pb_msg)
 		return RPCStatusOK;
 
+	if (this->sizer)
+		this->sizer->prepare(this->buf);
+
 	RPCOutputStream output_stream(this->buf, pb_msg->ByteSizeLong());
 
 	if (data_type == RPCDataProtobuf)
@@ -488,6 +714,29 @@ int SRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 		return is_resp ? RPCStatusRespSerializeError :
 						 RPCStatusReqSerializeError;
 
+	if (this->sizer)
+		this->sizer->observe(this->message_len);
+
+	return RPCStatusOK;
+}
+
+// ret: status of the decompression after parsing from the stream
+static int __decompress_stream_end(RPCDecompressStream *stream,
+								   const RPCMeta *meta, bool is_resp)
+{
+	if (!stream->finish())
+	{
+		return is_resp ? RPCStatusRespDecompressError
+					   : RPCStatusReqDecompressError;
+	}
+
+	if (stream->ByteCount() == 0 ||
+		(meta->has_origin_size() && stream->ByteCount() != meta->origin_size()))
+	{
+		return is_resp ? RPCStatusRespDecompressSizeInvalid
+					   : RPCStatusReqDecompressSizeInvalid;
+	}
+
 	return RPCStatusOK;
 }
 
@@ -497,7 +746,37 @@ int SRPCMessage::deserialize(ProtobufIDLMessage *pb_msg)
 	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
 	bool is_resp = !meta->has_request();
 	int data_type = meta->data_type();
+	int status_code;
 	int ret;
+
+	if (this->decompress_pending && data_type == RPCDataProtobuf)
+	{
+		RPCDecompressStream decompress_stream(this->buf);
+
+		if (decompress_stream.begin(meta->compress_type(), meta->compress_dict()))
+		{
+			ret = pb_msg->ParseFromZeroCopyStream(&decompress_stream) ? 0 : -1;
+			status_code = __decompress_stream_end(&decompress_stream, meta, is_resp);
+			if (status_code != RPCStatusOK)
+				return status_code;
+
+			if (ret < 0)
+				return is_resp ? RPCStatusRespDeserializeError :
+								 RPCStatusReqDeserializeError;
+
+			return RPCStatusOK;
+		}
+	}
+
+	// chunks or dicts a stream can not begin with are decompressed whole
+	if (this->decompress_pending)
+	{
+		this->decompress_pending = false;
+		status_code = this->decompress_buffer();
+		if (status_code != RPCStatusOK)
+			return status_code;
+	}
+
 	RPCInputStream input_stream(this->buf);
 
 	if (data_type == RPCDataProtobuf)
@@ -544,6 +823,9 @@ int SRPCMessage::serialize(const ThriftIDLMessage *thrift_msg)
 	if (!thrift_msg)
 		return RPCStatusOK;
 
+	if (this->sizer)
+		this->sizer->prepare(this->buf);
+
 	ThriftBuffer thrift_buffer(this->buf);
 
 	if (data_type == RPCDataThrift)
@@ -558,6 +840,9 @@ int SRPCMessage::serialize(const ThriftIDLMessage *thrift_msg)
 						 RPCStatusReqSerializeError;
 
 	this->message_len = this->buf->size();
+	if (this->sizer)
+		this->sizer->observe(this->message_len);
+
 	return RPCStatusOK;
 }
 
@@ -566,18 +851,48 @@ int SRPCMessage::deserialize(ThriftIDLMessage *thrift_msg)
 	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
 	bool is_resp = !meta->has_request();
 	int data_type = meta->data_type();
+	int status_code;
 	int ret;
 
 	if (this->buf->size() == 0 || this->message_len == 0)
 		return is_resp ? RPCStatusRespDeserializeError
 					   : RPCStatusReqDeserializeError;
 
+	if (this->decompress_pending && data_type == RPCDataThrift)
+	{
+		RPCDecompressStream decompress_stream(this->buf);
+		ThriftBuffer stream_buffer(&decompress_stream);
+
+		if (decompress_stream.begin(meta->compress_type(), meta->compress_dict()))
+		{
+			ret = thrift_msg->descriptor->reader(&stream_buffer, thrift_msg) ? 0 : -1;
+			status_code = __decompress_stream_end(&decompress_stream, meta, is_resp);
+			if (status_code != RPCStatusOK)
+				return status_code;
+
+			if (ret < 0)
+				return is_resp ? RPCStatusRespDeserializeError
+							   : RPCStatusReqDeserializeError;
+
+			return RPCStatusOK;
+		}
+	}
+
+	// chunks or dicts a stream can not begin with are decompressed whole
+	if (this->decompress_pending)
+	{
+		this->decompress_pending = false;
+		status_code = this->decompress_buffer();
+		if (status_code != RPCStatusOK)
+			return status_code;
+	}
+
 	ThriftBuffer thrift_buffer(this->buf);
 
 	if (data_type == RPCDataThrift)
-		ret = thrift_msg->descriptor->reader(&thrift_buffer, thrift_msg) ? 0 : 1;
+		ret = thrift_msg->descriptor->reader(&thrift_buffer, thrift_msg) ? 0 : -1;
 	else if (data_type == RPCDataJson)
-		ret = thrift_msg->descriptor->json_reader(&thrift_buffer, thrift_msg) ? 0 : 1;
+		ret = thrift_msg->descriptor->json_reader(&thrift_buffer, thrift_msg) ? 0 : -1;
 	else
 		ret = -1;
 
@@ -616,6 +931,20 @@ int SRPCMessage::compress()
 					   : RPCStatusReqCompressSizeInvalid;
 	}
 
+	if (this->compress_stats)
+	{
+		int selected = this->compress_stats->select(type, buflen);
+
+		// the dictionary is only for the type set with it
+		if (selected != type)
+			this->set_compress_dict(0);
+
+		type = selected;
+		meta->set_compress_type(type);
+		if (type == RPCCompressNone)
+			return status_code;
+	}
+
 	origin_size = (int)buflen;
 	static RPCCompressor *compressor = RPCCompressor::get_instance();
 	int ret = compressor->lease_compressed_size(type, buflen);
@@ -636,7 +965,25 @@ int SRPCMessage::compress()
 		return is_resp ? RPCStatusRespCompressError : RPCStatusReqCompressError;
 
 	RPCBuffer *dst_buf = new RPCBuffer();
-	ret = compressor->serialize_to_compressed(this->buf, dst_buf, type);
+	long long ns_st = this->compress_stats ? GET_CURRENT_NS() : 0;
+
+	dst_buf->set_allocator(this->buf->get_allocator());
+	ret = compressor->serialize_to_compressed(this->buf, dst_buf, type,
+											  meta->compress_dict());
+	if (this->compress_stats && ret > 0)
+	{
+		this->compress_stats->observe(type, origin_size, ret,
+									  GET_CURRENT_NS() - ns_st);
+		// send this one as it is if not shrinking
+		if (ret >= origin_size)
+		{
+			this->buf->rewind();
+			meta->set_compress_type(RPCCompressNone);
+			this->set_compress_dict(0);
+			delete dst_buf;
+			return status_code;
+		}
+	}
 
 	if (ret == -2)
 	{
@@ -691,9 +1038,31 @@ int SRPCMessage::decompress()
 	if (this->buf->size() != (size_t)meta->compressed_size())
 		return is_resp ? RPCStatusRespCompressError : RPCStatusReqCompressError;
 
+	// parse from the compressed pieces without a decompressed copy,
+	// json is parsed from the whole buffer as before
+	if ((meta->data_type() == RPCDataProtobuf ||
+		 meta->data_type() == RPCDataThrift) &&
+		RPCDecompressStream::is_supported(type))
+	{
+		this->decompress_pending = true;
+		return status_code;
+	}
+
+	return this->decompress_buffer();
+}
+
+int SRPCMessage::decompress_buffer()
+{
+	const RPCMeta *meta = static_cast<const RPCMeta *>(this->meta);
+	bool is_resp = !meta->has_request();
+	int type = meta->compress_type();
+	int status_code = RPCStatusOK;
 	RPCBuffer *dst_buf = new RPCBuffer();
+
+	dst_buf->set_allocator(this->buf->get_allocator());
 	static RPCCompressor *compressor = RPCCompressor::get_instance();
-	int ret = compressor->parse_from_compressed(this->buf, dst_buf, type);
+	int ret = compressor->parse_from_compressed(this->buf, dst_buf, type,
+												meta->compress_dict());
 
 	if (ret == -2)
 	{
@@ -756,6 +1125,9 @@ static bool __deserialize_meta_http(const char *request_uri,
 			case 2:
 				meta->set_origin_size(atoi(value.c_str()));
 				break;
+			case 7:
+				meta->set_compress_dict(strtoul(value.c_str(), NULL, 10));
+				break;
 			case 4:
 				for (size_t i = 0; i < RPCDataTypeString.size(); i++)
 				{
@@ -866,6 +1238,12 @@ bool SRPCHttpRequest::serialize_meta()
 
 		set_header_pair(SRPCHttpHeaders.OriginSize,
 						std::to_string(meta->origin_size()));
+
+		if (meta->has_compress_dict())
+		{
+			set_header_pair(SRPCHttpHeaders.CompressDict,
+							std::to_string(meta->compress_dict()));
+		}
 	} else {
 		set_header_pair("Content-Length", std::to_string(this->message_len));
 	}
@@ -921,7 +1299,8 @@ bool SRPCHttpResponse::serialize_meta()
 	{
 		protocol::HttpUtil::set_response_status(this, HttpStatusNotImplemented);
 	}
-	else if (rpc_status_code == RPCStatusUpstreamFailed)
+	else if (rpc_status_code == RPCStatusUpstreamFailed
+			|| rpc_status_code == RPCStatusOverloaded)
 	{
 		protocol::HttpUtil::set_response_status(this,
 												HttpStatusServiceUnavailable);
@@ -952,6 +1331,12 @@ bool SRPCHttpResponse::serialize_meta()
 
 		set_header_pair(SRPCHttpHeaders.OriginSize,
 						std::to_string(meta->origin_size()));
+
+		if (meta->has_compress_dict())
+		{
+			set_header_pair(SRPCHttpHeaders.CompressDict,
+							std::to_string(meta->compress_dict()));
+		}
 	} else {
 		set_header_pair("Content-Length", std::to_string(this->message_len));
 	}
@@ -53,8 +53,23 @@ public:
 	void set_compress_type(int type) override;
 	void set_data_type(int type) override;
 
+	void set_compress_dict(unsigned int dict_id) override;
+	unsigned int get_compress_dict() const override;
+
+	int64_t get_correlation_id() const;
+	void set_correlation_id(int64_t cid);
+
 	void set_attachment_nocopy(const char *attachment, size_t len);
 	bool get_attachment_nocopy(const char **attachment, size_t *len) const;
+	bool set_attachment_file(int fd, size_t offset, size_t len);
+	void set_attachment_spill(int fd);
+
+	void set_buffer_allocator(RPCBufferAllocator *allocator) override
+	{
+		this->buf->set_allocator(allocator);
+	}
+
+	size_t get_body_size() const override { return this->buf->size(); }
 
 	bool set_meta_module_data(const RPCModuleData& data) override;
 	bool get_meta_module_data(RPCModuleData& data) const override;
@@ -77,14 +92,25 @@ public:
 
 protected:
 	void init_meta();
+	// decompress the whole body into a new buf
+	int decompress_buffer();
+	int append_body(const char *buf, size_t size, size_t size_limit);
+	int prepare_spill(size_t size_limit);
 
 	// "SRPC" + META_LEN + MESSAGE_LEN + RESERVED
 	char header[SRPC_HEADER_SIZE];
 	RPCBuffer *buf;
 	char *meta_buf;
+	bool body_taken;	// quota taken, receive body as it arrives
+	int spill_fd;
+	size_t spill_len;	// size of attachment written to spill_fd
 	size_t nreceived;
 	size_t meta_len;
 	size_t message_len;
+	size_t attachment_len;
+	RPCBuffer *attachment;
+	// still compressed, decompressed by deserialize() while parsing
+	bool decompress_pending;
 	ProtobufIDLMessage *meta;
 };
 
@@ -96,6 +122,10 @@ public:
 
 	void set_service_name(const std::string& service_name);
 	void set_method_name(const std::string& method_name);
+
+	unsigned int get_service_id() const;
+	unsigned int get_method_id() const;
+	void set_method_id(unsigned int service_id, unsigned int method_id);
 };
 
 class SRPCResponse : public SRPCMessage
@@ -154,6 +184,31 @@ public:
 		return this->SRPCRequest::set_method_name(method_name);
 	}
 
+	void set_seqid(long long seqid) override
+	{
+		this->SRPCMessage::set_correlation_id(seqid);
+	}
+
+	void set_method_id(unsigned int service_id, unsigned int method_id) override
+	{
+		this->SRPCRequest::set_method_id(service_id, method_id);
+	}
+
+	unsigned int get_service_id() const override
+	{
+		return this->SRPCRequest::get_service_id();
+	}
+
+	unsigned int get_method_id() const override
+	{
+		return this->SRPCRequest::get_method_id();
+	}
+
+	long long get_seqid() const override
+	{
+		return this->SRPCMessage::get_correlation_id();
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->SRPCMessage::set_meta_module_data(data);
@@ -218,6 +273,11 @@ public:
 		return this->SRPCResponse::set_error(error);
 	}
 
+	long long get_seqid() const override
+	{
+		return this->SRPCMessage::get_correlation_id();
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->SRPCMessage::set_meta_module_data(data);
@@ -259,6 +319,16 @@ public:
 		return this->SRPCRequest::set_method_name(method_name);
 	}
 
+	// attachment is not carried by http
+	void set_attachment_nocopy(const char *attachment, size_t len) { }
+	bool get_attachment_nocopy(const char **attachment, size_t *len) const
+	{
+		return false;
+	}
+
+	bool set_attachment_file(int fd, size_t offset, size_t len) { return false; }
+	void set_attachment_spill(int fd) { }
+
 	bool set_meta_module_data(const RPCModuleData& data) override;
 	bool get_meta_module_data(RPCModuleData& data) const override;
 
@@ -310,6 +380,16 @@ public:
 		return this->protocol::HttpResponse::set_status_code(std::to_string(code));
 	}
 
+	// attachment is not carried by http
+	void set_attachment_nocopy(const char *attachment, size_t len) { }
+	bool get_attachment_nocopy(const char **attachment, size_t *len) const
+	{
+		return false;
+	}
+
+	bool set_attachment_file(int fd, size_t offset, size_t len) { return false; }
+	void set_attachment_spill(int fd) { }
+
 	bool set_meta_module_data(const RPCModuleData& data) override;
 	bool get_meta_module_data(RPCModuleData& data) const override;
 
@@ -327,21 +407,26 @@ public:
 ////////
 // inl
 
-inline SRPCMessage::~SRPCMessage()
+inline void SRPCMessage::set_attachment_spill(int fd)
 {
-	delete []this->meta_buf;
-	delete this->meta;
-	delete this->buf;
+#ifndef _WIN32
+	// write the attachment received to fd instead of memory
+	this->spill_fd = fd;
+#endif
 }
 
 inline int SRPCMessage::encode(struct iovec vectors[], int max, size_t size_limit)
 {
-	if (this->message_len > 0x7FFFFFFF)
+	size_t sz = this->message_len + this->attachment_len;
+
+	if (sz > 0x7FFFFFFF)
 	{
 		errno = EOVERFLOW;
 		return -1;
 	}
 
+	int ret;
+	int total;
 	char *p = this->header;
 
 	memcpy(p, "SRPC", 4);
@@ -350,16 +435,28 @@ inline int SRPCMessage::encode(struct iovec vectors[], int max, size_t size_limi
 	*(uint32_t *)(p) = htonl((uint32_t)this->meta_len);
 	p += 4;
 
-	*(uint32_t *)(p) = htonl((uint32_t)this->message_len);
+	*(uint32_t *)(p) = htonl((uint32_t)sz);
 
 	vectors[0].iov_base = this->header;
 	vectors[0].iov_len = SRPC_HEADER_SIZE;
 	vectors[1].iov_base = this->meta_buf;
 	vectors[1].iov_len = this->meta_len;
 
-	int ret = this->buf->encode(vectors + 2, max - 2);
+	ret = this->buf->encode(vectors + 2, max - 2);
+	if (ret < 0)
+		return ret;
+
+	total = ret;
+	if (this->attachment_len)
+	{
+		ret = this->attachment->encode(vectors + 2 + ret, max - 2 - ret);
+		if (ret < 0)
+			return ret;
+
+		total += ret;
+	}
 
-	return ret < 0 ? ret : ret + 2;
+	return 2 + total;
 }
 
 inline bool SRPCMessage::serialize_meta()
@@ -369,11 +466,6 @@ inline bool SRPCMessage::serialize_meta()
 	return this->meta->SerializeToArray(this->meta_buf, (int)this->meta_len);
 }
 
-inline bool SRPCMessage::deserialize_meta()
-{
-	return this->meta->ParseFromArray(this->meta_buf, (int)this->meta_len);
-}
-
 } // namespace srpc
 
 #endif
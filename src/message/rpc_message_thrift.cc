@@ -15,7 +15,10 @@
 */
 
 #include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
 #include <workflow/HttpUtil.h>
+#include "rpc_compress.h"
 #include "rpc_message_thrift.h"
 
 namespace srpc
@@ -109,6 +112,221 @@ int ThriftMessage::append(const void *buf, size_t *size, size_t size_limit)
 	return thrift_parser_append_message(buf, size, &TBuffer_);
 }
 
+// THeader of Apache Thrift, after the frame size:
+// magic(2) flags(2) seqid(4) header words(2) header(words * 4) payload
+// header: protocol id, transform count and ids in varint, info, padding
+static constexpr uint16_t THEADER_MAGIC			=	0x0FFF;
+static constexpr size_t THEADER_FIXED_SIZE		=	10;
+static constexpr uint32_t THEADER_PROTOCOL_BINARY	=	0;
+static constexpr size_t THEADER_MAX_TRANSFORMS	=	8;
+
+static int thrift_transform_id(int type)
+{
+	switch (type)
+	{
+	case RPCCompressZlib:
+		return 0x01;
+	case RPCCompressSnappy:
+		return 0x03;
+	case RPCCompressZstd:
+		return 0x05;
+	default:
+		return -1;
+	}
+}
+
+static int thrift_transform_type(uint32_t id)
+{
+	switch (id)
+	{
+	case 0x01:
+		return RPCCompressZlib;
+	case 0x03:
+		return RPCCompressSnappy;
+	case 0x05:
+		return RPCCompressZstd;
+	default:
+		return -1;
+	}
+}
+
+static size_t thrift_write_varint(uint32_t val, char *buf)
+{
+	size_t len = 0;
+
+	while (val >= 0x80)
+	{
+		buf[len++] = (char)((val & 0x7F) | 0x80);
+		val >>= 7;
+	}
+
+	buf[len++] = (char)val;
+	return len;
+}
+
+static bool thrift_read_varint(const char **cur, const char *end,
+							   uint32_t *val)
+{
+	uint32_t res = 0;
+
+	for (int shift = 0; shift < 35 && *cur < end; shift += 7)
+	{
+		uint8_t byte = (uint8_t)*(*cur)++;
+
+		res |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			*val = res;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ThriftMessage::transformable() const
+{
+	if (compress_type_ == RPCCompressNone)
+		return true;
+
+	return thrift_transform_id(compress_type_) >= 0 &&
+		   RPCCompressor::get_instance()->find_handler(compress_type_);
+}
+
+bool ThriftMessage::transform(bool theader)
+{
+	const std::string& begin = TBuffer_.meta.writebuf;
+	char head[THEADER_FIXED_SIZE + 16] = { 0 };
+	size_t len = THEADER_FIXED_SIZE;
+	uint32_t count = 0;
+	int id = -1;
+	RPCBuffer src;
+
+	header_.clear();
+	payload_.clear();
+	if (!theader)
+		return true;
+
+	if (compress_type_ != RPCCompressNone)
+	{
+		id = thrift_transform_id(compress_type_);
+		if (id < 0)
+			return false;
+
+		count = 1;
+	}
+
+	// the whole message is the payload, including the message begin
+	src.append(begin.c_str(), begin.size(), BUFFER_MODE_NOCOPY);
+	buf_.share(&src);
+	if (count == 0)
+	{
+		if (payload_.append(&src) < 0)
+			return false;
+	}
+	else if (RPCCompressor::get_instance()->serialize_to_compressed(&src,
+										&payload_, compress_type_) < 0)
+	{
+		return false;
+	}
+
+	len += thrift_write_varint(THEADER_PROTOCOL_BINARY, head + len);
+	len += thrift_write_varint(count, head + len);
+	if (count > 0)
+		len += thrift_write_varint((uint32_t)id, head + len);
+
+	// header size is in words
+	len = THEADER_FIXED_SIZE + ((len - THEADER_FIXED_SIZE + 3) & ~(size_t)3);
+
+	uint16_t magic = htons(THEADER_MAGIC);
+	uint32_t seqid = htonl((uint32_t)TBuffer_.meta.seqid);
+	uint16_t words = htons((uint16_t)((len - THEADER_FIXED_SIZE) / 4));
+
+	memcpy(head, &magic, 2);
+	memcpy(head + 4, &seqid, 4);
+	memcpy(head + 8, &words, 2);
+	header_.assign(head, len);
+	return true;
+}
+
+bool ThriftMessage::untransform()
+{
+	char head[THEADER_FIXED_SIZE];
+	uint16_t magic = 0;
+	uint16_t words;
+
+	if (buf_.read(head, THEADER_FIXED_SIZE))
+		memcpy(&magic, head, 2);
+
+	// plain framed
+	if (ntohs(magic) != THEADER_MAGIC)
+	{
+		buf_.rewind();
+		return true;
+	}
+
+	memcpy(&words, head + 8, 2);
+
+	std::string header(ntohs(words) * 4, '\0');
+	const char *cur = header.c_str();
+	const char *end = cur + header.size();
+	int types[THEADER_MAX_TRANSFORMS];
+	uint32_t protocol_id;
+	uint32_t count;
+	uint32_t id;
+
+	if (!buf_.read(&header[0], header.size()) ||
+		!thrift_read_varint(&cur, end, &protocol_id) ||
+		protocol_id != THEADER_PROTOCOL_BINARY ||
+		!thrift_read_varint(&cur, end, &count) ||
+		count > THEADER_MAX_TRANSFORMS)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (!thrift_read_varint(&cur, end, &id))
+			return false;
+
+		types[i] = thrift_transform_type(id);
+		if (types[i] < 0)
+			return false;
+	}
+
+	// info headers are skipped, and the reply uses the first transform
+	theader_ = true;
+	compress_type_ = count > 0 ? types[0] : RPCCompressNone;
+	payload_.clear();
+	buf_.cut(THEADER_FIXED_SIZE + header.size(), &payload_);
+	buf_.clear();
+
+	// the transforms were applied in order when writing
+	for (uint32_t i = count; i > 0; i--)
+	{
+		if (RPCCompressor::get_instance()->parse_from_compressed(&payload_,
+											&buf_, types[i - 1]) < 0)
+		{
+			return false;
+		}
+
+		payload_.clear();
+		if (i > 1)
+		{
+			if (payload_.append(&buf_) < 0)
+				return false;
+		}
+	}
+
+	if (count == 0)
+	{
+		if (buf_.append(&payload_) < 0)
+			return false;
+	}
+
+	return true;
+}
+
 bool ThriftResponse::serialize_meta()
 {
 	if (status_code_ == RPCStatusOK)
@@ -267,7 +485,8 @@ bool ThriftHttpResponse::serialize_meta()
 			|| rpc_status_code == RPCStatusIDLSerializeNotSupported
 			|| rpc_status_code == RPCStatusIDLDeserializeNotSupported)
 		protocol::HttpUtil::set_response_status(this, HttpStatusNotImplemented);
-	else if (rpc_status_code == RPCStatusUpstreamFailed)
+	else if (rpc_status_code == RPCStatusUpstreamFailed
+			|| rpc_status_code == RPCStatusOverloaded)
 		protocol::HttpUtil::set_response_status(this, HttpStatusServiceUnavailable);
 	else
 		protocol::HttpUtil::set_response_status(this, HttpStatusInternalServerError);
@@ -76,10 +76,10 @@ public:
 	ThriftMessage& operator= (ThriftMessage&&) = delete;
 
 public:
-	int get_compress_type() const override { return RPCCompressNone; }
+	int get_compress_type() const override { return compress_type_; }
 	int get_data_type() const override { return RPCDataThrift; }
 
-	void set_compress_type(int type) override {}
+	void set_compress_type(int type) override { compress_type_ = type; }
 	void set_data_type(int type) override {}
 
 	void set_attachment_nocopy(const char *attachment, size_t len) { }
@@ -88,6 +88,17 @@ public:
 		return false;
 	}
 
+	bool set_attachment_file(int fd, size_t offset, size_t len) { return false; }
+	void set_attachment_spill(int fd) { }
+
+	void set_buffer_allocator(RPCBufferAllocator *allocator) override
+	{
+		buf_.set_allocator(allocator);
+		payload_.set_allocator(allocator);
+	}
+
+	size_t get_body_size() const override { return buf_.size(); }
+
 public:
 	int serialize(const ThriftIDLMessage *thrift_msg) override;
 	int deserialize(ThriftIDLMessage *thrift_msg) override;
@@ -102,12 +113,26 @@ public:
 	const ThriftMeta *get_meta() const { return &TBuffer_.meta; }
 	ThriftMeta *get_meta() { return &TBuffer_.meta; }
 
+	// framed message with THeader, such as from Apache Thrift THeader client
+	bool get_theader() const { return theader_; }
+	void set_theader(bool theader) { theader_ = theader; }
+
 protected:
 	int encode(struct iovec vectors[], int max, size_t size_limit);
 	int append(const void *buf, size_t *size, size_t size_limit);
 
+	// THeader of framed transport, for the compressed requests and
+	// the replies of THeader requests
+	bool transform(bool theader);
+	bool untransform();
+	bool transformable() const;
+
 	RPCBuffer buf_;
 	ThriftBuffer TBuffer_;
+	RPCBuffer payload_;
+	std::string header_;
+	int compress_type_ = RPCCompressNone;
+	bool theader_ = false;
 };
 
 class ThriftRequest : public ThriftMessage
@@ -172,12 +197,20 @@ public:
 public:
 	bool serialize_meta() override
 	{
-		return this->ThriftRequest::serialize_meta();
+		return this->ThriftRequest::serialize_meta() &&
+			   this->transform(this->compress_type_ != RPCCompressNone);
 	}
 
 	bool deserialize_meta() override
 	{
-		return this->ThriftRequest::deserialize_meta();
+		return this->untransform() && this->ThriftRequest::deserialize_meta();
+	}
+
+	// only framed transport compresses, with THeader
+	int compress() override
+	{
+		return this->transformable() ? RPCStatusOK :
+									   RPCStatusReqCompressNotSupported;
 	}
 
 public:
@@ -206,6 +239,11 @@ public:
 		this->ThriftRequest::set_seqid(seqid);
 	}
 
+	long long get_seqid() const override
+	{
+		return (uint32_t)TBuffer_.meta.seqid;
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->ThriftMessage::set_meta_module_data(data);
@@ -237,12 +275,20 @@ public:
 public:
 	bool serialize_meta() override
 	{
-		return this->ThriftResponse::serialize_meta();
+		return this->ThriftResponse::serialize_meta() &&
+			   this->transform(this->theader_);
 	}
 
 	bool deserialize_meta() override
 	{
-		return this->ThriftResponse::deserialize_meta();
+		return this->untransform() && this->ThriftResponse::deserialize_meta();
+	}
+
+	// not compressed if the request is not THeader
+	int compress() override
+	{
+		return !this->theader_ || this->transformable() ? RPCStatusOK :
+									RPCStatusRespCompressNotSupported;
 	}
 
 public:
@@ -271,6 +317,11 @@ public:
 		return this->ThriftResponse::set_error(error);
 	}
 
+	long long get_seqid() const override
+	{
+		return (uint32_t)TBuffer_.meta.seqid;
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->ThriftMessage::set_meta_module_data(data);
@@ -405,12 +456,18 @@ inline int ThriftMessage::serialize(const ThriftIDLMessage *thrift_msg)
 {
 	if (thrift_msg)
 	{
+		if (this->sizer)
+			this->sizer->prepare(&buf_);
+
 		if (!thrift_msg->descriptor->writer(thrift_msg, &TBuffer_))
 		{
 			return TBuffer_.meta.message_type == TMT_CALL ?
 												 RPCStatusReqSerializeError :
 												 RPCStatusRespSerializeError;
 		}
+
+		if (this->sizer)
+			this->sizer->observe(buf_.size());
 	}
 
 	return RPCStatusOK;
@@ -434,6 +491,27 @@ inline int ThriftMessage::deserialize(ThriftIDLMessage *thrift_msg)
 inline int ThriftMessage::encode(struct iovec vectors[], int max,
 								 size_t size_limit)
 {
+	if (!header_.empty())
+	{
+		size_t sz = header_.size() + payload_.size();
+
+		if (sz > 0x7FFFFFFF)
+		{
+			errno = EOVERFLOW;
+			return -1;
+		}
+
+		TBuffer_.framesize = ntohl((int32_t)sz);
+		vectors[0].iov_base = (char *)&TBuffer_.framesize;
+		vectors[0].iov_len = sizeof (int32_t);
+		vectors[1].iov_base = const_cast<char *>(header_.c_str());
+		vectors[1].iov_len = header_.size();
+
+		int ret = payload_.encode(vectors + 2, max - 2);
+
+		return ret < 0 ? ret : 2 + ret;
+	}
+
 	size_t sz = TBuffer_.meta.writebuf.size() + buf_.size();
 
 	if (sz > 0x7FFFFFFF)
@@ -145,7 +145,8 @@ static int GetHttpCompressType(const std::string &type)
 		{"x-snappy",	RPCCompressSnappy},
 		{"gzip",		RPCCompressGzip},
 		{"deflate",		RPCCompressZlib},
-		{"x-lz4",		RPCCompressLz4}
+		{"x-lz4",		RPCCompressLz4},
+		{"zstd",		RPCCompressZstd}
 	};
 	auto it = M.find(type);
 	return it == M.end() ? RPCCompressNone : it->second;
@@ -165,6 +166,8 @@ static std::string GetHttpCompressTypeStr(int type)
 			return "deflate";
 		case RPCCompressLz4:
 			return "x-lz4";
+		case RPCCompressZstd:
+			return "zstd";
 	}
 
 	return "";
@@ -351,8 +354,10 @@ TRPCMessage::TRPCMessage()
 {
 	this->nreceived = 0;
 	this->meta_buf = NULL;
+	this->body_taken = false;
 	this->meta_len = 0;
 	this->message_len = 0;
+	this->decompress_pending = false;
 	memset(this->header, 0, TRPC_HEADER_SIZE);
 	this->message = new RPCBuffer();
 }
@@ -366,12 +371,26 @@ TRPCMessage::~TRPCMessage()
 
 TRPCRequest::TRPCRequest()
 {
-	this->meta = new RequestProtocol();
+	this->meta = RPCObjectRecycler<RequestProtocol>::get();
+}
+
+TRPCRequest::~TRPCRequest()
+{
+	RPCObjectRecycler<RequestProtocol>::put(
+						static_cast<RequestProtocol *>(this->meta));
+	this->meta = NULL;
 }
 
 TRPCResponse::TRPCResponse()
 {
-	this->meta = new ResponseProtocol();
+	this->meta = RPCObjectRecycler<ResponseProtocol>::get();
+}
+
+TRPCResponse::~TRPCResponse()
+{
+	RPCObjectRecycler<ResponseProtocol>::put(
+						static_cast<ResponseProtocol *>(this->meta));
+	this->meta = NULL;
 }
 
 int TRPCMessage::encode(struct iovec vectors[], int max, size_t size_limit)
@@ -441,6 +460,12 @@ int TRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 			sp = (uint16_t *)this->header + 4;
 			this->meta_len = ntohs(*sp);
 
+			if (buf_len < TRPC_HEADER_SIZE + this->meta_len)
+			{
+				errno = EBADMSG;
+				return -1;
+			}
+
 			this->message_len = buf_len - TRPC_HEADER_SIZE - this->meta_len;
 			buf_len -= TRPC_HEADER_SIZE;
 
@@ -455,6 +480,9 @@ int TRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 					*size = header_left + buf_len;
 
 				this->meta_buf = new char[this->meta_len];
+				// over the quota, receive meta only and drop the body
+				if (this->message_len > 0 && this->take_quota(this->message_len))
+					this->body_taken = true;
 
 				if (*size - header_left <= this->meta_len)
 				{
@@ -464,9 +492,13 @@ int TRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 					memcpy(this->meta_buf, (const char *)buf + header_left,
 						   this->meta_len);
 
-					this->message->append((const char *)buf + header_left + this->meta_len,
-										  *size - header_left - this->meta_len,
-										  BUFFER_MODE_COPY);
+					if (this->body_taken &&
+						!this->message->write_message((const char *)buf + header_left + this->meta_len,
+												 *size - header_left - this->meta_len,
+												 this->message_len))
+					{
+						return -1;
+					}
 				}
 
 				this->nreceived += *size - header_left;
@@ -509,12 +541,19 @@ int TRPCMessage::append(const void *buf, size_t *size, size_t size_limit)
 			memcpy(this->meta_buf + body_received, buf,
 				   this->meta_len - body_received);
 
-			if (body_received + *size > this->meta_len)// useless. always true
-				this->message->append((const char *)buf + this->meta_len - body_received,
-									  *size - this->meta_len + body_received,
-									  BUFFER_MODE_COPY);
-		} else {
-			this->message->append((const char *)buf, *size, BUFFER_MODE_COPY);
+			if (this->body_taken &&
+				!this->message->write_message((const char *)buf + this->meta_len - body_received,
+										 *size - this->meta_len + body_received,
+										 this->message_len))
+			{
+				return -1;
+			}
+		} else if (this->body_taken) {
+			if (!this->message->write_message(buf, *size, this->meta_len +
+											this->message_len - body_received))
+			{
+				return -1;
+			}
 		}
 
 		this->nreceived += *size;
@@ -592,6 +631,12 @@ inline int TRPCMessage::compress_type_trpc_srpc(int trpc_content_encoding) const
 			return RPCCompressGzip;
 		case TrpcCompressType::TRPC_SNAPPY_COMPRESS :
 			return RPCCompressSnappy;
+		case TrpcCompressType::TRPC_ZLIB_COMPRESS :
+			return RPCCompressZlib;
+		case TrpcCompressType::TRPC_LZ4_COMPRESS :
+			return RPCCompressLz4;
+		case TrpcCompressType::TRPC_ZSTD_COMPRESS :
+			return RPCCompressZstd;
 		default :
 			return -1;
 	}
@@ -611,6 +656,8 @@ inline int TRPCMessage::compress_type_srpc_trpc(int srpc_compress_type) const
 			return TrpcCompressType::TRPC_ZLIB_COMPRESS;
 		case RPCCompressLz4 :
 			return TrpcCompressType::TRPC_LZ4_COMPRESS;
+		case RPCCompressZstd :
+			return TrpcCompressType::TRPC_ZSTD_COMPRESS;
 		default :
 			return -1;
 	}
@@ -677,6 +724,8 @@ inline int TRPCMessage::status_code_srpc_trpc(int srpc_status_code) const
 	case RPCStatusUpstreamFailed:
 	case RPCStatusDNSError:
 		return TrpcRetCode::TRPC_CLIENT_ROUTER_ERR;
+	case RPCStatusOverloaded:
+		return TrpcRetCode::TRPC_SERVER_OVERLOAD_ERR;
 	case RPCStatusSystemError:
 		return TrpcRetCode::TRPC_SERVER_SYSTEM_ERR;
 //		return TrpcRetCode::TRPC_CLINET_NETWORK_ERR;
@@ -705,6 +754,8 @@ inline int TRPCMessage::status_code_trpc_srpc(int trpc_ret_code) const
 		return RPCStatusRespDeserializeError;
 	case TrpcRetCode::TRPC_CLIENT_ROUTER_ERR:
 		return RPCStatusUpstreamFailed;
+	case TrpcRetCode::TRPC_SERVER_OVERLOAD_ERR:
+		return RPCStatusOverloaded;
 //		return RPCStatusDNSError;
 	default:
 		return RPCStatusSystemError;
@@ -894,9 +945,13 @@ int TRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 	bool is_resp = (meta != NULL);
 
 	int data_type = this->get_data_type();
-	RPCOutputStream output_stream(this->message, pb_msg->ByteSizeLong());
 	int ret;
 
+	if (this->sizer)
+		this->sizer->prepare(this->message);
+
+	RPCOutputStream output_stream(this->message, pb_msg->ByteSizeLong());
+
 	if (data_type == RPCDataProtobuf)
 		ret = pb_msg->SerializeToZeroCopyStream(&output_stream) ? 0 : -1;
 	else if (data_type == RPCDataJson)
@@ -933,6 +988,9 @@ int TRPCMessage::serialize(const ProtobufIDLMessage *pb_msg)
 		return is_resp ? RPCStatusRespSerializeError :
 						 RPCStatusReqSerializeError;
 
+	if (this->sizer)
+		this->sizer->observe(this->message_len);
+
 	return RPCStatusOK;
 }
 
@@ -942,8 +1000,41 @@ int TRPCMessage::deserialize(ProtobufIDLMessage *pb_msg)
 	ResponseProtocol *meta = dynamic_cast<ResponseProtocol *>(this->meta);
 	bool is_resp = (meta != NULL);
 	int data_type = this->get_data_type();
+	int status_code;
 	int ret;
 
+	if (this->decompress_pending && data_type == RPCDataProtobuf)
+	{
+		RPCDecompressStream decompress_stream(this->message);
+
+		if (decompress_stream.begin(this->get_compress_type(), 0))
+		{
+			ret = pb_msg->ParseFromZeroCopyStream(&decompress_stream) ? 0 : -1;
+			if (!decompress_stream.finish())
+				return is_resp ? RPCStatusRespDecompressError :
+								 RPCStatusReqDecompressError;
+
+			if (decompress_stream.ByteCount() == 0)
+				return is_resp ? RPCStatusRespDecompressSizeInvalid :
+								 RPCStatusReqDecompressSizeInvalid;
+
+			if (ret < 0)
+				return is_resp ? RPCStatusRespDeserializeError :
+								 RPCStatusReqDeserializeError;
+
+			return RPCStatusOK;
+		}
+	}
+
+	// chunks a stream can not begin with are decompressed whole
+	if (this->decompress_pending)
+	{
+		this->decompress_pending = false;
+		status_code = this->decompress_buffer();
+		if (status_code != RPCStatusOK)
+			return status_code;
+	}
+
 	RPCInputStream input_stream(this->message);
 
 	if (data_type == RPCDataProtobuf)
@@ -994,6 +1085,14 @@ int TRPCMessage::compress()
 	if (type == RPCCompressNone)
 		return status_code;
 
+	if (this->compress_stats)
+	{
+		type = this->compress_stats->select(type, buflen);
+		this->set_compress_type(type);
+		if (type == RPCCompressNone)
+			return status_code;
+	}
+
 	static RPCCompressor *compressor = RPCCompressor::get_instance();
 	int ret = compressor->lease_compressed_size(type, buflen);
 
@@ -1006,7 +1105,23 @@ int TRPCMessage::compress()
 
 	//buflen = ret;
 	RPCBuffer *dst_buf = new RPCBuffer();
+	long long ns_st = this->compress_stats ? GET_CURRENT_NS() : 0;
+
+	dst_buf->set_allocator(this->message->get_allocator());
 	ret = compressor->serialize_to_compressed(this->message, dst_buf, type);
+	if (this->compress_stats && ret > 0)
+	{
+		this->compress_stats->observe(type, buflen, ret,
+									  GET_CURRENT_NS() - ns_st);
+		// send this one as it is if not shrinking
+		if ((size_t)ret >= buflen)
+		{
+			this->message->rewind();
+			this->set_compress_type(RPCCompressNone);
+			delete dst_buf;
+			return status_code;
+		}
+	}
 
 	if (ret == -2)
 	{
@@ -1048,7 +1163,27 @@ int TRPCMessage::decompress()
 	if (this->message_len == 0 || type == RPCCompressNone)
 		return status_code;
 
+	// parse from the compressed pieces without a decompressed copy,
+	// json is parsed from the whole buffer as before
+	if (this->get_data_type() == RPCDataProtobuf &&
+		RPCDecompressStream::is_supported(type))
+	{
+		this->decompress_pending = true;
+		return status_code;
+	}
+
+	return this->decompress_buffer();
+}
+
+int TRPCMessage::decompress_buffer()
+{
+	ResponseProtocol *meta = dynamic_cast<ResponseProtocol *>(this->meta);
+	bool is_resp = (meta != NULL);
+	int type = this->get_compress_type();
+	int status_code = RPCStatusOK;
 	RPCBuffer *dst_buf = new RPCBuffer();
+
+	dst_buf->set_allocator(this->message->get_allocator());
 	static RPCCompressor *compressor = RPCCompressor::get_instance();
 	int ret = compressor->parse_from_compressed(this->message, dst_buf, type);
 
@@ -1402,7 +1537,8 @@ bool TRPCHttpResponse::serialize_meta()
 	{
 		protocol::HttpUtil::set_response_status(this, HttpStatusNotImplemented);
 	}
-	else if (rpc_status_code == RPCStatusUpstreamFailed)
+	else if (rpc_status_code == RPCStatusUpstreamFailed
+			|| rpc_status_code == RPCStatusOverloaded)
 	{
 		protocol::HttpUtil::set_response_status(this,
 												HttpStatusServiceUnavailable);
@@ -47,6 +47,16 @@ public:
 		return false;
 	}
 
+	bool set_attachment_file(int fd, size_t offset, size_t len) { return false; }
+	void set_attachment_spill(int fd) { }
+
+	void set_buffer_allocator(RPCBufferAllocator *allocator) override
+	{
+		this->message->set_allocator(allocator);
+	}
+
+	size_t get_body_size() const override { return this->message->size(); }
+
 public:
 	using RPCMessage::serialize;
 	using RPCMessage::deserialize;
@@ -61,10 +71,15 @@ protected:
 	size_t meta_len;
 	size_t message_len;
 	char *meta_buf;
+	bool body_taken;	// quota taken, receive body as it arrives
 	RPCBuffer *message;
+	// still compressed, decompressed by deserialize() while parsing
+	bool decompress_pending;
 	ProtobufIDLMessage *meta;
 
 protected:
+	// decompress the whole message into a new buffer
+	int decompress_buffer();
 	int compress_type_trpc_srpc(int trpc_content_encoding) const;
 	int compress_type_srpc_trpc(int srpc_compress_type) const;
 	int data_type_trpc_srpc(int trpc_content_type) const;
@@ -80,6 +95,7 @@ class TRPCRequest : public TRPCMessage
 {
 public:
 	TRPCRequest();
+	virtual ~TRPCRequest();
 
 	bool serialize_meta();
 	bool deserialize_meta();
@@ -112,6 +128,7 @@ class TRPCResponse : public TRPCMessage
 {
 public:
 	TRPCResponse();
+	virtual ~TRPCResponse();
 
 	bool serialize_meta();
 	bool deserialize_meta();
@@ -186,6 +203,16 @@ public:
 		return this->TRPCRequest::set_method_name(method_name);
 	}
 
+	void set_seqid(long long seqid) override
+	{
+		this->TRPCRequest::set_request_id((int32_t)seqid);
+	}
+
+	long long get_seqid() const override
+	{
+		return (uint32_t)this->TRPCRequest::get_request_id();
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->TRPCRequest::set_meta_module_data(data);
@@ -256,6 +283,11 @@ public:
 		return this->TRPCResponse::set_error(error);
 	}
 
+	long long get_seqid() const override
+	{
+		return (uint32_t)this->TRPCResponse::get_request_id();
+	}
+
 	bool set_meta_module_data(const RPCModuleData& data) override
 	{
 		return this->TRPCResponse::set_meta_module_data(data);
@@ -281,6 +281,21 @@ HistogramCounterVar *RPCMetricsFilter::create_histogram_counter(const std::strin
 	return hc;
 }
 
+bool RPCMetricsFilter::expose_var(const std::string& name)
+{
+	this->mutex.lock();
+	const auto it = var_names.insert(name);
+	this->mutex.unlock();
+
+	if (!it.second)
+	{
+		errno = EEXIST;
+		return false;
+	}
+
+	return true;
+}
+
 void RPCMetricsFilter::reduce(std::unordered_map<std::string, RPCVar *>& out)
 {
 	std::unordered_map<std::string, RPCVar *>::iterator it;
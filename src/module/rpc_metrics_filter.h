@@ -68,6 +68,9 @@ public:
 	SummaryVar *summary(const std::string& name);
 	HistogramCounterVar *histogram_counter(const std::string &name);
 
+	// report the vars updated by srpc itself, such as RPC_BUFFER_PIECE_HIT_VAR
+	bool expose_var(const std::string& name);
+
 	// filter api
 	bool client_end(SubTask *task, RPCModuleData& data) override;
 	bool server_end(SubTask *task, RPCModuleData& data) override;
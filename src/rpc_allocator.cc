@@ -0,0 +1,968 @@
+/*
+  Copyright (c) 2024 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <new>
+#include <string>
+#include <mutex>
+#include <unordered_set>
+#include "rpc_var.h"
+#include "rpc_buffer.h"
+#include "rpc_allocator.h"
+
+namespace srpc
+{
+
+RPCBufferAllocator *RPCBufferAllocator::default_allocator_ =
+										RPCSlabAllocator::get_instance();
+
+static GaugeVar *__local_gauge(const std::string& name, const std::string& help)
+{
+	RPCVarLocal *local = RPCVarLocal::get_instance();
+	GaugeVar *gauge = new GaugeVar(name, help);
+	RPCVar *var;
+
+	local->add(name, gauge);
+	local->mutex.lock();
+	var = local->vars[name];
+	local->mutex.unlock();
+
+	// someone has already created this var in current thread
+	if (var != gauge)
+		delete gauge;
+
+	return static_cast<GaugeVar *>(var);
+}
+
+// numbers of one thread, summed by the vars below only when collected
+struct RPCBufferStats
+{
+	std::atomic<long long> piece_hit;
+	std::atomic<long long> piece_miss;
+	std::atomic<long long> piece_cached;
+	// a piece may be freed in another thread, so one thread may be negative
+	std::atomic<long long> buffer_total;
+	std::atomic<long long> buffer_inflight;
+	std::atomic<long long> buffer_overload;
+	std::atomic<long long> arena_used;
+	std::atomic<long long> arena_miss;
+
+	RPCBufferStats() :
+		piece_hit(0),
+		piece_miss(0),
+		piece_cached(0),
+		buffer_total(0),
+		buffer_inflight(0),
+		buffer_overload(0),
+		arena_used(0),
+		arena_miss(0)
+	{
+	}
+
+	void add_to(RPCBufferStats *out) const
+	{
+		out->piece_hit += this->piece_hit.load(std::memory_order_relaxed);
+		out->piece_miss += this->piece_miss.load(std::memory_order_relaxed);
+		out->piece_cached += this->piece_cached.load(std::memory_order_relaxed);
+		out->buffer_total += this->buffer_total.load(std::memory_order_relaxed);
+		out->buffer_inflight += this->buffer_inflight.load(std::memory_order_relaxed);
+		out->buffer_overload += this->buffer_overload.load(std::memory_order_relaxed);
+		out->arena_used += this->arena_used.load(std::memory_order_relaxed);
+		out->arena_miss += this->arena_miss.load(std::memory_order_relaxed);
+	}
+};
+
+using RPCBufferStatsField = std::atomic<long long> RPCBufferStats::*;
+
+class RPCBufferStatsList
+{
+public:
+	static RPCBufferStatsList *get_instance()
+	{
+		// never destroyed, pieces may be released after static destructors
+		static RPCBufferStatsList *kInstance = new RPCBufferStatsList;
+		return kInstance;
+	}
+
+	void add(RPCBufferStats *stats)
+	{
+		this->mutex.lock();
+		this->stats.insert(stats);
+		this->mutex.unlock();
+	}
+
+	// numbers of an exited thread are kept
+	void remove(RPCBufferStats *stats)
+	{
+		this->mutex.lock();
+		this->stats.erase(stats);
+		stats->add_to(&this->exited);
+		this->mutex.unlock();
+	}
+
+	long long sum(RPCBufferStatsField field)
+	{
+		long long total;
+
+		this->mutex.lock();
+		total = (this->exited.*field).load(std::memory_order_relaxed);
+		for (const RPCBufferStats *stats : this->stats)
+			total += (stats->*field).load(std::memory_order_relaxed);
+		this->mutex.unlock();
+
+		return total;
+	}
+
+public:
+	std::mutex mutex;
+	std::unordered_set<RPCBufferStats *> stats;
+	// also taken directly by the threads exiting
+	RPCBufferStats exited;
+	// bytes of all pieces, flushed by each thread in batches for the quota
+	std::atomic<long long> total_size;
+
+private:
+	RPCBufferStatsList() : total_size(0) { }
+};
+
+// reads RPCBufferStats when collected, so holds no pointer of any thread
+class RPCBufferStatsGauge : public GaugeVar
+{
+public:
+	RPCVar *create(bool with_data) override
+	{
+		auto *var = new RPCBufferStatsGauge(this->name, this->help, this->field);
+
+		if (with_data)
+			var->set((double)RPCBufferStatsList::get_instance()->sum(this->field));
+
+		return var;
+	}
+
+	void reset() override { }
+
+public:
+	RPCBufferStatsGauge(const std::string& name, const std::string& help,
+						RPCBufferStatsField field) :
+		GaugeVar(name, help),
+		field(field)
+	{
+	}
+
+private:
+	RPCBufferStatsField field;
+};
+
+// the same for monotonic numbers, one series without label
+class RPCBufferStatsCounter : public CounterVar
+{
+public:
+	RPCVar *create(bool with_data) override
+	{
+		auto *var = new RPCBufferStatsCounter(this->name, this->help, this->field);
+
+		if (with_data)
+		{
+			var->add({})->set(
+				(double)RPCBufferStatsList::get_instance()->sum(this->field));
+		}
+
+		return var;
+	}
+
+	void reset() override { }
+
+public:
+	RPCBufferStatsCounter(const std::string& name, const std::string& help,
+						  RPCBufferStatsField field) :
+		CounterVar(name, help),
+		field(field)
+	{
+	}
+
+private:
+	RPCBufferStatsField field;
+};
+
+static bool __register_stats_vars()
+{
+	RPCVarLocal *local = RPCVarLocal::get_instance();
+
+	local->add(RPC_BUFFER_PIECE_HIT_VAR,
+			   new RPCBufferStatsCounter(RPC_BUFFER_PIECE_HIT_VAR,
+						"RPCBuffer pieces reused from slab cache",
+						&RPCBufferStats::piece_hit));
+	local->add(RPC_BUFFER_PIECE_MISS_VAR,
+			   new RPCBufferStatsCounter(RPC_BUFFER_PIECE_MISS_VAR,
+						"RPCBuffer pieces allocated by malloc",
+						&RPCBufferStats::piece_miss));
+	local->add(RPC_BUFFER_PIECE_CACHED_VAR,
+			   new RPCBufferStatsGauge(RPC_BUFFER_PIECE_CACHED_VAR,
+						"bytes held by RPCBuffer slab cache",
+						&RPCBufferStats::piece_cached));
+	local->add(RPC_BUFFER_TOTAL_VAR,
+			   new RPCBufferStatsGauge(RPC_BUFFER_TOTAL_VAR,
+						"bytes of all RPCBuffer pieces",
+						&RPCBufferStats::buffer_total));
+	local->add(RPC_BUFFER_INFLIGHT_VAR,
+			   new RPCBufferStatsGauge(RPC_BUFFER_INFLIGHT_VAR,
+						"bytes of request bodies in flight",
+						&RPCBufferStats::buffer_inflight));
+	local->add(RPC_BUFFER_OVERLOAD_VAR,
+			   new RPCBufferStatsCounter(RPC_BUFFER_OVERLOAD_VAR,
+						"requests refused by buffer limit",
+						&RPCBufferStats::buffer_overload));
+	local->add(RPC_BUFFER_ARENA_USED_VAR,
+			   new RPCBufferStatsGauge(RPC_BUFFER_ARENA_USED_VAR,
+						"bytes of RPCBuffer arena in use",
+						&RPCBufferStats::arena_used));
+	local->add(RPC_BUFFER_ARENA_MISS_VAR,
+			   new RPCBufferStatsCounter(RPC_BUFFER_ARENA_MISS_VAR,
+						"RPCBuffer pieces not from arena",
+						&RPCBufferStats::arena_miss));
+	return true;
+}
+
+class RPCBufferStatsLocal
+{
+public:
+	static RPCBufferStats *get_stats()
+	{
+		// pieces may be released by the destructors after ours
+		if (destroyed_)
+			return &RPCBufferStatsList::get_instance()->exited;
+
+		return &RPCBufferStatsLocal::get_local()->stats;
+	}
+
+	// the process total moves only when one thread changes over a batch
+	static void add_total(long long n)
+	{
+		RPCBufferStatsList *list = RPCBufferStatsList::get_instance();
+
+		if (destroyed_)
+		{
+			list->total_size.fetch_add(n, std::memory_order_relaxed);
+			return;
+		}
+
+		RPCBufferStatsLocal *local = RPCBufferStatsLocal::get_local();
+		long long pending = local->total_pending + n;
+
+		if (pending >= BUFFER_TOTAL_BATCH_SIZE ||
+			pending <= -BUFFER_TOTAL_BATCH_SIZE)
+		{
+			list->total_size.fetch_add(pending, std::memory_order_relaxed);
+			pending = 0;
+		}
+
+		local->total_pending = pending;
+	}
+
+private:
+	static RPCBufferStatsLocal *get_local()
+	{
+		static thread_local RPCBufferStatsLocal kInstance;
+		return &kInstance;
+	}
+
+	RPCBufferStatsLocal() : total_pending(0)
+	{
+		static bool registered = __register_stats_vars();
+
+		(void)registered;
+		RPCBufferStatsList::get_instance()->add(&this->stats);
+	}
+
+	~RPCBufferStatsLocal()
+	{
+		RPCBufferStatsList *list = RPCBufferStatsList::get_instance();
+
+		list->total_size.fetch_add(this->total_pending,
+								   std::memory_order_relaxed);
+		list->remove(&this->stats);
+		destroyed_ = true;
+	}
+
+	RPCBufferStats stats;
+	long long total_pending;	// not flushed to total_size yet
+	static thread_local bool destroyed_;
+};
+
+thread_local bool RPCBufferStatsLocal::destroyed_ = false;
+
+static inline void __stats_add(RPCBufferStatsField field, long long n)
+{
+	(RPCBufferStatsLocal::get_stats()->*field).fetch_add(n,
+											std::memory_order_relaxed);
+}
+
+static inline int __slab_class(size_t size)
+{
+	size_t class_size = (size_t)1 << SLAB_CLASS_MIN_SHIFT;
+	int cls = 0;
+
+	while (class_size < size && cls < SLAB_CLASS_NUM)
+	{
+		class_size <<= 1;
+		cls++;
+	}
+
+	return cls;
+}
+
+class RPCSlabCache
+{
+public:
+	// NULL after destroyed, then pieces go to malloc and free directly
+	static RPCSlabCache *get_instance()
+	{
+		if (destroyed_)
+			return NULL;
+
+		static thread_local RPCSlabCache kInstance;
+		return &kInstance;
+	}
+
+	void *pop(int cls)
+	{
+		struct slab_node_t *node = this->free_list[cls];
+
+		if (!node)
+		{
+			__stats_add(&RPCBufferStats::piece_miss, 1);
+			return NULL;
+		}
+
+		this->free_list[cls] = node->next;
+		this->count[cls]--;
+		__stats_add(&RPCBufferStats::piece_hit, 1);
+		__stats_add(&RPCBufferStats::piece_cached,
+					-(long long)this->class_size(cls));
+		return node;
+	}
+
+	bool push(int cls, void *ptr, size_t limit)
+	{
+		size_t sz = this->class_size(cls);
+		struct slab_node_t *node;
+
+		if ((this->count[cls] + 1) * sz > limit)
+			return false;
+
+		node = static_cast<struct slab_node_t *>(ptr);
+		node->next = this->free_list[cls];
+		this->free_list[cls] = node;
+		this->count[cls]++;
+		__stats_add(&RPCBufferStats::piece_cached, (long long)sz);
+		return true;
+	}
+
+	static size_t class_size(int cls)
+	{
+		return (size_t)1 << (cls + SLAB_CLASS_MIN_SHIFT);
+	}
+
+private:
+	RPCSlabCache()
+	{
+		for (int i = 0; i < SLAB_CLASS_NUM; i++)
+		{
+			this->free_list[i] = NULL;
+			this->count[i] = 0;
+		}
+	}
+
+	~RPCSlabCache()
+	{
+		struct slab_node_t *node;
+
+		destroyed_ = true;
+
+		for (int i = 0; i < SLAB_CLASS_NUM; i++)
+		{
+			while ((node = this->free_list[i]) != NULL)
+			{
+				this->free_list[i] = node->next;
+				free(node);
+			}
+
+			__stats_add(&RPCBufferStats::piece_cached,
+						-(long long)(this->count[i] * this->class_size(i)));
+			this->count[i] = 0;
+		}
+	}
+
+private:
+	struct slab_node_t
+	{
+		struct slab_node_t *next;
+	};
+
+	struct slab_node_t *free_list[SLAB_CLASS_NUM];
+	size_t count[SLAB_CLASS_NUM];
+	static thread_local bool destroyed_;
+};
+
+thread_local bool RPCSlabCache::destroyed_ = false;
+
+void *RPCSlabAllocator::allocate(size_t size)
+{
+	RPCSlabCache *cache = RPCSlabCache::get_instance();
+	int cls = __slab_class(size);
+	void *ptr;
+
+	if (cls < SLAB_CLASS_NUM)
+	{
+		if (!cache)
+			__stats_add(&RPCBufferStats::piece_miss, 1);
+		else if ((ptr = cache->pop(cls)) != NULL)
+			return ptr;
+
+		// always malloc the whole class so that it can be reused by others
+		return malloc(RPCSlabCache::class_size(cls));
+	}
+
+	__stats_add(&RPCBufferStats::piece_miss, 1);
+	return malloc(size);
+}
+
+void RPCSlabAllocator::deallocate(void *ptr, size_t size)
+{
+	RPCSlabCache *cache = RPCSlabCache::get_instance();
+	int cls = __slab_class(size);
+
+	if (cls < SLAB_CLASS_NUM && cache &&
+		cache->push(cls, ptr, this->cache_size))
+	{
+		return;
+	}
+
+	free(ptr);
+}
+
+size_t RPCObjectAllocator::cache_size_ = OBJECT_CACHE_SIZE_DEFAULT;
+
+class RPCObjectCache
+{
+public:
+	static RPCObjectCache *get_instance()
+	{
+		static thread_local RPCObjectCache kInstance;
+		return &kInstance;
+	}
+
+	void *pop(int cls)
+	{
+		struct object_node_t *node = this->free_list[cls];
+
+		if (node)
+		{
+			this->free_list[cls] = node->next;
+			this->count[cls]--;
+		}
+
+		return node;
+	}
+
+	bool push(int cls, void *ptr, size_t limit)
+	{
+		struct object_node_t *node;
+
+		if ((this->count[cls] + 1) * this->class_size(cls) > limit)
+			return false;
+
+		node = static_cast<struct object_node_t *>(ptr);
+		node->next = this->free_list[cls];
+		this->free_list[cls] = node;
+		this->count[cls]++;
+		return true;
+	}
+
+	static int size_class(size_t size)
+	{
+		return (int)((size - 1) >> OBJECT_CLASS_SHIFT);
+	}
+
+	static size_t class_size(int cls)
+	{
+		return (size_t)(cls + 1) << OBJECT_CLASS_SHIFT;
+	}
+
+private:
+	RPCObjectCache()
+	{
+		for (int i = 0; i < OBJECT_CLASS_NUM; i++)
+		{
+			this->free_list[i] = NULL;
+			this->count[i] = 0;
+		}
+	}
+
+	~RPCObjectCache()
+	{
+		struct object_node_t *node;
+
+		for (int i = 0; i < OBJECT_CLASS_NUM; i++)
+		{
+			while ((node = this->free_list[i]) != NULL)
+			{
+				this->free_list[i] = node->next;
+				::operator delete(node);
+			}
+		}
+	}
+
+private:
+	struct object_node_t
+	{
+		struct object_node_t *next;
+	};
+
+	struct object_node_t *free_list[OBJECT_CLASS_NUM];
+	size_t count[OBJECT_CLASS_NUM];
+};
+
+void *RPCObjectAllocator::allocate(size_t size)
+{
+	int cls;
+	void *ptr;
+
+	if (size == 0)
+		size = 1;
+
+	cls = RPCObjectCache::size_class(size);
+	if (cls < OBJECT_CLASS_NUM)
+	{
+		ptr = RPCObjectCache::get_instance()->pop(cls);
+		if (ptr)
+			return ptr;
+
+		// always allocate the whole class so that it can be reused by others
+		return ::operator new(RPCObjectCache::class_size(cls));
+	}
+
+	return ::operator new(size);
+}
+
+void RPCObjectAllocator::deallocate(void *ptr, size_t size)
+{
+	int cls;
+
+	if (!ptr)
+		return;
+
+	if (size == 0)
+		size = 1;
+
+	cls = RPCObjectCache::size_class(size);
+	if (cls < OBJECT_CLASS_NUM &&
+		RPCObjectCache::get_instance()->push(cls, ptr, cache_size_))
+	{
+		return;
+	}
+
+	::operator delete(ptr);
+}
+
+static google::protobuf::ArenaOptions __message_arena_options(char *block)
+{
+	google::protobuf::ArenaOptions options;
+
+	options.initial_block = block;
+	options.initial_block_size = MESSAGE_ARENA_BLOCK_SIZE;
+	return options;
+}
+
+RPCMessageArena::RPCMessageArena() :
+	arena(__message_arena_options(this->block))
+{
+}
+
+struct RPCMessageArenaList
+{
+	RPCMessageArena *arenas[OBJECT_RECYCLE_NUM];
+	int num = 0;
+
+	~RPCMessageArenaList()
+	{
+		while (this->num > 0)
+			delete this->arenas[--this->num];
+	}
+
+	static RPCMessageArenaList *get_instance()
+	{
+		static thread_local RPCMessageArenaList kList;
+		return &kList;
+	}
+};
+
+RPCMessageArena *RPCMessageArena::get()
+{
+	RPCMessageArenaList *list = RPCMessageArenaList::get_instance();
+
+	if (list->num == 0)
+		return new RPCMessageArena;
+
+	return list->arenas[--list->num];
+}
+
+void RPCMessageArena::put(RPCMessageArena *arena)
+{
+	RPCMessageArenaList *list = RPCMessageArenaList::get_instance();
+
+	if (!arena)
+		return;
+
+	if (list->num == OBJECT_RECYCLE_NUM ||
+		RPCObjectAllocator::get_cache_size() == 0)
+	{
+		delete arena;
+		return;
+	}
+
+	// destroy the messages and free the blocks except the first one
+	arena->arena.Reset();
+	list->arenas[list->num++] = arena;
+}
+
+RPCArenaAllocator *RPCArenaAllocator::get_instance(size_t size)
+{
+	// never destroyed, pieces may be released after static destructors
+	static RPCArenaAllocator *kInstance = new RPCArenaAllocator(size);
+	return kInstance;
+}
+
+RPCArenaAllocator::RPCArenaAllocator(size_t size)
+{
+	void *ptr = NULL;
+
+	this->base = NULL;
+	this->size = 0;
+	this->hugetlb = false;
+	this->offset = 0;
+	for (int i = 0; i < SLAB_CLASS_NUM; i++)
+		this->free_list[i] = NULL;
+
+#ifndef _WIN32
+	size = (size + ARENA_HUGE_PAGE_SIZE - 1) / ARENA_HUGE_PAGE_SIZE *
+		   ARENA_HUGE_PAGE_SIZE;
+
+	if (size > 0)
+	{
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+
+#ifdef MAP_HUGETLB
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+				   -1, 0);
+		if (ptr != MAP_FAILED)
+			this->hugetlb = true;
+		else
+#endif
+		{
+			// not enough hugepages reserved, let THP do what it can
+			ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+#ifdef MADV_HUGEPAGE
+			if (ptr != MAP_FAILED)
+				madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+		}
+
+		if (ptr == MAP_FAILED)
+			ptr = NULL;
+	}
+#endif
+
+	if (ptr)
+	{
+		this->base = (char *)ptr;
+		this->size = size;
+	}
+
+	__local_gauge(RPC_BUFFER_ARENA_RESERVED_VAR,
+				  "bytes reserved by RPCBuffer arena")->set(this->size);
+	__local_gauge(RPC_BUFFER_ARENA_HUGE_VAR,
+				  "bytes of RPCBuffer arena on hugepages")->set(
+									this->hugetlb ? this->size : 0);
+}
+
+void *RPCArenaAllocator::allocate(size_t size)
+{
+	int cls = __slab_class(size);
+	struct arena_node_t *node;
+	size_t class_size;
+	size_t pos;
+
+	if (cls < SLAB_CLASS_NUM && this->base)
+	{
+		class_size = RPCSlabCache::class_size(cls);
+		this->mutex[cls].lock();
+		node = this->free_list[cls];
+		if (node)
+			this->free_list[cls] = node->next;
+		this->mutex[cls].unlock();
+
+		if (!node)
+		{
+			pos = this->offset.fetch_add(class_size, std::memory_order_relaxed);
+			if (pos + class_size <= this->size)
+				node = (struct arena_node_t *)(this->base + pos);
+		}
+
+		if (node)
+		{
+			__stats_add(&RPCBufferStats::arena_used, class_size);
+			return node;
+		}
+	}
+
+	__stats_add(&RPCBufferStats::arena_miss, 1);
+	return malloc(size);
+}
+
+void RPCArenaAllocator::deallocate(void *ptr, size_t size)
+{
+	struct arena_node_t *node;
+	int cls;
+
+	if (!this->contains(ptr))
+	{
+		free(ptr);
+		return;
+	}
+
+	cls = __slab_class(size);
+	node = (struct arena_node_t *)ptr;
+	__stats_add(&RPCBufferStats::arena_used,
+				-(long long)RPCSlabCache::class_size(cls));
+
+	this->mutex[cls].lock();
+	node->next = this->free_list[cls];
+	this->free_list[cls] = node;
+	this->mutex[cls].unlock();
+}
+
+class RPCBufferSizerList
+{
+public:
+	static RPCBufferSizerList *get_instance()
+	{
+		static RPCBufferSizerList kInstance;
+		return &kInstance;
+	}
+
+	void add(RPCBufferSizer *sizer)
+	{
+		this->mutex.lock();
+		this->sizers.insert(sizer);
+		this->mutex.unlock();
+	}
+
+	void remove(RPCBufferSizer *sizer)
+	{
+		this->mutex.lock();
+		this->sizers.erase(sizer);
+		this->mutex.unlock();
+	}
+
+public:
+	std::mutex mutex;
+	std::unordered_set<RPCBufferSizer *> sizers;
+};
+
+// always reports the sizers alive, even after dup to another thread
+class RPCBufferSizerVar : public CounterVar
+{
+public:
+	RPCVar *create(bool with_data) override
+	{
+		RPCBufferSizerVar *var = new RPCBufferSizerVar();
+		RPCBufferSizerList *list = RPCBufferSizerList::get_instance();
+
+		if (with_data)
+		{
+			list->mutex.lock();
+			for (const RPCBufferSizer *sizer : list->sizers)
+			{
+				var->add({{"service", sizer->get_service_name()},
+						  {"method", sizer->get_method_name()}})->set(
+										(double)sizer->get_piece_size());
+			}
+			list->mutex.unlock();
+		}
+
+		return var;
+	}
+
+	// learned sizes are not statistics of an interval
+	void reset() override { }
+
+public:
+	RPCBufferSizerVar() :
+		CounterVar(RPC_BUFFER_PIECE_LEARNED_VAR,
+				   "piece size learned for RPCBuffer of each method")
+	{
+	}
+};
+
+static bool __register_sizer_var()
+{
+	RPCVarLocal::get_instance()->add(RPC_BUFFER_PIECE_LEARNED_VAR,
+									 new RPCBufferSizerVar());
+	return true;
+}
+
+static inline int __sizer_class(size_t size)
+{
+	size_t class_size = (size_t)1 << SIZER_CLASS_MIN_SHIFT;
+	int cls = 0;
+
+	while (class_size < size && cls < SIZER_CLASS_NUM - 1)
+	{
+		class_size <<= 1;
+		cls++;
+	}
+
+	return cls;
+}
+
+RPCBufferSizer::RPCBufferSizer(const std::string& service,
+							   const std::string& method) :
+	service(service),
+	method(method)
+{
+	static bool registered = __register_sizer_var();
+
+	(void)registered;
+	this->piece_size = 0;
+	this->observed = 0;
+	for (int i = 0; i < SIZER_CLASS_NUM; i++)
+		this->counts[i] = 0;
+
+	RPCBufferSizerList::get_instance()->add(this);
+}
+
+RPCBufferSizer::~RPCBufferSizer()
+{
+	RPCBufferSizerList::get_instance()->remove(this);
+}
+
+void RPCBufferSizer::prepare(RPCBuffer *buf) const
+{
+	size_t size = this->get_piece_size();
+
+	if (size == 0)
+		return;
+
+	buf->set_piece_min_size(size);
+	if (size > BUFFER_PIECE_MAX_SIZE)
+		buf->set_piece_max_size(size);
+}
+
+void RPCBufferSizer::observe(size_t size)
+{
+	// leave some room for the header of piece
+	int cls = __sizer_class(size + size / 64 + 64);
+
+	this->counts[cls].fetch_add(1, std::memory_order_relaxed);
+	if (this->observed.fetch_add(1, std::memory_order_relaxed) %
+		SIZER_LEARN_WINDOW == SIZER_LEARN_WINDOW - 1)
+	{
+		this->learn();
+	}
+}
+
+void RPCBufferSizer::learn()
+{
+	unsigned int snapshot[SIZER_CLASS_NUM];
+	unsigned int total = 0;
+	unsigned int sum = 0;
+	int cls;
+
+	for (cls = 0; cls < SIZER_CLASS_NUM; cls++)
+	{
+		snapshot[cls] = this->counts[cls].load(std::memory_order_relaxed);
+		total += snapshot[cls];
+		// decay, so that it follows the change of message size
+		this->counts[cls].store(snapshot[cls] / 2, std::memory_order_relaxed);
+	}
+
+	for (cls = 0; cls < SIZER_CLASS_NUM - 1; cls++)
+	{
+		sum += snapshot[cls];
+		if (sum * 100 >= total * SIZER_LEARN_PERCENT)
+			break;
+	}
+
+	this->piece_size.store((size_t)1 << (cls + SIZER_CLASS_MIN_SHIFT),
+						   std::memory_order_relaxed);
+}
+
+RPCBufferQuota::RPCBufferQuota(size_t limit, size_t total_limit) :
+	used(0),
+	ref(1)
+{
+	this->limit = limit;
+	this->total_limit = total_limit;
+}
+
+bool RPCBufferQuota::take(size_t size)
+{
+	size_t used = this->used.fetch_add(size, std::memory_order_relaxed) + size;
+
+	if ((this->limit > 0 && used > this->limit) ||
+		(this->total_limit > 0 &&
+		 RPCBufferQuota::get_total_size() + size > this->total_limit))
+	{
+		this->used.fetch_sub(size, std::memory_order_relaxed);
+		__stats_add(&RPCBufferStats::buffer_overload, 1);
+		return false;
+	}
+
+	__stats_add(&RPCBufferStats::buffer_inflight, (long long)size);
+	return true;
+}
+
+void RPCBufferQuota::give_back(size_t size)
+{
+	this->used.fetch_sub(size, std::memory_order_relaxed);
+	__stats_add(&RPCBufferStats::buffer_inflight, -(long long)size);
+}
+
+size_t RPCBufferQuota::get_total_size()
+{
+	long long total = RPCBufferStatsList::get_instance()->total_size.load(
+											std::memory_order_relaxed);
+
+	return total > 0 ? (size_t)total : 0;
+}
+
+void RPCBufferQuota::increase_total(size_t size)
+{
+	__stats_add(&RPCBufferStats::buffer_total, (long long)size);
+	RPCBufferStatsLocal::add_total((long long)size);
+}
+
+void RPCBufferQuota::decrease_total(size_t size)
+{
+	__stats_add(&RPCBufferStats::buffer_total, -(long long)size);
+	RPCBufferStatsLocal::add_total(-(long long)size);
+}
+
+} // namespace srpc
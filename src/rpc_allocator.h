@@ -0,0 +1,442 @@
+/*
+  Copyright (c) 2024 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RPC_ALLOCATOR_H__
+#define __RPC_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <google/protobuf/arena.h>
+
+namespace srpc
+{
+
+static constexpr int	SLAB_CLASS_MIN_SHIFT		= 11;	// 2K
+static constexpr int	SLAB_CLASS_MAX_SHIFT		= 18;	// 256K
+static constexpr int	SLAB_CLASS_NUM				= SLAB_CLASS_MAX_SHIFT -
+													  SLAB_CLASS_MIN_SHIFT + 1;
+static constexpr size_t	SLAB_CACHE_SIZE_DEFAULT		= 1024 * 1024;
+
+static constexpr size_t	ARENA_HUGE_PAGE_SIZE		= 2 * 1024 * 1024;
+
+static constexpr int	OBJECT_CLASS_SHIFT			= 6;	// 64
+static constexpr int	OBJECT_CLASS_NUM			= 64;	// 4K
+static constexpr size_t	OBJECT_CACHE_SIZE_DEFAULT	= 256 * 1024;
+static constexpr int	OBJECT_RECYCLE_NUM			= 64;
+static constexpr size_t	OBJECT_RECYCLE_MAX_SIZE		= 64 * 1024;
+static constexpr int	OBJECT_RECYCLE_CHECK_EVERY	= 16;
+static constexpr size_t	MESSAGE_ARENA_BLOCK_SIZE	= 8 * 1024;
+
+static constexpr int	SIZER_CLASS_MIN_SHIFT		= 8;	// 256
+static constexpr int	SIZER_CLASS_MAX_SHIFT		= 24;	// 16M
+static constexpr int	SIZER_CLASS_NUM				= SIZER_CLASS_MAX_SHIFT -
+														  SIZER_CLASS_MIN_SHIFT + 1;
+static constexpr int	SIZER_LEARN_WINDOW			= 64;
+static constexpr int	SIZER_LEARN_PERCENT			= 90;
+static constexpr long long	BUFFER_TOTAL_BATCH_SIZE	= 64 * 1024;
+
+// vars updated by RPCSlabAllocator, use RPCMetricsFilter::expose_var() to report
+static constexpr const char *RPC_BUFFER_PIECE_HIT_VAR		= "rpc_buffer_piece_hit";
+static constexpr const char *RPC_BUFFER_PIECE_MISS_VAR		= "rpc_buffer_piece_miss";
+static constexpr const char *RPC_BUFFER_PIECE_CACHED_VAR	= "rpc_buffer_piece_cached_bytes";
+// vars updated by RPCArenaAllocator
+static constexpr const char *RPC_BUFFER_ARENA_RESERVED_VAR	= "rpc_buffer_arena_reserved_bytes";
+static constexpr const char *RPC_BUFFER_ARENA_HUGE_VAR		= "rpc_buffer_arena_hugepage_bytes";
+static constexpr const char *RPC_BUFFER_ARENA_USED_VAR		= "rpc_buffer_arena_used_bytes";
+static constexpr const char *RPC_BUFFER_ARENA_MISS_VAR		= "rpc_buffer_arena_miss";
+// vars updated by RPCBufferQuota
+static constexpr const char *RPC_BUFFER_TOTAL_VAR			= "rpc_buffer_total_bytes";
+static constexpr const char *RPC_BUFFER_INFLIGHT_VAR		= "rpc_buffer_inflight_request_bytes";
+static constexpr const char *RPC_BUFFER_OVERLOAD_VAR		= "rpc_buffer_overload";
+// counter with labels service and method, updated by RPCBufferSizer
+static constexpr const char *RPC_BUFFER_PIECE_LEARNED_VAR	= "rpc_buffer_piece_learned_size";
+
+class RPCBuffer;
+
+/**
+ * @brief   Allocator for the pieces acquired by RPCBuffer itself
+ * @details
+ * - Thread Safety : YES, a piece may be deallocated by any thread
+ * - deallocate() always gets the same size as the one passed to allocate()
+ */
+class RPCBufferAllocator
+{
+public:
+	/**
+	 * @brief      Get a piece at least size bytes
+	 * @return     NULL if OOM
+	 */
+	virtual void *allocate(size_t size) = 0;
+
+	/**
+	 * @brief      Give back a piece from allocate()
+	 * @note       NEVER fail
+	 */
+	virtual void deallocate(void *ptr, size_t size) = 0;
+
+public:
+	/**
+	 * @brief      Allocator for every new RPCBuffer. Default is RPCSlabAllocator
+	 * @note       NULL means use malloc() and free() directly
+	 * @note       Call set_default() before any RPCBuffer created.
+	 * 				The allocator should live longer than all the buffers
+	 */
+	static RPCBufferAllocator *get_default() { return default_allocator_; }
+	static void set_default(RPCBufferAllocator *allocator)
+	{
+		default_allocator_ = allocator;
+	}
+
+	virtual ~RPCBufferAllocator() { }
+
+private:
+	static RPCBufferAllocator *default_allocator_;
+};
+
+/**
+ * @brief   Per-thread size-class cache of pieces
+ * @details
+ * - Size classes are power of 2 from 2K to 256K
+ * - Larger size goes to malloc() and free() directly
+ * - Piece is cached by the thread who deallocates it, so no global lock
+ * - Each thread caches at most cache_size bytes for each size class
+ */
+class RPCSlabAllocator : public RPCBufferAllocator
+{
+public:
+	static RPCSlabAllocator *get_instance()
+	{
+		static RPCSlabAllocator kInstance;
+		return &kInstance;
+	}
+
+	void *allocate(size_t size) override;
+	void deallocate(void *ptr, size_t size) override;
+
+	void set_cache_size(size_t size) { this->cache_size = size; }
+	size_t get_cache_size() const { return this->cache_size; }
+
+private:
+	RPCSlabAllocator() { this->cache_size = SLAB_CACHE_SIZE_DEFAULT; }
+
+	size_t cache_size;
+};
+
+/**
+ * @brief   Pieces from a memory arena reserved at startup
+ * @details
+ * - Thread Safety : YES
+ * - Arena is mapped by MAP_HUGETLB, or normal pages with MADV_HUGEPAGE
+ * 	 if no hugepage is configured in system
+ * - Size classes are the same as RPCSlabAllocator, carved from the arena
+ * 	 and never given back to system
+ * - Larger size or arena used up goes to malloc() and free() directly
+ * - One arena for the whole process, reserved by the first get_instance()
+ */
+class RPCArenaAllocator : public RPCBufferAllocator
+{
+public:
+	/**
+	 * @brief      Get the arena, reserve size bytes if it is the first time
+	 * @note       size of later calls is ignored
+	 */
+	static RPCArenaAllocator *get_instance(size_t size);
+
+	void *allocate(size_t size) override;
+	void deallocate(void *ptr, size_t size) override;
+
+	size_t get_reserved_size() const { return this->size; }
+	bool is_hugetlb() const { return this->hugetlb; }
+
+private:
+	RPCArenaAllocator(size_t size);
+
+	bool contains(const void *ptr) const
+	{
+		return (const char *)ptr >= this->base &&
+			   (const char *)ptr < this->base + this->size;
+	}
+
+	struct arena_node_t
+	{
+		struct arena_node_t *next;
+	};
+
+	char *base;
+	size_t size;
+	bool hugetlb;
+	std::atomic<size_t> offset;
+	std::mutex mutex[SLAB_CLASS_NUM];
+	struct arena_node_t *free_list[SLAB_CLASS_NUM];
+};
+
+/**
+ * @brief   Memory of small objects, such as tasks and contexts of server
+ * @details
+ * - Thread Safety : YES
+ * - Size classes are multiple of 64 up to 4K
+ * - Larger size and the missing of cache go to global operator new
+ * - Memory is cached by the thread who deallocates it, so no global lock.
+ * 	 Poller and handler threads create and destroy the objects of requests,
+ * 	 so steady serving takes them from the cache instead of heap
+ * - Each thread caches at most cache_size bytes for each size class,
+ * 	 0 means no cache at all
+ */
+class RPCObjectAllocator
+{
+public:
+	static void *allocate(size_t size);
+	static void deallocate(void *ptr, size_t size);
+
+	static void set_cache_size(size_t size) { cache_size_ = size; }
+	static size_t get_cache_size() { return cache_size_; }
+
+private:
+	static size_t cache_size_;
+};
+
+/**
+ * @brief   Inherit it, then new and delete go through RPCObjectAllocator
+ * @note    Delete by a pointer of base class needs virtual destructor
+ */
+class RPCPooledObject
+{
+public:
+	static void *operator new(size_t size)
+	{
+		return RPCObjectAllocator::allocate(size);
+	}
+
+	static void operator delete(void *ptr, size_t size)
+	{
+		RPCObjectAllocator::deallocate(ptr, size);
+	}
+};
+
+/**
+ * @brief   Keep the objects of T cleared for next use in each thread
+ * @details
+ * - Thread Safety : YES
+ * - For protobuf messages, Clear() keeps the memory of fields and
+ * 	 sub-messages, so a recycled one fills without allocating again
+ * - At most OBJECT_RECYCLE_NUM objects of each type in each thread.
+ * 	 One of every OBJECT_RECYCLE_CHECK_EVERY puts is measured, and deleted
+ * 	 if holding more than OBJECT_RECYCLE_MAX_SIZE
+ */
+template<class T>
+class RPCObjectRecycler
+{
+public:
+	static T *get()
+	{
+		struct recycle_list *list = get_list();
+
+		if (list->num == 0)
+			return new T;
+
+		return list->objects[--list->num];
+	}
+
+	static void put(T *object)
+	{
+		struct recycle_list *list = get_list();
+
+		if (!object)
+			return;
+
+		// SpaceUsedLong() walks the message, so not for each put
+		if (list->num == OBJECT_RECYCLE_NUM ||
+			RPCObjectAllocator::get_cache_size() == 0 ||
+			(++list->puts % OBJECT_RECYCLE_CHECK_EVERY == 0 &&
+			 object->SpaceUsedLong() > OBJECT_RECYCLE_MAX_SIZE))
+		{
+			delete object;
+			return;
+		}
+
+		object->Clear();
+		list->objects[list->num++] = object;
+	}
+
+private:
+	struct recycle_list
+	{
+		T *objects[OBJECT_RECYCLE_NUM];
+		int num = 0;
+		unsigned int puts = 0;
+
+		~recycle_list()
+		{
+			while (this->num > 0)
+				delete this->objects[--this->num];
+		}
+	};
+
+	static struct recycle_list *get_list()
+	{
+		static thread_local struct recycle_list kList;
+		return &kList;
+	}
+};
+
+/**
+ * @brief   protobuf Arena owning the messages of one server task
+ * @details
+ * - Thread Safety : YES
+ * - Each one starts with a MESSAGE_ARENA_BLOCK_SIZE block which Reset()
+ * 	 keeps, so small messages allocate nothing after recycled
+ * - At most OBJECT_RECYCLE_NUM arenas in each thread, the blocks grown
+ * 	 over the first one are freed when put back
+ */
+class RPCMessageArena
+{
+public:
+	static RPCMessageArena *get();
+	static void put(RPCMessageArena *arena);
+
+	google::protobuf::Arena *get_arena() { return &this->arena; }
+
+private:
+	RPCMessageArena();
+
+	alignas(16) char block[MESSAGE_ARENA_BLOCK_SIZE];
+	google::protobuf::Arena arena;
+};
+
+/**
+ * @brief   Learn the size of messages and pick the piece size for them
+ * @details
+ * - Thread Safety : YES
+ * - One for each service and method, used by RPCServer and RPCClient
+ * - Piece size covers SIZER_LEARN_PERCENT% of the recent messages,
+ * 	 so that most serializations land in one piece
+ */
+class RPCBufferSizer
+{
+public:
+	/**
+	 * @brief      Set the piece size of a buffer before serialize into it
+	 * @note       Do nothing before learned anything
+	 */
+	void prepare(RPCBuffer *buf) const;
+
+	/**
+	 * @brief      Tell the size after serialize
+	 */
+	void observe(size_t size);
+
+	/**
+	 * @brief      Learned piece size, 0 if not learned yet
+	 */
+	size_t get_piece_size() const
+	{
+		return this->piece_size.load(std::memory_order_relaxed);
+	}
+
+	const std::string& get_service_name() const { return this->service; }
+	const std::string& get_method_name() const { return this->method; }
+
+public:
+	RPCBufferSizer(const std::string& service, const std::string& method);
+	~RPCBufferSizer();
+
+	RPCBufferSizer(const RPCBufferSizer&) = delete;
+	RPCBufferSizer& operator=(const RPCBufferSizer&) = delete;
+
+private:
+	void learn();
+
+	std::atomic<size_t> piece_size;
+	std::atomic<unsigned int> observed;
+	std::atomic<unsigned int> counts[SIZER_CLASS_NUM];
+	std::string service;
+	std::string method;
+};
+
+/**
+ * @brief   Account the bytes of RPCBuffer and refuse requests over limit
+ * @details
+ * - Thread Safety : YES
+ * - Total bytes are all the pieces allocated by RPCBuffer in process,
+ * 	 counted in each thread and flushed to one atomic in batches of
+ * 	 BUFFER_TOTAL_BATCH_SIZE, so it may lag by a batch for each thread
+ * - One quota for each connection of RPCServer, counts the request bodies
+ * 	 in flight, from received until the request is destroyed
+ * - Reference counted, a request may live longer than its connection
+ */
+class RPCBufferQuota
+{
+public:
+	/**
+	 * @brief      Take size bytes for a request body before allocating it
+	 * @return     false if the connection or the process is over limit
+	 */
+	bool take(size_t size);
+
+	/**
+	 * @brief      Give back the bytes of take() when the request is done
+	 */
+	void give_back(size_t size);
+
+	size_t get_used() const
+	{
+		return this->used.load(std::memory_order_relaxed);
+	}
+
+	void incref() { this->ref++; }
+	void decref()
+	{
+		if (--this->ref == 0)
+			delete this;
+	}
+
+public:
+	/**
+	 * @brief      Bytes of all the pieces allocated by RPCBuffer now
+	 * @note       One atomic load, each thread may hold a batch unflushed
+	 */
+	static size_t get_total_size();
+
+	// called by RPCBuffer for each piece of its own
+	static void increase_total(size_t size);
+	static void decrease_total(size_t size);
+
+public:
+	/**
+	 * @param[in]  limit            bytes in flight of this connection
+	 * @param[in]  total_limit      bytes of all RPCBuffer in process
+	 * @note       0 means no limit. Created with one reference
+	 */
+	RPCBufferQuota(size_t limit, size_t total_limit);
+
+	RPCBufferQuota(const RPCBufferQuota&) = delete;
+	RPCBufferQuota& operator=(const RPCBufferQuota&) = delete;
+
+private:
+	~RPCBufferQuota() { }
+
+	std::atomic<size_t> used;
+	std::atomic<int> ref;
+	size_t limit;
+	size_t total_limit;
+};
+
+} // namespace srpc
+
+#endif
+
@@ -43,6 +43,7 @@ static constexpr size_t			RPC_BODY_SIZE_LIMIT		= 2LL * 1024 * 1024 * 1024;
 static constexpr int			SRPC_MODULE_MAX			= 5;
 static constexpr size_t			SRPC_SPANID_SIZE		= 8;
 static constexpr size_t			SRPC_TRACEID_SIZE		= 16;
+static constexpr const char	   *SRPC_CODEC_QUEUE		= "srpc_codec";
 
 #ifndef htonll
 
@@ -122,6 +123,7 @@ enum RPCStatusCode
 
 	RPCStatusURIInvalid					=	30,
 	RPCStatusUpstreamFailed				=	31,
+	RPCStatusOverloaded					=	32,
 	RPCStatusSystemError				=	100,
 	RPCStatusSSLError					=	101,
 	RPCStatusDNSError					=	102,
@@ -135,7 +137,8 @@ enum RPCCompressType
 	RPCCompressGzip		=	2,
 	RPCCompressZlib		=	3,
 	RPCCompressLz4		=	4,
-	RPCCompressMax		=	5,
+	RPCCompressZstd		=	5,
+	RPCCompressMax		=	6,
 };
 
 enum RPCModuleType
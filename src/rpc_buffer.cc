@@ -16,29 +16,149 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <new>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include "rpc_buffer.h"
 
 namespace srpc
 {
 
-void RPCBuffer::clear_list_buffer()
+void RPCBuffer::unref_block(block_t *block)
 {
-	for (const auto& ele: buffer_list_)
+	if (!block || --block->ref > 0)
+		return;
+
+	switch (block->mode)
 	{
-		if (!ele.is_nocopy)
-		{
-			if (ele.is_new)
-				delete []((char *)ele.buf);
-			else
-				free(ele.buf);
-		}
+	case BUFFER_MODE_GIFT_NEW:
+		delete [](char *)block->base;
+		delete block;
+		break;
+	case BUFFER_MODE_GIFT_MALLOC:
+		free(block->base);
+		delete block;
+		break;
+#ifndef _WIN32
+	case BUFFER_MODE_GIFT_MMAP:
+		munmap(block->base, block->size);
+		delete block;
+		break;
+#endif
+	default:
+	{
+		// header and data come from the same allocation
+		RPCBufferAllocator *allocator = block->allocator;
+		size_t size = block->size;
+
+		RPCBufferQuota::decrease_total(size);
+		block->~block_t();
+		if (allocator)
+			allocator->deallocate(block, size);
+		else
+			free(block);
+		break;
+	}
+	}
+}
+
+RPCBuffer::block_t *RPCBuffer::alloc_block(size_t size)
+{
+	void *ptr;
+
+	if (allocator_)
+		ptr = allocator_->allocate(size);
+	else
+		ptr = malloc(size);
+
+	if (!ptr)
+		return NULL;
+
+	block_t *block = new (ptr) block_t;
+
+	block->ref = 1;
+	block->mode = BUFFER_MODE_COPY;
+	block->base = block + 1;
+	block->size = size;
+	block->allocator = allocator_;
+	RPCBufferQuota::increase_total(size);
+	return block;
+}
+
+size_t RPCBuffer::alloc_piece(size_t size)
+{
+	// keep header inside the size so that the allocation fits its size class
+	if (size <= 2 * sizeof (block_t))
+		size += sizeof (block_t);
+
+	block_t *block = alloc_block(size);
+	buffer_t *ele;
+
+	if (!block)
+		return 0;
+
+	ele = push_piece();
+	if (!ele)
+	{
+		unref_block(block);
+		return 0;
+	}
+
+	ele->buf = block->base;
+	ele->buflen = 0;
+	ele->block = block;
+	return size - sizeof (block_t);
+}
+
+bool RPCBuffer::reserve_pieces(size_t num)
+{
+	if (num <= piece_cap_)
+		return true;
+
+	size_t cap = piece_cap_ * 2;
+	buffer_t *pieces;
+
+	while (cap < num)
+		cap *= 2;
+
+	if (pieces_ == inline_pieces_)
+	{
+		pieces = (buffer_t *)malloc(cap * sizeof (buffer_t));
+		if (pieces)
+			memcpy(pieces, inline_pieces_, piece_num_ * sizeof (buffer_t));
 	}
+	else
+		pieces = (buffer_t *)realloc(pieces_, cap * sizeof (buffer_t));
+
+	if (!pieces)
+		return false;
+
+	pieces_ = pieces;
+	piece_cap_ = cap;
+	return true;
+}
+
+RPCBuffer::buffer_t *RPCBuffer::push_piece()
+{
+	if (!reserve_pieces(piece_num_ + 1))
+		return NULL;
+
+	return &pieces_[piece_num_++];
+}
+
+void RPCBuffer::clear_list_buffer()
+{
+	for (size_t i = 0; i < piece_num_; i++)
+		unref_block(pieces_[i].block);
+
+	piece_num_ = 0;
 }
 
 void RPCBuffer::clear()
 {
 	clear_list_buffer();
-	buffer_list_.clear();
 	size_ = 0;
 	piece_min_size_ = BUFFER_PIECE_MIN_SIZE;
 	piece_max_size_ = BUFFER_PIECE_MAX_SIZE;
@@ -46,37 +166,51 @@ void RPCBuffer::clear()
 	last_piece_left_ = 0;
 }
 
-bool RPCBuffer::append(void *buf, size_t buflen, int mode)
+void RPCBuffer::append_piece(void *buf, size_t buflen, block_t *block)
 {
-	if (mode == BUFFER_MODE_COPY)
-		return write(buf, buflen);
+	// two more pieces should be reserved already
+	buffer_t *ele = &pieces_[piece_num_++];
 
-	buffer_t ele;
-	void *left_buf;
+	ele->buflen = buflen;
+	ele->buf = buf;
+	ele->block = block;
+	size_ += buflen;
 
 	if (last_piece_left_ > 0)
 	{
-		const auto it = buffer_list_.rbegin();
-
-		left_buf = (char *)it->buf + it->buflen;
+		// keep the spare room of the previous piece as the last one
+		const buffer_t *prev = ele - 1;
+		buffer_t *left = &pieces_[piece_num_++];
+
+		left->buf = (char *)prev->buf + prev->buflen;
+		left->buflen = 0;
+		left->block = prev->block;
+		if (left->block)
+			left->block->ref++;
 	}
+}
 
-	ele.buflen = buflen;
-	ele.buf = buf;
-	ele.is_nocopy = (mode == BUFFER_MODE_NOCOPY);
-	ele.is_new = (mode == BUFFER_MODE_GIFT_NEW);
-	buffer_list_.emplace_back(std::move(ele));
-	size_ += buflen;
+bool RPCBuffer::append(void *buf, size_t buflen, int mode)
+{
+	if (mode == BUFFER_MODE_COPY)
+		return write(buf, buflen);
 
-	if (last_piece_left_ > 0)
+	if (!reserve_pieces(piece_num_ + 2))
+		return false;
+
+	block_t *block = NULL;
+
+	if (mode != BUFFER_MODE_NOCOPY)
 	{
-		ele.buflen = 0;
-		ele.buf = left_buf;
-		ele.is_nocopy = true;
-		ele.is_new = false;
-		buffer_list_.emplace_back(std::move(ele));
+		block = new block_t;
+		block->ref = 1;
+		block->mode = mode;
+		block->base = buf;
+		block->size = buflen;
+		block->allocator = NULL;
 	}
 
+	append_piece(buf, buflen, block);
 	return true;
 }
 
@@ -88,12 +222,89 @@ bool RPCBuffer::append(const void *buf, size_t buflen, int mode)
 	return append(const_cast<void *>(buf), buflen, mode);
 }
 
+bool RPCBuffer::append_file(int fd, size_t offset, size_t len)
+{
+#ifndef _WIN32
+	if (len == 0)
+		return true;
+
+	if (!reserve_pieces(piece_num_ + 2))
+		return false;
+
+	// mmap() needs the offset aligned to page
+	size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = offset - offset % pagesize;
+	size_t maplen = offset - start + len;
+	void *base = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, (off_t)start);
+
+	if (base == MAP_FAILED)
+		return false;
+
+	madvise(base, maplen, MADV_SEQUENTIAL);
+
+	block_t *block = new block_t;
+
+	block->ref = 1;
+	block->mode = BUFFER_MODE_GIFT_MMAP;
+	block->base = base;
+	block->size = maplen;
+	block->allocator = NULL;
+	append_piece((char *)base + offset - start, len, block);
+	return true;
+#else
+	errno = ENOSYS;
+	return false;
+#endif
+}
+
+int RPCBuffer::append(RPCBuffer *buf)
+{
+	if (!reserve_pieces(piece_num_ + buf->piece_num_))
+		return -1;
+
+	// the spare room of our last piece is dropped
+	memcpy(&pieces_[piece_num_], buf->pieces_,
+		   buf->piece_num_ * sizeof (buffer_t));
+	piece_num_ += buf->piece_num_;
+	size_ += buf->size_;
+	last_piece_left_ = buf->last_piece_left_;
+
+	buf->piece_num_ = 0;
+	buf->size_ = 0;
+	buf->init_read_over_ = false;
+	buf->last_piece_left_ = 0;
+	return 0;
+}
+
+size_t RPCBuffer::share(RPCBuffer *out) const
+{
+	if (!out->reserve_pieces(out->piece_num_ + piece_num_))
+		return 0;
+
+	for (size_t i = 0; i < piece_num_; i++)
+	{
+		const buffer_t& ele = pieces_[i];
+
+		if (ele.buflen == 0)
+			continue;
+
+		if (ele.block)
+			ele.block->ref++;
+
+		out->pieces_[out->piece_num_++] = ele;
+	}
+
+	out->size_ += size_;
+	out->last_piece_left_ = 0;
+	return size_;
+}
+
 size_t RPCBuffer::backup(size_t count)
 {
-	if (count == 0 || buffer_list_.empty())
+	if (count == 0 || piece_num_ == 0)
 		return 0;
 
-	const auto it = buffer_list_.rbegin();
+	buffer_t *it = &pieces_[piece_num_ - 1];
 	size_t sz = 0;
 
 	if (it->buflen > count)
@@ -107,7 +318,12 @@ size_t RPCBuffer::backup(size_t count)
 		it->buflen = 0;
 	}
 
-	last_piece_left_ += sz;
+	// someone else may refer to these bytes, never write them again
+	if (it->block && it->block->ref > 1)
+		last_piece_left_ = 0;
+	else
+		last_piece_left_ += sz;
+
 	size_ -= sz;
 	return sz;
 }
@@ -150,7 +366,7 @@ bool RPCBuffer::write(const void *buf, size_t buflen)
 
 void RPCBuffer::rewind()
 {
-	cur_.first = buffer_list_.begin();
+	cur_.first = 0;
 	cur_.second = 0;
 	init_read_over_ = true;
 }
@@ -178,13 +394,15 @@ size_t RPCBuffer::fetch(const void **buf)
 RPCBuffer::~RPCBuffer()
 {
 	clear_list_buffer();
+	if (pieces_ != inline_pieces_)
+		free(pieces_);
 }
 
 size_t RPCBuffer::acquire(void **buf)
 {
 	if (last_piece_left_ > 0)
 	{
-		const auto it = buffer_list_.rbegin();
+		buffer_t *it = &pieces_[piece_num_ - 1];
 		size_t sz = last_piece_left_;
 
 		*buf = (char *)it->buf + it->buflen;
@@ -194,38 +412,46 @@ size_t RPCBuffer::acquire(void **buf)
 		return sz;
 	}
 
-	*buf = malloc(piece_min_size_);
-	if (*buf == NULL)
+	size_t sz = alloc_piece(piece_min_size_);
+
+	if (sz == 0)
+	{
+		*buf = NULL;
 		return 0;
+	}
+
+	buffer_t *it = &pieces_[piece_num_ - 1];
 
-	append(*buf, piece_min_size_, BUFFER_MODE_GIFT_MALLOC);
-	return piece_min_size_;
+	*buf = it->buf;
+	it->buflen = sz;
+	size_ += sz;
+	return sz;
 }
 
 bool RPCBuffer::acquire(void **buf, size_t *size)
 {
 	if (last_piece_left_ == 0)
 	{
-		size_t sz = *size;
+		size_t sz = piece_min_size_;
+
+		// the piece is the class holding the expected size with the header
+		// inside, so a size learned at a class boundary stays in that class
+		while (sz < *size && sz < piece_max_size_)
+			sz <<= 1;
 
 		if (sz > piece_max_size_)
 			sz = piece_max_size_;
 
-		if (sz < piece_min_size_)
-			sz = piece_min_size_;
-
-		*buf = malloc(sz);
-		if (*buf == NULL)
+		last_piece_left_ = alloc_piece(sz);
+		if (last_piece_left_ == 0)
 		{
+			*buf = NULL;
 			*size = 0;
 			return false;
 		}
-
-		append(*buf, 0, BUFFER_MODE_GIFT_MALLOC);
-		last_piece_left_ = sz;
 	}
 
-	const auto it = buffer_list_.rbegin();
+	buffer_t *it = &pieces_[piece_num_ - 1];
 
 	*buf = (char *)it->buf + it->buflen;
 	if (last_piece_left_ <= *size)
@@ -241,36 +467,88 @@ bool RPCBuffer::acquire(void **buf, size_t *size)
 	return true;
 }
 
+bool RPCBuffer::write_message(const void *buf, size_t buflen, size_t left)
+{
+	while (buflen > 0)
+	{
+		void *p;
+		size_t sz = left;
+
+		if (!acquire(&p, &sz))
+			return false;
+
+		// keep the rest of piece for the bytes coming next
+		if (sz > buflen)
+		{
+			backup(sz - buflen);
+			sz = buflen;
+		}
+
+		memcpy(p, buf, sz);
+		buf = (const char *)buf + sz;
+		buflen -= sz;
+		left -= sz;
+	}
+
+	return true;
+}
+
+void *RPCBuffer::acquire_contiguous(size_t size)
+{
+	void *buf;
+
+	if (last_piece_left_ < size)
+	{
+		// drop the small room left, a few more bounds fit in next piece
+		size_t sz = 8 * size + sizeof (block_t);
+
+		if (sz > piece_max_size_)
+			sz = piece_max_size_;
+
+		if (sz < size + sizeof (block_t))
+			sz = size + sizeof (block_t);
+
+		last_piece_left_ = alloc_piece(sz);
+		if (last_piece_left_ == 0)
+			return NULL;
+	}
+
+	acquire(&buf, &size);
+	return buf;
+}
+
 int RPCBuffer::merge_all(struct iovec& iov)
 {
 	size_t sz = 0;
-	void *new_base = malloc(size_);
+	block_t *block;
+
+	// already in one piece, nothing to copy
+	if (piece_num_ == 1 || (piece_num_ == 2 && pieces_[1].buflen == 0))
+	{
+		iov.iov_base = pieces_[0].buf;
+		iov.iov_len = pieces_[0].buflen;
+		return 1;
+	}
 
-	if (!new_base)
+	block = alloc_block(size_ + sizeof (block_t));
+
+	if (!block)
 		return -1;
 
-	for (const auto& ele : buffer_list_)
+	for (size_t i = 0; i < piece_num_; i++)
 	{
-		memcpy((char *)new_base + sz, ele.buf, ele.buflen);
-		sz += ele.buflen;
-		if (!ele.is_nocopy)
-		{
-			if (ele.is_new)
-				delete []((char *)ele.buf);
-			else
-				free(ele.buf);
-		}
+		memcpy((char *)block->base + sz, pieces_[i].buf, pieces_[i].buflen);
+		sz += pieces_[i].buflen;
+		unref_block(pieces_[i].block);
 	}
 
-	iov.iov_base = new_base;
+	iov.iov_base = block->base;
 	iov.iov_len = sz;
-	buffer_list_.resize(1);
-	auto head = buffer_list_.begin();
-
-	head->buf = new_base;
-	head->buflen = sz;
-	head->is_nocopy = false;
-	head->is_new = false;
+	piece_num_ = 1;
+	pieces_[0].buf = block->base;
+	pieces_[0].buflen = sz;
+	pieces_[0].block = block;
+	last_piece_left_ = 0;
 	return 1;
 }
 
@@ -283,9 +561,9 @@ int RPCBuffer::encode(struct iovec *iov, int count)
 	}
 
 	if (count == 1)
-		return merge_all(iov[0]) == 0 ? 1 : -1;
+		return merge_all(iov[0]) < 0 ? -1 : 1;
 
-	//if (buffer_list_.size() > count)
+	//if (piece_num_ > count)
 	//{
 	//	// todo try merge all Adjacent copyed
 	//	// nocopy copy nocopy copy copy nocopy ...
@@ -293,60 +571,55 @@ int RPCBuffer::encode(struct iovec *iov, int count)
 	//	// merge same, test if <= count
 	//}
 
-	while (buffer_list_.size() > (size_t)count)
+	if (piece_num_ > (size_t)count)
+		last_piece_left_ = 0;
+
+	while (piece_num_ > (size_t)count)
 	{
 		//merge half
-		auto next = buffer_list_.begin();
-		auto cur = next;
+		size_t i = 0;
+		size_t j = 0;
 
-		++next;
-		while (next != buffer_list_.end())
+		for (; i + 1 < piece_num_; i += 2, j++)
 		{
-			size_t sz = cur->buflen + next->buflen;
-			void *new_base = malloc(sz);
-
-			if (!new_base)
-				return -1;
-
-			memcpy(new_base, cur->buf, cur->buflen);
-			memcpy((char *)new_base + cur->buflen, next->buf, next->buflen);
+			const buffer_t& cur = pieces_[i];
+			const buffer_t& next = pieces_[i + 1];
+			size_t sz = cur.buflen + next.buflen;
+			block_t *block = alloc_block(sz + sizeof (block_t));
 
-			if (!cur->is_nocopy)
+			if (!block)
 			{
-				if (cur->is_new)
-					delete []((char *)cur->buf);
-				else
-					free(cur->buf);
+				memmove(&pieces_[j], &pieces_[i],
+						(piece_num_ - i) * sizeof (buffer_t));
+				piece_num_ -= i - j;
+				return -1;
 			}
 
-			if (!next->is_nocopy)
-			{
-				if (next->is_new)
-					delete []((char *)next->buf);
-				else
-					free(next->buf);
-			}
+			memcpy(block->base, cur.buf, cur.buflen);
+			memcpy((char *)block->base + cur.buflen, next.buf, next.buflen);
 
-			cur->buf = new_base;
-			cur->buflen = sz;
-			cur->is_nocopy = false;
-			cur->is_new = false;
+			unref_block(cur.block);
+			unref_block(next.block);
 
-			buffer_list_.erase(next);
-			++cur;
-			next = cur;
-			++next;
+			pieces_[j].buf = block->base;
+			pieces_[j].buflen = sz;
+			pieces_[j].block = block;
 		}
+
+		if (i < piece_num_)
+			pieces_[j++] = pieces_[i];
+
+		piece_num_ = j;
 	}
 
 	int n = 0;
 
-	for (const auto& ele : buffer_list_)
+	for (size_t i = 0; i < piece_num_; i++)
 	{
-		if (ele.buflen > 0)
+		if (pieces_[i].buflen > 0)
 		{
-			iov[n].iov_base = ele.buf;
-			iov[n].iov_len = ele.buflen;
+			iov[n].iov_base = pieces_[i].buf;
+			iov[n].iov_len = pieces_[i].buflen;
 			n++;
 		}
 	}
@@ -359,29 +632,36 @@ bool RPCBuffer::fetch(const void **buf, size_t *size)
 	if (!init_read_over_)
 		rewind();
 
-	while (cur_.first != buffer_list_.end() && cur_.second >= cur_.first->buflen)
+	size_t idx = cur_.first;
+	size_t off = cur_.second;
+
+	while (idx < piece_num_ && off >= pieces_[idx].buflen)
 	{
-		++cur_.first;
-		cur_.second = 0;
+		++idx;
+		off = 0;
 	}
 
-	if (cur_.first != buffer_list_.end())
+	if (idx < piece_num_)
 	{
-		size_t n = cur_.first->buflen - cur_.second;
+		size_t n = pieces_[idx].buflen - off;
 
-		*buf = (char *)cur_.first->buf + cur_.second;
+		*buf = (char *)pieces_[idx].buf + off;
 		if (*size < n)
-			cur_.second += *size;
+			off += *size;
 		else
 		{
 			*size = n;
-			++cur_.first;
-			cur_.second = 0;
+			++idx;
+			off = 0;
 		}
 
+		cur_.first = idx;
+		cur_.second = off;
 		return true;
 	}
 
+	cur_.first = idx;
+	cur_.second = off;
 	*buf = nullptr;
 	*size = 0;
 	return false;
@@ -394,26 +674,31 @@ size_t RPCBuffer::internal_fetch(const void **buf, bool move_or_stay)
 	if (!init_read_over_)
 		rewind();
 
-	while (cur_.first != buffer_list_.end() && cur_.second >= cur_.first->buflen)
+	size_t idx = cur_.first;
+	size_t off = cur_.second;
+
+	while (idx < piece_num_ && off >= pieces_[idx].buflen)
 	{
-		++cur_.first;
-		cur_.second = 0;
+		++idx;
+		off = 0;
 	}
 
-	if (cur_.first == buffer_list_.end())
+	if (idx >= piece_num_)
 		*buf = nullptr;
 	else
 	{
-		*buf = (char *)cur_.first->buf + cur_.second;
-		sz = cur_.first->buflen - cur_.second;
+		*buf = (char *)pieces_[idx].buf + off;
+		sz = pieces_[idx].buflen - off;
 
 		if (move_or_stay)
 		{
-			++cur_.first;
-			cur_.second = 0;
+			++idx;
+			off = 0;
 		}
 	}
 
+	cur_.first = idx;
+	cur_.second = off;
 	return sz;
 }
 
@@ -424,15 +709,18 @@ long RPCBuffer::read_skip(long offset)
 	if (!init_read_over_)
 		rewind();
 
-	while (offset > 0 && cur_.first != buffer_list_.end())
+	size_t idx = cur_.first;
+	size_t off = cur_.second;
+
+	while (offset > 0 && idx < piece_num_)
 	{
-		if (cur_.second < cur_.first->buflen)
+		if (off < pieces_[idx].buflen)
 		{
-			long n = cur_.first->buflen - cur_.second;
+			long n = pieces_[idx].buflen - off;
 
 			if (offset < n)
 			{
-				cur_.second += offset;
+				off += offset;
 				offset = 0;
 				break;
 			}
@@ -440,10 +728,12 @@ long RPCBuffer::read_skip(long offset)
 			offset -= n;
 		}
 
-		++cur_.first;
-		cur_.second = 0;
+		++idx;
+		off = 0;
 	}
 
+	cur_.first = idx;
+	cur_.second = off;
 	return origin - offset;
 }
 
@@ -454,26 +744,29 @@ long RPCBuffer::read_back(long offset)
 	if (!init_read_over_)
 		rewind();
 
-	if (cur_.first == buffer_list_.end())
+	size_t idx = cur_.first;
+	size_t off = cur_.second;
+
+	if (idx >= piece_num_)
 	{
-		if (buffer_list_.empty())
+		if (piece_num_ == 0)
 			return 0;
 		else
 		{
-			--cur_.first;
-			cur_.second = cur_.first->buflen;
+			idx = piece_num_ - 1;
+			off = pieces_[idx].buflen;
 		}
 	}
 
 	while (offset < 0)
 	{
-		if (cur_.second > 0)
+		if (off > 0)
 		{
-			long n = cur_.second;
+			long n = off;
 
 			if (n + offset >= 0)
 			{
-				cur_.second += offset;
+				off += offset;
 				offset = 0;
 				break;
 			}
@@ -481,69 +774,65 @@ long RPCBuffer::read_back(long offset)
 			offset += n;
 		}
 
- 		if (cur_.first == buffer_list_.begin())
+		if (idx == 0)
 		{
-			cur_.second = 0;
+			off = 0;
 			break;
 		}
 
-		--cur_.first;
-		cur_.second = cur_.first->buflen;
+		--idx;
+		off = pieces_[idx].buflen;
 	}
 
+	cur_.first = idx;
+	cur_.second = off;
 	return origin - offset;
 }
 
 size_t RPCBuffer::cut(size_t offset, RPCBuffer *out)
 {
-	rewind();
-	size_ = seek(offset);
+	size_t i = 0;
+	size_t pos = 0;
 
-	size_t cutsize = 0;
-	const void *buf;
-	size_t sz = peek(&buf);
-	// sz is the length in this current buf, not final len
+	while (i < piece_num_ && pos + pieces_[i].buflen <= offset)
+		pos += pieces_[i++].buflen;
 
-	if (sz > 0)
+	if (i == piece_num_ || !out->reserve_pieces(out->piece_num_ + piece_num_ - i))
 	{
-		out->last_piece_left_ = 0; // drop
-
-		auto erase_it = buffer_list_.end();
-
-		while (cur_.first != buffer_list_.end())
-		{
-			auto it = cur_.first;
-			size_t cur_len = it->buflen - cur_.second;
-
-			if (it->is_nocopy || cur_.second != 0)
-			{
-				out->append((char *)it->buf + cur_.second, cur_len,
-							BUFFER_MODE_NOCOPY);
-			}
-			else
-			{
-				out->append((char *)it->buf + cur_.second, cur_len,
-							it->is_new ? BUFFER_MODE_GIFT_NEW
-									   : BUFFER_MODE_GIFT_MALLOC);
-			}
-
-			if (erase_it == buffer_list_.end() && cur_.second == 0)
-				erase_it = it;
-			else
-				cur_.first->buflen = cur_.second;
-
-			cutsize += cur_len;
-			++cur_.first;
-			cur_.second = 0;
-		}
+		rewind();
+		return 0;
+	}
 
-		if (last_piece_left_ > 0)
-			out->last_piece_left_ = last_piece_left_;
+	size_t cutsize = size_ - offset;
+	size_t from = i;
 
-		if (erase_it != buffer_list_.end())
-			buffer_list_.erase(erase_it, buffer_list_.end());
+	if (offset > pos)
+	{
+		// both of us refer to the piece at offset
+		buffer_t *it = &pieces_[i];
+		buffer_t *ele = &out->pieces_[out->piece_num_++];
+		size_t len = offset - pos;
+
+		ele->buf = (char *)it->buf + len;
+		ele->buflen = it->buflen - len;
+		ele->block = it->block;
+		if (ele->block)
+			ele->block->ref++;
+
+		it->buflen = len;
+		i++;
 	}
 
+	// give the rest pieces to out, with their owners
+	memcpy(&out->pieces_[out->piece_num_], &pieces_[i],
+		   (piece_num_ - i) * sizeof (buffer_t));
+	out->piece_num_ += piece_num_ - i;
+	out->size_ += cutsize;
+	out->last_piece_left_ = last_piece_left_;
+
+	piece_num_ = offset > pos ? from + 1 : from;
+	size_ = offset;
+	last_piece_left_ = 0;
 	rewind();
 	return cutsize;
 }
@@ -24,18 +24,21 @@
 #endif
 #include <stddef.h>
 #include <string.h>
-#include <list>
+#include <atomic>
+#include "rpc_allocator.h"
 
 namespace srpc
 {
 
 static constexpr int	BUFFER_PIECE_MIN_SIZE		= 2 * 1024;
 static constexpr int	BUFFER_PIECE_MAX_SIZE		= 256 * 1024;
+static constexpr int	BUFFER_PIECE_INLINE_NUM		= 4;
 
 static constexpr int	BUFFER_MODE_COPY			= 0;
 static constexpr int	BUFFER_MODE_NOCOPY			= 1;
 static constexpr int	BUFFER_MODE_GIFT_NEW		= 2;
 static constexpr int	BUFFER_MODE_GIFT_MALLOC		= 3;
+static constexpr int	BUFFER_MODE_GIFT_MMAP		= 4;
 
 static constexpr bool	BUFFER_FETCH_MOVE			= true;
 static constexpr bool	BUFFER_FETCH_STAY			= false;
@@ -45,10 +48,14 @@ static constexpr bool	BUFFER_FETCH_STAY			= false;
  * @details
  * - Thread Safety : NO
  * - All buffer should allocated by new char[...] or malloc
+ * - Pieces acquired by RPCBuffer itself come from RPCBufferAllocator
+ * - Pieces are reference counted, cut(), append() and share() never memcpy
+ * - Piece array is inside the buffer until more than BUFFER_PIECE_INLINE_NUM
  * - Gather buffer piece by piece
  * - Get buffer one by one
+ * - new RPCBuffer() comes from RPCObjectAllocator
  */
-class RPCBuffer
+class RPCBuffer : public RPCPooledObject
 {
 public:
 	/**
@@ -69,9 +76,20 @@ public:
 	 * @param[in]  out              points to out buffer
 	 * @return     actual give how many bytes to out
 	 * @note       this will cause current buffer rewind()
+	 * @note       the piece at offset is shared by both buffers, no memcpy
 	 */
 	size_t cut(size_t offset, RPCBuffer *out);
 
+	/**
+	 * @brief      Add all the data of current buffer to the end of out buffer.
+	 * 				Both buffers refer to the same pieces after that.
+	 * @param[in]  out              points to out buffer
+	 * @return     how many bytes shared to out
+	 * @note       Pieces from BUFFER_MODE_NOCOPY should live longer than out
+	 * @note       Shared bytes are read-only, backup() never gives them back
+	 */
+	size_t share(RPCBuffer *out) const;
+
 public:
 	/**
 	 * @brief      For write. Add one buffer allocated by RPCBuffer
@@ -90,6 +108,27 @@ public:
 	 */
 	size_t acquire(void **buf);
 
+	/**
+	 * @brief      For write. Like write(), for a message of known size
+	 * @param[in]  left             bytes of the message not written yet,
+	 * 								at least buflen
+	 * @return     false if OOM
+	 * @note       Each new piece fits the rest of message up to the max
+	 * 				piece size, so a small body lands in one piece and a
+	 * 				large one is allocated only as its bytes arrive
+	 */
+	bool write_message(const void *buf, size_t buflen, size_t left);
+
+	/**
+	 * @brief      For write. Get size bytes in one piece, never less
+	 * @param[in]  size             at least this size in one piece
+	 * @return     NULL if OOM, or the buffer to be filled later
+	 * @note       Ownership of this buffer remains with the stream
+	 * @note       For encoders asking a bound, backup() the unused part
+	 * 				and the new piece is large enough for next time
+	 */
+	void *acquire_contiguous(size_t size);
+
 	/**
 	 * @brief      For write. Add one buffer
 	 * @param[in]  buf              upstream name
@@ -104,6 +143,26 @@ public:
 	bool append(void *buf, size_t buflen, int mode);
 	bool append(const void *buf, size_t buflen, int mode);
 
+	/**
+	 * @brief      For write. Add a range of file as one piece by mmap(), no copy
+	 * @param[in]  fd               file descriptor opened for read
+	 * @param[in]  offset           where the range begins in the file
+	 * @param[in]  len              size of the range
+	 * @return     false if mmap() fails, errno is set
+	 * @note       Mapped with BUFFER_MODE_GIFT_MMAP and unmapped by RPCBuffer,
+	 * 				fd can be closed after that
+	 * @note       Pages are read by kernel when the piece is written to socket
+	 */
+	bool append_file(int fd, size_t offset, size_t len);
+
+	/**
+	 * @brief      For write. Move all the pieces of another buffer to the end
+	 * @param[in]  buf              buffer to be moved, become empty after that
+	 * @return     0 if all the bytes of buf moved, no memcpy
+	 * @return     -1 and buf unchanged if pieces can not grow
+	 */
+	int append(RPCBuffer *buf);
+
 	/**
 	 * @brief      For write. Backs up a number of bytes of last buffer
 	 * @param[in]  count            how many bytes back up
@@ -135,8 +194,9 @@ public:
 	 * @brief      merge all buffer into one piece
 	 * @param[out] iov              pointer and length of result
 	 * @return     suceess or OOM
-	 * @retval     0                success
+	 * @retval     1                success
 	 * @retval     -1               OOM
+	 * @note       No copy if it is already one piece
 	 */
 	int merge_all(struct iovec& iov);
 
@@ -186,9 +246,18 @@ public:
 	long seek(long offset);
 
 public:
-	void set_piece_min_size(size_t size) { piece_min_size_ = size; }
+	// 0 is taken as 1, pieces are rounded up by doubling from it
+	void set_piece_min_size(size_t size) { piece_min_size_ = size ? size : 1; }
 	void set_piece_max_size(size_t size) { piece_max_size_ = size; }
 
+	/**
+	 * @brief      Set allocator for the pieces acquired later
+	 * @note       Pieces acquired before still go back to their own allocator
+	 * @note       NULL means use malloc() and free() directly
+	 */
+	void set_allocator(RPCBufferAllocator *allocator) { allocator_ = allocator; }
+	RPCBufferAllocator *get_allocator() const { return allocator_; }
+
 	RPCBuffer() = default;
 	~RPCBuffer();
 
@@ -198,26 +267,45 @@ public:
 	RPCBuffer& operator=(RPCBuffer&&) = delete;
 
 private:
+	struct block_t
+	{
+		std::atomic<int> ref;
+		int mode;
+		void *base;
+		size_t size;
+		RPCBufferAllocator *allocator;
+	};
+
 	struct buffer_t
 	{
 		void *buf;
 		size_t buflen;
-		bool is_nocopy;
-		bool is_new;
+		block_t *block;			// NULL for BUFFER_MODE_NOCOPY
 	};
 
+	static void unref_block(block_t *block);
+	block_t *alloc_block(size_t size);
+	size_t alloc_piece(size_t size);
+	bool reserve_pieces(size_t num);
+	void append_piece(void *buf, size_t buflen, block_t *block);
+	buffer_t *push_piece();
 	void clear_list_buffer();
 	size_t internal_fetch(const void **buf, bool move_or_stay);
 	long read_skip(long offset);
 	long read_back(long offset);
 
-	std::list<buffer_t> buffer_list_;
-	std::pair<std::list<buffer_t>::iterator, size_t> cur_;
+	buffer_t inline_pieces_[BUFFER_PIECE_INLINE_NUM];
+	buffer_t *pieces_ = inline_pieces_;
+	size_t piece_num_ = 0;
+	size_t piece_cap_ = BUFFER_PIECE_INLINE_NUM;
+	// index of piece and offset in it
+	std::pair<size_t, size_t> cur_;
 	size_t size_ = 0;
 	size_t piece_min_size_ = BUFFER_PIECE_MIN_SIZE;
 	size_t piece_max_size_ = BUFFER_PIECE_MAX_SIZE;
 	bool init_read_over_ = false;
 	size_t last_piece_left_ = 0;
+	RPCBufferAllocator *allocator_ = RPCBufferAllocator::get_default();
 };
 
 } // namespace srpc
@@ -17,6 +17,9 @@
 #ifndef __RPC_CLIENT_H__
 #define __RPC_CLIENT_H__
 
+#include <string>
+#include <tuple>
+#include <unordered_map>
 #include "rpc_types.h"
 #include "rpc_context.h"
 #include "rpc_options.h"
@@ -49,6 +52,8 @@ public:
 	void set_keep_alive(int timeout);
 	void set_watch_timeout(int timeout);
 	void add_filter(RPCFilter *filter);
+	// requests with compress type are checked by policy, NULL means not
+	void set_compress_policy(RPCCompressPolicy *policy);
 
 protected:
 	template<class OUTPUT>
@@ -71,15 +76,39 @@ protected:
 			});
 
 		this->task_init(task);
+		if (this->service_id != 0)
+		{
+			const auto it = this->method_ids.find(method_name);
+
+			if (it != this->method_ids.cend())
+				task->get_req()->set_method_id(this->service_id, it->second);
+		}
+
+		task->get_req()->set_buffer_sizer(this->find_sizer(method_name));
+		if (this->compress_policy)
+		{
+			task->get_req()->set_compress_stats(
+					this->compress_policy->find_stats(this->service_name,
+													  method_name));
+		}
+		task->set_buffer_allocator(this->allocator);
 
 		return task;
 	}
 
 	void init(const RPCClientParams *params);
+	// IDs from generator, sent with the names by the protocols carrying them
+	void set_service_id(unsigned int id) { this->service_id = id; }
+	void add_method_id(const std::string& method_name, unsigned int id)
+	{
+		this->method_ids.emplace(method_name, id);
+	}
+
 	std::string service_name;
 
 private:
 	void __task_init(COMPLEXTASK *task) const;
+	RPCBufferSizer *find_sizer(const std::string& method_name);
 
 protected:
 	RPCClientParams params;
@@ -91,6 +120,12 @@ private:
 	bool has_addr_info;
 	std::mutex mutex;
 	RPCModule *modules[SRPC_MODULE_MAX] = { 0 };
+	RPCBufferAllocator *allocator;
+	// learn the request size of each method
+	std::unordered_map<std::string, RPCBufferSizer> sizers;
+	RPCCompressPolicy *compress_policy = NULL;
+	unsigned int service_id = 0;
+	std::unordered_map<std::string, unsigned int> method_ids;
 };
 
 ////////
@@ -99,7 +134,8 @@ private:
 template<class RPCTYPE>
 inline RPCClient<RPCTYPE>::RPCClient(const std::string& service_name):
 	params(RPC_CLIENT_PARAMS_DEFAULT),
-	has_addr_info(false)
+	has_addr_info(false),
+	allocator(RPCBufferAllocator::get_default())
 {
 	SRPCGlobal::get_instance();
 	this->service_name = service_name;
@@ -129,6 +165,12 @@ inline void RPCClient<RPCTYPE>::set_watch_timeout(int timeout)
 	this->params.task_params.watch_timeout = timeout;
 }
 
+template<class RPCTYPE>
+inline void RPCClient<RPCTYPE>::set_compress_policy(RPCCompressPolicy *policy)
+{
+	this->compress_policy = policy;
+}
+
 template<class RPCTYPE>
 void RPCClient<RPCTYPE>::add_filter(RPCFilter *filter)
 {
@@ -171,11 +213,38 @@ void RPCClient<RPCTYPE>::add_filter(RPCFilter *filter)
 	return;
 }
 
+template<class RPCTYPE>
+RPCBufferSizer *RPCClient<RPCTYPE>::find_sizer(const std::string& method_name)
+{
+	RPCBufferSizer *sizer;
+
+	this->mutex.lock();
+	auto it = this->sizers.find(method_name);
+
+	if (it == this->sizers.end())
+	{
+		it = this->sizers.emplace(std::piecewise_construct,
+								  std::forward_as_tuple(method_name),
+								  std::forward_as_tuple(this->service_name,
+														method_name)).first;
+	}
+
+	sizer = &it->second;
+	this->mutex.unlock();
+	return sizer;
+}
+
 template<class RPCTYPE>
 inline void RPCClient<RPCTYPE>::init(const RPCClientParams *params)
 {
 	this->params = *params;
 
+	if (this->params.buffer_arena_size > 0)
+	{
+		this->allocator = RPCArenaAllocator::get_instance(
+											this->params.buffer_arena_size);
+	}
+
 	if (this->params.task_params.data_type == RPCDataUndefined)
 		this->params.task_params.data_type = RPCTYPE::default_data_type;
 
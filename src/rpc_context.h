@@ -61,7 +61,11 @@ public:
 	// for server-process
 	virtual void set_data_type(RPCDataType type) = 0;//enum RPCDataType
 	virtual void set_compress_type(RPCCompressType type) = 0;//enum RPCCompressType
+	// dictionary loaded by RPCCompressor::add_dict(), only srpc supported now
+	virtual void set_compress_dict(unsigned int dict_id) = 0;
 	virtual void set_attachment_nocopy(const char *attachment, size_t len) = 0;
+	// reply the range of file by mmap() without copy, only brpc supported now
+	virtual bool set_attachment_file(int fd, size_t offset, size_t len) = 0;
 	virtual bool get_attachment(const char **attachment, size_t *len) const = 0;
 
 	virtual void set_reply_callback(std::function<void (RPCContext *ctx)> cb) = 0;
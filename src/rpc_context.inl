@@ -34,7 +34,7 @@ struct ThriftReceiver
 };
 
 template<class RPCREQ, class RPCRESP>
-class RPCContextImpl : public RPCContext
+class RPCContextImpl : public RPCContext, public RPCPooledObject
 {
 public:
 	long long get_seqid() const override
@@ -92,6 +92,11 @@ public:
 		task_->get_resp()->set_compress_type(type);
 	}
 
+	void set_compress_dict(unsigned int dict_id) override
+	{
+		task_->get_resp()->set_compress_dict(dict_id);
+	}
+
 	void set_send_timeout(int timeout) override
 	{
 		task_->set_send_timeout(timeout);
@@ -162,6 +167,11 @@ public:
 		task_->get_resp()->set_attachment_nocopy(attachment, len);
 	}
 
+	bool set_attachment_file(int fd, size_t offset, size_t len) override
+	{
+		return task_->get_resp()->set_attachment_file(fd, offset, len);
+	}
+
 	void set_reply_callback(std::function<void (RPCContext *ctx)> cb) override
 	{
 		if (this->is_server_task())
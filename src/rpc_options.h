@@ -48,6 +48,8 @@ struct RPCClientParams
 	std::string url;
 	int callee_timeout;
 	std::string caller;
+//bytes reserved for RPCArenaAllocator, 0 means not used
+	size_t buffer_arena_size;
 };
 
 struct RPCServerParams : public WFServerParams
@@ -55,7 +57,23 @@ struct RPCServerParams : public WFServerParams
 	RPCServerParams() : WFServerParams(SERVER_PARAMS_DEFAULT)
 	{
 		this->request_size_limit = RPC_BODY_SIZE_LIMIT;
+		this->buffer_arena_size = 0;
+		this->buffer_total_limit = 0;
+		this->buffer_connection_limit = 0;
+		this->offload_size = 0;
 	}
+
+	// bytes reserved for RPCArenaAllocator, 0 means not used
+	size_t buffer_arena_size;
+	// bytes of all RPCBuffers in process, or of request bodies in flight
+	// on one connection. Over them a request body is dropped without
+	// allocating and replied with RPCStatusOverloaded. 0 means no limit
+	size_t buffer_total_limit;
+	size_t buffer_connection_limit;
+	// requests or learned responses of at least these bytes are decompressed,
+	// parsed, serialized and compressed in compute threads instead of the
+	// network ones, and so is the method called. 0 means never
+	size_t offload_size;
 };
 
 static constexpr struct RPCTaskParams RPC_TASK_PARAMS_DEFAULT =
@@ -78,7 +96,8 @@ static const struct RPCClientParams RPC_CLIENT_PARAMS_DEFAULT =
 /*	.is_ssl				=	*/	false,
 /*	.url				=	*/	"",
 /*	.callee_timeout		=	*/	-1,
-/*	.caller				=	*/	""
+/*	.caller				=	*/	"",
+/*	.buffer_arena_size	=	*/	0
 };
 
 static const RPCServerParams RPC_SERVER_PARAMS_DEFAULT;
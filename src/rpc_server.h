@@ -19,9 +19,12 @@
 
 #include <map>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <errno.h>
 #include <workflow/WFServer.h>
 #include <workflow/WFHttpServer.h>
+#include <workflow/WFConnection.h>
 #include "rpc_types.h"
 #include "rpc_service.h"
 #include "rpc_options.h"
@@ -50,7 +53,10 @@ public:
 
 	int add_service(RPCService *service);
 	const RPCService* find_service(const std::string& name) const;
+	const RPCService* find_service(unsigned int id) const;
 	void add_filter(RPCFilter *filter);
+	// responses with compress type are checked by policy, NULL means not
+	void set_compress_policy(RPCCompressPolicy *policy);
 
 protected:
 	RPCServer(const struct RPCServerParams *params,
@@ -60,11 +66,52 @@ protected:
 	void server_process(NETWORKTASK *task) const;
 
 private:
+	int server_call(TASK *task, const std::function<int (RPCWorker&)>& rpc) const;
+	void add_service_id(RPCService *service);
+	const RPCService::Method *find_method(const REQTYPE *req,
+										  const RPCService **service) const;
+	bool need_offload(const RPCService::Method *method,
+					  const REQTYPE *req) const;
+
 	std::mutex mutex;
 	std::map<std::string, RPCService *> service_map;
+	// sorted by ID, NULL for the IDs of more than one service
+	std::vector<std::pair<unsigned int, RPCService *>> service_ids;
 	RPCModule *modules[SRPC_MODULE_MAX] = { NULL };
+	RPCBufferAllocator *allocator;
+	size_t buffer_total_limit;
+	size_t buffer_connection_limit;
+	size_t offload_size;
+	RPCCompressPolicy *compress_policy = NULL;
 };
 
+static inline RPCBufferAllocator *__server_allocator(const RPCServerParams *params)
+{
+	if (params->buffer_arena_size == 0)
+		return RPCBufferAllocator::get_default();
+
+	return RPCArenaAllocator::get_instance(params->buffer_arena_size);
+}
+
+// one quota for each connection, released with the connection
+static inline RPCBufferQuota *__connection_quota(CommConnection *conn,
+												 size_t limit,
+												 size_t total_limit)
+{
+	WFConnection *wfconn = static_cast<WFConnection *>(conn);
+	auto *quota = static_cast<RPCBufferQuota *>(wfconn->get_context());
+
+	if (!quota)
+	{
+		quota = new RPCBufferQuota(limit, total_limit);
+		wfconn->set_context(quota, [](void *ctx) {
+			static_cast<RPCBufferQuota *>(ctx)->decref();
+		});
+	}
+
+	return quota;
+}
+
 ////////
 // inl
 
@@ -72,20 +119,32 @@ template<class RPCTYPE>
 inline RPCServer<RPCTYPE>::RPCServer():
 	WFServer<REQTYPE, RESPTYPE>(&RPC_SERVER_PARAMS_DEFAULT,
 								std::bind(&RPCServer::server_process,
-								this, std::placeholders::_1))
+								this, std::placeholders::_1)),
+	allocator(__server_allocator(&RPC_SERVER_PARAMS_DEFAULT)),
+	buffer_total_limit(RPC_SERVER_PARAMS_DEFAULT.buffer_total_limit),
+	buffer_connection_limit(RPC_SERVER_PARAMS_DEFAULT.buffer_connection_limit),
+	offload_size(RPC_SERVER_PARAMS_DEFAULT.offload_size)
 {}
 
 template<class RPCTYPE>
 inline RPCServer<RPCTYPE>::RPCServer(const struct RPCServerParams *params):
 	WFServer<REQTYPE, RESPTYPE>(params,
 								std::bind(&RPCServer::server_process,
-								this, std::placeholders::_1))
+								this, std::placeholders::_1)),
+	allocator(__server_allocator(params)),
+	buffer_total_limit(params->buffer_total_limit),
+	buffer_connection_limit(params->buffer_connection_limit),
+	offload_size(params->offload_size)
 {}
 
 template<class RPCTYPE>
 inline RPCServer<RPCTYPE>::RPCServer(const struct RPCServerParams *params,
 							std::function<void (NETWORKTASK *)>&& process):
-	WFServer<REQTYPE, RESPTYPE>(&params, std::move(process))
+	WFServer<REQTYPE, RESPTYPE>(&params, std::move(process)),
+	allocator(__server_allocator(params)),
+	buffer_total_limit(params->buffer_total_limit),
+	buffer_connection_limit(params->buffer_connection_limit),
+	offload_size(params->offload_size)
 {}
 
 template<class RPCTYPE>
@@ -99,6 +158,8 @@ inline int RPCServer<RPCTYPE>::add_service(RPCService* service)
 		return -1;
 	}
 
+	this->add_service_id(service);
+
 	return 0;
 }
 
@@ -118,6 +179,8 @@ inline int RPCServer<RPCTYPESRPC>::add_service(RPCService* service)
 	if (pos != std::string::npos)
 		this->service_map.emplace(name.substr(pos + 1), service);
 
+	this->add_service_id(service);
+
 	return 0;
 }
 
@@ -137,6 +200,8 @@ inline int RPCServer<RPCTYPESRPCHttp>::add_service(RPCService* service)
 	if (pos != std::string::npos)
 		this->service_map.emplace(name.substr(pos + 1), service);
 
+	this->add_service_id(service);
+
 	return 0;
 }
 
@@ -182,6 +247,12 @@ void RPCServer<RPCTYPE>::add_filter(RPCFilter *filter)
 	return;
 }
 
+template<class RPCTYPE>
+inline void RPCServer<RPCTYPE>::set_compress_policy(RPCCompressPolicy *policy)
+{
+	this->compress_policy = policy;
+}
+
 template<class RPCTYPE>
 inline const RPCService *
 RPCServer<RPCTYPE>::find_service(const std::string& name) const
@@ -194,22 +265,80 @@ RPCServer<RPCTYPE>::find_service(const std::string& name) const
 	return NULL;
 }
 
+// NULL for the IDs of more than one service, found only by names
 template<class RPCTYPE>
-inline CommSession *RPCServer<RPCTYPE>::new_session(long long seq,
-													CommConnection *conn)
+inline void RPCServer<RPCTYPE>::add_service_id(RPCService *service)
 {
-	/* TODO: Change to a factory function. */
-	std::list<RPCModule *> module;
-	for (int i = 0; i < SRPC_MODULE_MAX; i++)
+	if (service->get_id() == 0)
+		return;
+
+	auto it = std::lower_bound(this->service_ids.begin(), this->service_ids.end(),
+							   service->get_id(), __id_less<RPCService *>);
+
+	if (it != this->service_ids.end() && it->first == service->get_id())
+		it->second = NULL;
+	else
+		this->service_ids.emplace(it, service->get_id(), service);
+}
+
+template<class RPCTYPE>
+inline const RPCService *RPCServer<RPCTYPE>::find_service(unsigned int id) const
+{
+	const auto it = std::lower_bound(this->service_ids.cbegin(),
+									 this->service_ids.cend(),
+									 id, __id_less<RPCService *>);
+
+	if (it != this->service_ids.cend() && it->first == id)
+		return it->second;
+
+	return NULL;
+}
+
+// by IDs first, then by names if the IDs are unknown or not the same method
+template<class RPCTYPE>
+const RPCService::Method *
+RPCServer<RPCTYPE>::find_method(const REQTYPE *req,
+								const RPCService **service) const
+{
+	const std::string& service_name = req->get_service_name();
+	const std::string& method_name = req->get_method_name();
+	const RPCService::Method *method;
+
+	*service = this->find_service(req->get_service_id());
+	if (*service)
 	{
-		if (this->modules[i])
-			module.push_back(this->modules[i]);
+		method = (*service)->get_method(req->get_method_id());
+		if (method && method_name == method->name &&
+			(service_name.empty() || service_name == (*service)->get_name()))
+		{
+			return method;
+		}
 	}
 
-	auto *task = new TASK(this, this->process, std::move(module));
+	*service = this->find_service(service_name);
+	if (!*service)
+		return NULL;
+
+	return (*service)->get_method(method_name);
+}
+
+template<class RPCTYPE>
+inline CommSession *RPCServer<RPCTYPE>::new_session(long long seq,
+													CommConnection *conn)
+{
+	/* TODO: Change to a factory function. */
+	auto *task = new TASK(this, this->process, this->modules);
 
 	task->set_keep_alive(this->params.keep_alive_timeout);
 	task->get_req()->set_size_limit(this->params.request_size_limit);
+	task->get_req()->set_buffer_allocator(this->allocator);
+	task->get_resp()->set_buffer_allocator(this->allocator);
+	if (this->buffer_total_limit > 0 || this->buffer_connection_limit > 0)
+	{
+		task->get_req()->set_buffer_quota(
+				__connection_quota(conn, this->buffer_connection_limit,
+								   this->buffer_total_limit));
+	}
 
 	return task;
 }
@@ -231,48 +360,98 @@ void RPCServer<RPCTYPE>::server_process(NETWORKTASK *task) const
 
 		RPCTYPE::server_reply_init(req, resp);
 
-		auto *service = this->find_service(req->get_service_name());
-		if (!service)
+		if (req->is_overloaded())
 		{
-			status_code = RPCStatusServiceNotFound;
+			status_code = RPCStatusOverloaded;
 			break;
 		}
 
-		auto *rpc = service->find_method(req->get_method_name());
-		if (!rpc)
+		const RPCService *service;
+		auto *method = this->find_method(req, &service);
+		if (!method)
 		{
-			status_code = RPCStatusMethodNotFound;
+			status_code = service ? RPCStatusMethodNotFound :
+									RPCStatusServiceNotFound;
 			break;
 		}
 
-		status_code = req->decompress();
-		if (status_code != RPCStatusOK)
-			break;
+		auto *rpc = &method->call;
+		resp->set_buffer_sizer(&method->sizer);
+		if (this->compress_policy)
+		{
+			resp->set_compress_stats(this->compress_policy->find_stats(
+									 service->get_name(), method->name));
+		}
 
 		auto *server_task = static_cast<TASK *>(task);
-		RPCModuleData *task_data = server_task->mutable_module_data();
-		req->get_meta_module_data(*task_data);
-
-		for (auto *module : this->modules)
+		if (this->need_offload(method, req))
 		{
-			if (module && !module->server_task_begin(server_task, *task_data))
-			{
-				status_code = RPCStatusModuleFilterFailed;
-				break;
-			}
-		}
+			// the tasks pushed by the method still run after this one
+			WFGoTask *go = WFTaskFactory::create_go_task(SRPC_CODEC_QUEUE,
+				[this, server_task, rpc]() {
+					int status_code = this->server_call(server_task, *rpc);
 
-		if (status_code == RPCStatusOK)
-			status_code = (*rpc)(server_task->worker);
+					server_task->get_resp()->set_status_code(status_code);
+				});
 
-		SERIES *series = static_cast<SERIES *>(series_of(task));
-		series->set_module_data(task_data);
+			server_task->set_offload(true);
+			series_of(task)->push_back(go);
+			return;
+		}
 
+		status_code = this->server_call(server_task, *rpc);
 	} while (0);
 
 	resp->set_status_code(status_code);
 }
 
+template<class RPCTYPE>
+int RPCServer<RPCTYPE>::server_call(TASK *task,
+									const std::function<int (RPCWorker&)>& rpc) const
+{
+	auto *req = task->get_req();
+	int status_code = req->decompress();
+
+	if (status_code != RPCStatusOK)
+		return status_code;
+
+	RPCModuleData *task_data = task->mutable_module_data();
+	req->get_meta_module_data(*task_data);
+
+	for (auto *module : this->modules)
+	{
+		if (module && !module->server_task_begin(task, *task_data))
+		{
+			status_code = RPCStatusModuleFilterFailed;
+			break;
+		}
+	}
+
+	if (status_code == RPCStatusOK)
+		status_code = rpc(task->worker);
+
+	SERIES *series = static_cast<SERIES *>(series_of(task));
+	series->set_module_data(task_data);
+	return status_code;
+}
+
+template<class RPCTYPE>
+inline bool RPCServer<RPCTYPE>::need_offload(const RPCService::Method *method,
+											 const REQTYPE *req) const
+{
+	if (method->offload)
+		return true;
+
+	if (this->offload_size == 0)
+		return false;
+
+	if (req->get_body_size() >= this->offload_size)
+		return true;
+
+	// response size learned from the ones before
+	return method->sizer.get_piece_size() >= this->offload_size;
+}
+
 template<>
 inline const RPCService *
 RPCServer<RPCTYPEThrift>::find_service(const std::string& name) const
@@ -19,7 +19,12 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include <algorithm>
 #include <functional>
+#include <tuple>
+#include <type_traits>
+#include "rpc_allocator.h"
 #include "rpc_context.h"
 #include "rpc_options.h"
 
@@ -32,7 +37,32 @@ protected:
 	using rpc_method_t = std::function<int (RPCWorker&)>;
 
 public:
-	RPCService(const std::string& name) : name_(name) { }
+	// one method, found by name or by the ID from generator
+	struct Method
+	{
+		Method(const std::string& service, const std::string& name,
+			   rpc_method_t&& call) :
+			name(name),
+			call(std::move(call)),
+			sizer(service, name)
+		{ }
+
+		std::string name;
+		rpc_method_t call;
+		// learn the response size of this method
+		mutable RPCBufferSizer sizer;
+		bool offload = false;
+	};
+
+public:
+	RPCService(const std::string& name) : name_(name), id_(0), arena_(false) { }
+	// id is from generator, 0 means dispatched only by name
+	RPCService(const std::string& name, unsigned int id) :
+		name_(name),
+		id_(id),
+		arena_(false)
+	{ }
+
 	RPCService(RPCService&& move) = delete;
 	RPCService& operator=(RPCService&& move) = delete;
 	RPCService(const RPCService& copy) = delete;
@@ -40,47 +70,169 @@ public:
 	virtual ~RPCService() { };
 
 	const std::string& get_name() const { return name_; }
+	unsigned int get_id() const { return id_; }
+	const Method *get_method(const std::string& method_name) const;
+	const Method *get_method(unsigned int method_id) const;
 	const rpc_method_t *find_method(const std::string& method_name) const;
+	RPCBufferSizer *find_sizer(const std::string& method_name) const;
+
+	// decode, call and encode method in compute threads, set before start
+	void set_offload(const std::string& method_name);
+	bool is_offload(const std::string& method_name) const;
+	// protobuf input and output of each call are on an arena of the task,
+	// freed at once after replied. Keep no pointer into them after that
+	void set_arena(bool on) { arena_ = on; }
+	bool is_arena() const { return arena_; }
 
 protected:
 	void add_method(const std::string& method_name, rpc_method_t&& method);
+	// method_id is the hash of method_name from generator, 0 means none
+	void add_method(const std::string& method_name, unsigned int method_id,
+					rpc_method_t&& method);
 
 private:
-	std::unordered_map<std::string, rpc_method_t> methods_;
+	std::unordered_map<std::string, Method> methods_;
+	// sorted by ID, NULL for the IDs of more than one method
+	std::vector<std::pair<unsigned int, const Method *>> method_ids_;
 	std::string name_;
+	unsigned int id_;
+	bool arena_;
 };
 
 ////////
 // inl
 
+template<class T>
+static void __server_message_recycle(ProtobufIDLMessage *msg)
+{
+	RPCObjectRecycler<T>::put(static_cast<T *>(msg));
+}
+
+// freed with the arena of worker
+static inline void __server_message_on_arena(ProtobufIDLMessage *)
+{
+}
+
+// protobuf messages are on arena or recycled per thread, thrift ones are not
+template<class INPUT>
+static inline INPUT *__server_input(RPCWorker& worker, bool arena,
+									std::true_type)
+{
+	INPUT *in;
+
+	if (arena)
+	{
+		in = google::protobuf::Arena::CreateMessage<INPUT>(worker.get_server_arena());
+		worker.set_server_input(in, &__server_message_on_arena);
+	}
+	else
+	{
+		in = RPCObjectRecycler<INPUT>::get();
+		worker.set_server_input(in, &__server_message_recycle<INPUT>);
+	}
+
+	return in;
+}
+
+template<class INPUT>
+static inline INPUT *__server_input(RPCWorker& worker, bool arena,
+									std::false_type)
+{
+	INPUT *in = new INPUT;
+
+	worker.set_server_input(in);
+	return in;
+}
+
+template<class OUTPUT>
+static inline OUTPUT *__server_output(RPCWorker& worker, bool arena,
+									  std::true_type)
+{
+	OUTPUT *out;
+
+	if (arena)
+	{
+		out = google::protobuf::Arena::CreateMessage<OUTPUT>(worker.get_server_arena());
+		worker.set_server_output(out, &__server_message_on_arena);
+	}
+	else
+	{
+		out = RPCObjectRecycler<OUTPUT>::get();
+		worker.set_server_output(out, &__server_message_recycle<OUTPUT>);
+	}
+
+	return out;
+}
+
+template<class OUTPUT>
+static inline OUTPUT *__server_output(RPCWorker& worker, bool arena,
+									  std::false_type)
+{
+	OUTPUT *out = new OUTPUT;
+
+	worker.set_server_output(out);
+	return out;
+}
+
 template<class INPUT, class OUTPUT, class SERVICE>
 static inline int
 ServiceRPCCallImpl(SERVICE *service,
 				   RPCWorker& worker,
 				   void (SERVICE::*rpc)(INPUT *, OUTPUT *, RPCContext *))
 {
-	auto *in = new INPUT;
-
-	worker.set_server_input(in);
+	bool arena = service->is_arena();
+	auto *in = __server_input<INPUT>(worker, arena,
+			std::is_base_of<ProtobufIDLMessage, INPUT>());
 	int status_code = worker.req->deserialize(in);
 
 	if (status_code == RPCStatusOK)
 	{
-		auto *out = new OUTPUT;
+		auto *out = __server_output<OUTPUT>(worker, arena,
+				std::is_base_of<ProtobufIDLMessage, OUTPUT>());
 
-		worker.set_server_output(out);
 		(service->*rpc)(in, out, worker.ctx);
 	}
 
 	return status_code;
 }
 
+// for the tables sorted by ID
+template<class T>
+static inline bool __id_less(const std::pair<unsigned int, T>& entry,
+							 unsigned int id)
+{
+	return entry.first < id;
+}
+
 inline void RPCService::add_method(const std::string& method_name, rpc_method_t&& method)
 {
-	methods_.emplace(method_name, std::move(method));
+	methods_.emplace(std::piecewise_construct,
+					 std::forward_as_tuple(method_name),
+					 std::forward_as_tuple(name_, method_name, std::move(method)));
 }
 
-inline const RPCService::rpc_method_t *RPCService::find_method(const std::string& method_name) const
+inline void RPCService::add_method(const std::string& method_name,
+								   unsigned int method_id,
+								   rpc_method_t&& method)
+{
+	auto it = methods_.emplace(std::piecewise_construct,
+							   std::forward_as_tuple(method_name),
+							   std::forward_as_tuple(name_, method_name,
+													 std::move(method)));
+
+	if (!it.second || method_id == 0)
+		return;
+
+	auto id_it = std::lower_bound(method_ids_.begin(), method_ids_.end(),
+								  method_id, __id_less<const Method *>);
+
+	if (id_it != method_ids_.end() && id_it->first == method_id)
+		id_it->second = NULL;
+	else
+		method_ids_.emplace(id_it, method_id, &it.first->second);
+}
+
+inline const RPCService::Method *RPCService::get_method(const std::string& method_name) const
 {
 	const auto it = methods_.find(method_name);
 
@@ -90,6 +242,46 @@ inline const RPCService::rpc_method_t *RPCService::find_method(const std::string
 	return NULL;
 }
 
+inline const RPCService::Method *RPCService::get_method(unsigned int method_id) const
+{
+	const auto it = std::lower_bound(method_ids_.begin(), method_ids_.end(),
+									 method_id, __id_less<const Method *>);
+
+	if (it != method_ids_.end() && it->first == method_id)
+		return it->second;
+
+	return NULL;
+}
+
+inline const RPCService::rpc_method_t *RPCService::find_method(const std::string& method_name) const
+{
+	const Method *method = this->get_method(method_name);
+
+	return method ? &method->call : NULL;
+}
+
+inline RPCBufferSizer *RPCService::find_sizer(const std::string& method_name) const
+{
+	const Method *method = this->get_method(method_name);
+
+	return method ? &method->sizer : NULL;
+}
+
+inline void RPCService::set_offload(const std::string& method_name)
+{
+	const auto it = methods_.find(method_name);
+
+	if (it != methods_.end())
+		it->second.offload = true;
+}
+
+inline bool RPCService::is_offload(const std::string& method_name) const
+{
+	const Method *method = this->get_method(method_name);
+
+	return method && method->offload;
+}
+
 } // namespace srpc
 
 #endif
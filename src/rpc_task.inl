@@ -44,15 +44,37 @@ public:
 	~RPCWorker()
 	{
 		delete this->ctx;
-		delete this->pb_input;
-		delete this->pb_output;
+		if (this->pb_input_recycle)
+			this->pb_input_recycle(this->pb_input);
+		else
+			delete this->pb_input;
+
+		if (this->pb_output_recycle)
+			this->pb_output_recycle(this->pb_output);
+		else
+			delete this->pb_output;
+
 		delete this->thrift_intput;
 		delete this->thrift_output;
+		// after the messages, which may be on it
+		RPCMessageArena::put(this->arena);
+	}
+
+	// the arena of this worker, free with all messages on it when done
+	google::protobuf::Arena *get_server_arena()
+	{
+		if (!this->arena)
+			this->arena = RPCMessageArena::get();
+
+		return this->arena->get_arena();
 	}
 
-	void set_server_input(ProtobufIDLMessage *input)
+	// recycle instead of delete when the worker is done, if set
+	void set_server_input(ProtobufIDLMessage *input,
+						  void (*recycle)(ProtobufIDLMessage *) = NULL)
 	{
 		this->pb_input = input;
+		this->pb_input_recycle = recycle;
 	}
 
 	void set_server_input(ThriftIDLMessage *input)
@@ -60,9 +82,11 @@ public:
 		this->thrift_intput = input;
 	}
 
-	void set_server_output(ProtobufIDLMessage *output)
+	void set_server_output(ProtobufIDLMessage *output,
+						   void (*recycle)(ProtobufIDLMessage *) = NULL)
 	{
 		this->pb_output = output;
+		this->pb_output_recycle = recycle;
 		this->__server_serialize = &RPCWorker::resp_serialize_pb;
 	}
 
@@ -101,6 +125,9 @@ private:
 	ProtobufIDLMessage *pb_output = NULL;
 	ThriftIDLMessage *thrift_intput = NULL;
 	ThriftIDLMessage *thrift_output = NULL;
+	void (*pb_input_recycle)(ProtobufIDLMessage *) = NULL;
+	void (*pb_output_recycle)(ProtobufIDLMessage *) = NULL;
+	RPCMessageArena *arena = NULL;
 };
 
 template<class RPCREQ, class RPCRESP>
@@ -110,8 +137,16 @@ public:
 	// before rpc call
 	void set_data_type(RPCDataType type);
 	void set_compress_type(RPCCompressType type);
+	// dictionary loaded by RPCCompressor::add_dict(), only srpc supported now
+	void set_compress_dict(unsigned int dict_id);
 	void set_retry_max(int retry_max);
 	void set_attachment_nocopy(const char *attachment, size_t len);
+	// send the range of file as attachment by mmap(), fd can be closed after
+	bool set_attachment_file(int fd, size_t offset, size_t len);
+	// write the attachment of response into fd from the beginning of file
+	void set_attachment_spill(int fd);
+	// pieces of req and resp come from allocator
+	void set_buffer_allocator(RPCBufferAllocator *allocator);
 	int set_uri_fragment(const std::string& fragment);
 	int serialize_input(const ProtobufIDLMessage *in);
 	int serialize_input(const ThriftIDLMessage *in);
@@ -165,27 +200,36 @@ private:
 	user_done_t user_done_;
 	bool init_failed_;
 	int watch_timeout_;
+	int spill_fd_;
+	RPCBufferAllocator *allocator_;
 
 	RPCModuleData module_data_;
 	std::list<RPCModule *> modules_;
 };
 
+// task, context and series of each request come from RPCObjectAllocator
 template<class RPCREQ, class RPCRESP>
-class RPCServerTask : public WFServerTask<RPCREQ, RPCRESP>
+class RPCServerTask : public WFServerTask<RPCREQ, RPCRESP>,
+					  public RPCPooledObject
 {
 public:
+	// modules is the array of server, SRPC_MODULE_MAX entries, NULL if unset
 	RPCServerTask(CommService *service,
 				  std::function<void (WFNetworkTask<RPCREQ, RPCRESP> *)>& process,
-				  std::list<RPCModule *>&& modules) :
+				  RPCModule *const *modules) :
 		WFServerTask<RPCREQ, RPCRESP>(service, WFGlobal::get_scheduler(), process),
 		worker(new RPCContextImpl<RPCREQ, RPCRESP>(this, &module_data_),
 			   &this->req, &this->resp),
-		modules_(std::move(modules))
+		modules_(modules),
+		offload_(false),
+		encoded_(false),
+		encode_status_(RPCStatusOK)
 	{
 	}
 
 public:
-	class RPCSeries : public WFServerTask<RPCREQ, RPCRESP>::Series
+	class RPCSeries : public WFServerTask<RPCREQ, RPCRESP>::Series,
+					  public RPCPooledObject
 	{
 	public:
 		RPCSeries(WFServerTask<RPCREQ, RPCRESP> *task) :
@@ -210,18 +254,26 @@ public:
 protected:
 	CommMessageOut *message_out() override;
 	void handle(int state, int error) override;
+	void dispatch() override;
 
 public:
 	bool get_remote(std::string& ip, unsigned short *port) const;
 	RPCModuleData *mutable_module_data() { return &module_data_; }
 	void set_module_data(RPCModuleData data) { module_data_ = std::move(data); }
+	// serialize and compress the response in a compute thread, set by RPCServer
+	void set_offload(bool on) { offload_ = on; }
 
 public:
 	RPCWorker worker;
 
 private:
+	int encode();
+
 	RPCModuleData module_data_;
-	std::list<RPCModule *> modules_;
+	RPCModule *const *modules_;
+	bool offload_;
+	bool encoded_;
+	int encode_status_;
 };
 
 template<class OUTPUT>
@@ -287,13 +339,26 @@ ClientRPCDoneImpl(int status_code,
 }
 
 template<class RPCREQ, class RPCRESP>
-CommMessageOut *RPCServerTask<RPCREQ, RPCRESP>::message_out()
+int RPCServerTask<RPCREQ, RPCRESP>::encode()
 {
 	int status_code = this->worker.server_serialize();
 
 	if (status_code == RPCStatusOK)
 		status_code = this->resp.compress();
 
+	return status_code;
+}
+
+template<class RPCREQ, class RPCRESP>
+CommMessageOut *RPCServerTask<RPCREQ, RPCRESP>::message_out()
+{
+	int status_code;
+
+	if (this->encoded_)
+		status_code = this->encode_status_;
+	else
+		status_code = this->encode();
+
 	if (status_code == RPCStatusOK)
 	{
 		if (!this->resp.serialize_meta())
@@ -306,9 +371,11 @@ CommMessageOut *RPCServerTask<RPCREQ, RPCRESP>::message_out()
 	// for server, this is the where series->module_data stored
 	RPCModuleData *data = this->mutable_module_data();
 
-	for (auto *module : modules_)
+	for (int i = 0; i < SRPC_MODULE_MAX; i++)
 	{
-		if (!module->server_task_end(this, *data))
+		RPCModule *module = modules_[i];
+
+		if (module && !module->server_task_end(this, *data))
 		{
 			status_code = RPCStatusModuleFilterFailed;
 			break;
@@ -337,6 +404,25 @@ void RPCServerTask<RPCREQ, RPCRESP>::handle(int state, int error)
 	series->start();
 }
 
+// reply after the response is encoded by a go task, message_out() only sends
+template<class RPCREQ, class RPCRESP>
+void RPCServerTask<RPCREQ, RPCRESP>::dispatch()
+{
+	if (this->state != WFT_STATE_TOREPLY || !this->offload_ || this->encoded_)
+		return WFServerTask<RPCREQ, RPCRESP>::dispatch();
+
+	WFGoTask *task = WFTaskFactory::create_go_task(SRPC_CODEC_QUEUE, [this]() {
+		this->encode_status_ = this->encode();
+	});
+
+	task->set_callback([this](WFGoTask *) {
+		this->encoded_ = true;
+		this->WFServerTask<RPCREQ, RPCRESP>::dispatch();
+	});
+
+	task->start();
+}
+
 template<class RPCREQ, class RPCRESP>
 inline void RPCClientTask<RPCREQ, RPCRESP>::set_data_type(RPCDataType type)
 {
@@ -349,6 +435,12 @@ inline void RPCClientTask<RPCREQ, RPCRESP>::set_compress_type(RPCCompressType ty
 	this->req.set_compress_type(type);
 }
 
+template<class RPCREQ, class RPCRESP>
+inline void RPCClientTask<RPCREQ, RPCRESP>::set_compress_dict(unsigned int dict_id)
+{
+	this->req.set_compress_dict(dict_id);
+}
+
 template<class RPCREQ, class RPCRESP>
 inline void RPCClientTask<RPCREQ, RPCRESP>::set_attachment_nocopy(const char *attachment,
 																  size_t len)
@@ -356,6 +448,27 @@ inline void RPCClientTask<RPCREQ, RPCRESP>::set_attachment_nocopy(const char *at
 	this->req.set_attachment_nocopy(attachment, len);
 }
 
+template<class RPCREQ, class RPCRESP>
+inline bool RPCClientTask<RPCREQ, RPCRESP>::set_attachment_file(int fd,
+																size_t offset,
+																size_t len)
+{
+	return this->req.set_attachment_file(fd, offset, len);
+}
+
+template<class RPCREQ, class RPCRESP>
+inline void RPCClientTask<RPCREQ, RPCRESP>::set_attachment_spill(int fd)
+{
+	spill_fd_ = fd;
+}
+
+template<class RPCREQ, class RPCRESP>
+inline void RPCClientTask<RPCREQ, RPCRESP>::set_buffer_allocator(RPCBufferAllocator *allocator)
+{
+	allocator_ = allocator;
+	this->req.set_buffer_allocator(allocator);
+}
+
 template<class RPCREQ, class RPCRESP>
 int RPCClientTask<RPCREQ, RPCRESP>::set_uri_fragment(const std::string& fragment)
 {
@@ -415,6 +528,8 @@ inline RPCClientTask<RPCREQ, RPCRESP>::RPCClientTask(
 	WFComplexClientTask<RPCREQ, RPCRESP>(0, nullptr),
 	user_done_(std::move(user_done)),
 	init_failed_(false),
+	spill_fd_(-1),
+	allocator_(NULL),
 	modules_(std::move(modules))
 {
 	if (user_done_)
@@ -475,6 +590,12 @@ template<class RPCREQ, class RPCRESP>
 CommMessageOut *RPCClientTask<RPCREQ, RPCRESP>::message_out()
 {
 	this->req.set_seqid(this->get_task_seq());
+	// resp is renewed before every retry
+	if (spill_fd_ >= 0)
+		this->resp.set_attachment_spill(spill_fd_);
+
+	if (allocator_)
+		this->resp.set_buffer_allocator(allocator_);
 
 	int status_code = this->req.compress();
 
@@ -503,6 +624,11 @@ bool RPCClientTask<RPCREQ, RPCRESP>::finish_once()
 	{
 		if (this->resp.deserialize_meta() == false)
 			this->resp.set_status_code(RPCStatusMetaError);
+		// not the reply of this request, if both carry IDs
+		else if (this->resp.get_status_code() == RPCStatusOK &&
+				 this->resp.get_seqid() >= 0 &&
+				 this->resp.get_seqid() != this->req.get_seqid())
+			this->resp.set_status_code(RPCStatusMetaError);
 	}
 
 	return true;
@@ -36,6 +36,9 @@ struct RPCTYPESRPC
 	static inline void server_reply_init(const REQ *req, RESP *resp)
 	{
 		resp->set_data_type(req->get_data_type());
+		// -1 if the request has none, then the reply has none either
+		if (req->get_correlation_id() >= 0)
+			resp->set_correlation_id(req->get_correlation_id());
 	}
 };
 
@@ -51,6 +54,9 @@ struct RPCTYPESRPCHttp
 	}
 };
 
+// not implemented: gRPC needs an HTTP/2 transport with HPACK, flow control
+// and concurrent streams on one connection, while a workflow client
+// connection carries one request at a time
 struct RPCTYPEGRPC
 {
 	//using REQ = GRPCHttp2Request;
@@ -66,7 +72,8 @@ struct RPCTYPEBRPC
 
 	static inline void server_reply_init(const REQ *req, RESP *resp)
 	{
-		resp->set_correlation_id(req->get_correlation_id());
+		if (req->get_correlation_id() >= 0)
+			resp->set_correlation_id(req->get_correlation_id());
 	}
 };
 
@@ -85,6 +92,9 @@ struct RPCTYPEThrift
 		resp_meta->is_strict = req_meta->is_strict;
 		resp_meta->seqid = req_meta->seqid;
 		resp_meta->method_name = req_meta->method_name;
+		// reply THeader in the transform of request, unless set by server
+		resp->set_theader(req->get_theader());
+		resp->set_compress_type(req->get_compress_type());
 	}
 };
 
@@ -0,0 +1,226 @@
+/*
+  Copyright (c) 2020 sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "rpc_buffer.h"
+#include "rpc_allocator.h"
+#include "rpc_compress.h"
+#include "rpc_zero_copy_stream.h"
+
+namespace srpc
+{
+
+// one size class of the slab, large enough for the parser to copy less
+static constexpr size_t DECOMPRESS_WINDOW_SIZE = 64 * 1024;
+
+RPCDecompressStream::RPCDecompressStream(RPCBuffer *buf)
+{
+	this->buf = buf;
+	this->handler = NULL;
+	this->ctx = NULL;
+	this->in = NULL;
+	this->in_len = 0;
+	this->window = NULL;
+	this->pos = 0;
+	this->len = 0;
+	this->total_out = 0;
+	this->flushing = false;
+	this->ended = false;
+	this->failed = false;
+}
+
+RPCDecompressStream::~RPCDecompressStream()
+{
+	RPCBufferAllocator *allocator = this->buf->get_allocator();
+
+	if (!this->window)
+		return;
+
+	if (allocator)
+		allocator->deallocate(this->window, DECOMPRESS_WINDOW_SIZE);
+	else
+		free(this->window);
+}
+
+bool RPCDecompressStream::is_supported(int type)
+{
+	const CompressHandler *handler;
+
+	handler = RPCCompressor::get_instance()->find_handler(type);
+	return handler && handler->decompress_stream_begin &&
+		   handler->decompress_stream;
+}
+
+bool RPCDecompressStream::begin(int type, unsigned int dict_id)
+{
+	RPCBufferAllocator *allocator = this->buf->get_allocator();
+
+	this->handler = RPCCompressor::get_instance()->find_handler(type);
+	if (!this->handler || !this->handler->decompress_stream_begin ||
+		!this->handler->decompress_stream)
+	{
+		return false;
+	}
+
+	this->ctx = this->handler->decompress_stream_begin(this->buf, dict_id);
+	if (!this->ctx)
+		return false;
+
+	if (!this->window)
+	{
+		if (allocator)
+			this->window = (char *)allocator->allocate(DECOMPRESS_WINDOW_SIZE);
+		else
+			this->window = (char *)malloc(DECOMPRESS_WINDOW_SIZE);
+
+		if (!this->window)
+		{
+			this->ctx = NULL;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool RPCDecompressStream::fill()
+{
+	size_t in_len;
+	size_t out_len;
+	int ret;
+
+	if (!this->ctx || this->failed)
+		return false;
+
+	for (;;)
+	{
+		// a full window may leave more inside ctx without input
+		if (this->in_len == 0 && !this->flushing)
+		{
+			this->in_len = this->buf->fetch(&this->in);
+			if (this->in_len == 0)
+			{
+				// truncated if the data does not end with all the input
+				this->failed = !this->ended;
+				return false;
+			}
+		}
+
+		in_len = this->in_len;
+		out_len = DECOMPRESS_WINDOW_SIZE;
+		ret = this->handler->decompress_stream(this->ctx, this->in, &in_len,
+											   this->window, &out_len);
+		if (ret < 0)
+		{
+			this->failed = true;
+			return false;
+		}
+
+		this->in = (const char *)this->in + in_len;
+		this->in_len -= in_len;
+		this->ended = (ret == 0);
+		this->flushing = (ret != 0 && out_len == DECOMPRESS_WINDOW_SIZE);
+		if (out_len > 0)
+		{
+			this->pos = 0;
+			this->len = out_len;
+			this->total_out += out_len;
+			return true;
+		}
+
+		// input left but nothing consumed, such as garbage after the end
+		if (in_len == 0 && this->in_len != 0)
+		{
+			this->failed = true;
+			return false;
+		}
+	}
+}
+
+bool RPCDecompressStream::Next(const void **data, int *size)
+{
+	if (this->pos == this->len && !this->fill())
+		return false;
+
+	*data = this->window + this->pos;
+	*size = (int)(this->len - this->pos);
+	this->pos = this->len;
+	return true;
+}
+
+void RPCDecompressStream::BackUp(int count)
+{
+	this->pos -= count;
+}
+
+bool RPCDecompressStream::Skip(int count)
+{
+	size_t left = count;
+
+	while (left > this->len - this->pos)
+	{
+		left -= this->len - this->pos;
+		this->pos = this->len;
+		if (!this->fill())
+			return false;
+	}
+
+	this->pos += left;
+	return true;
+}
+
+int64_t RPCDecompressStream::ByteCount() const
+{
+	return this->total_out - (int64_t)(this->len - this->pos);
+}
+
+bool RPCDecompressStream::read(void *data, size_t size)
+{
+	size_t n;
+
+	while (size > 0)
+	{
+		if (this->pos == this->len && !this->fill())
+			return false;
+
+		n = this->len - this->pos;
+		if (n > size)
+			n = size;
+
+		memcpy(data, this->window + this->pos, n);
+		this->pos += n;
+		data = (char *)data + n;
+		size -= n;
+	}
+
+	return true;
+}
+
+bool RPCDecompressStream::finish()
+{
+	if (!this->ctx)
+		return false;
+
+	this->pos = this->len;
+	while (this->fill())
+		this->pos = this->len;
+
+	return !this->failed;
+}
+
+} // namespace srpc
+
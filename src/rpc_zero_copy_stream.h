@@ -18,10 +18,13 @@
 #define __RPC_ZERO_COPY_STREAM_H__
 
 #include <google/protobuf/io/zero_copy_stream.h>
+#include "rpc_buffer.h"
 
 namespace srpc
 {
 
+class CompressHandler;
+
 class RPCOutputStream : public google::protobuf::io::ZeroCopyOutputStream
 {
 public:
@@ -48,6 +51,54 @@ private:
 	RPCBuffer *buf;
 };
 
+/*
+ * Decompressed data of a compressed RPCBuffer. Decompressed piece by piece
+ * into a small window while the parser reads, instead of into a second
+ * buffer as large as the message.
+ * It uses the decompress context of this thread, so finish one stream
+ * before beginning another in the same thread.
+ */
+class RPCDecompressStream : public google::protobuf::io::ZeroCopyInputStream
+{
+public:
+	RPCDecompressStream(RPCBuffer *buf);
+	~RPCDecompressStream();
+
+	// ret: false if type can not be decompressed as a stream, or failed
+	bool begin(int type, unsigned int dict_id);
+
+	bool Next(const void **data, int *size) override;
+	void BackUp(int count) override;
+	bool Skip(int count) override;
+	int64_t ByteCount() const override;
+
+	// copy the next size bytes, for the readers not zero copy
+	bool read(void *data, size_t size);
+
+	// ret: true if the rest is decompressed to the end without error
+	bool finish();
+
+	// ret: true if type has stream handlers, begin() may still fail on dict
+	static bool is_supported(int type);
+
+private:
+	// decompress the next window, ret: false at the end or failed
+	bool fill();
+
+	RPCBuffer *buf;
+	const CompressHandler *handler;
+	void *ctx;
+	const void *in;
+	size_t in_len;
+	char *window;
+	size_t pos;
+	size_t len;
+	int64_t total_out;
+	bool flushing;
+	bool ended;
+	bool failed;
+};
+
 inline RPCOutputStream::RPCOutputStream(RPCBuffer *buf, size_t size)
 {
 	this->buf = buf;
@@ -16,18 +16,35 @@
 
 #include "rpc_thrift_buffer.h"
 #include "rpc_basic.h"
+#include "rpc_zero_copy_stream.h"
 
 namespace srpc
 {
 
+bool ThriftBuffer::read(void *buf, size_t size)
+{
+	if (this->stream)
+		return this->stream->read(buf, size);
+
+	return this->buffer->read(buf, size);
+}
+
+bool ThriftBuffer::seek(int32_t size)
+{
+	if (this->stream)
+		return this->stream->Skip(size);
+
+	return this->buffer->seek(size) == size;
+}
+
 bool ThriftBuffer::readI08(int8_t& val)
 {
-	return this->buffer->read((char *)&val, 1);
+	return this->read((char *)&val, 1);
 }
 
 bool ThriftBuffer::readI16(int16_t& val)
 {
-	if (!this->buffer->read((char *)&val, 2))
+	if (!this->read((char *)&val, 2))
 		return false;
 
 	val = ntohs(val);
@@ -36,7 +53,7 @@ bool ThriftBuffer::readI16(int16_t& val)
 
 bool ThriftBuffer::readI32(int32_t& val)
 {
-	if (!this->buffer->read((char *)&val, 4))
+	if (!this->read((char *)&val, 4))
 		return false;
 
 	val = ntohl(val);
@@ -45,7 +62,7 @@ bool ThriftBuffer::readI32(int32_t& val)
 
 bool ThriftBuffer::readI64(int64_t& val)
 {
-	if (!this->buffer->read((char *)&val, 8))
+	if (!this->read((char *)&val, 8))
 		return false;
 
 	val = ntohll(val);
@@ -54,7 +71,7 @@ bool ThriftBuffer::readI64(int64_t& val)
 
 bool ThriftBuffer::readU64(uint64_t& val)
 {
-	if (!this->buffer->read((char *)&val, 8))
+	if (!this->read((char *)&val, 8))
 		return false;
 
 	val = ntohll(val);
@@ -93,7 +110,7 @@ bool ThriftBuffer::readStringBody(std::string& str, int32_t slen)
 		return false;
 
 	str.resize(slen);
-	return this->buffer->read(const_cast<char *>(str.c_str()), slen);
+	return this->read(const_cast<char *>(str.c_str()), slen);
 }
 
 bool ThriftBuffer::writeFieldStop()
@@ -256,18 +273,18 @@ bool ThriftBuffer::skip(int8_t field_type)
 	{
 	case TDT_I08:
 	case TDT_BOOL:
-		return this->buffer->seek(1) == 1;
+		return this->seek(1);
 
 	case TDT_I16:
-		return this->buffer->seek(2) == 2;
+		return this->seek(2);
 
 	case TDT_I32:
-		return this->buffer->seek(4) == 4;
+		return this->seek(4);
 
 	case TDT_I64:
 	case TDT_U64:
 	case TDT_DOUBLE:
-		return this->buffer->seek(8) == 8;
+		return this->seek(8);
 
 	case TDT_STRING:
 	case TDT_UTF8:
@@ -278,7 +295,7 @@ bool ThriftBuffer::skip(int8_t field_type)
 		if (!readI32(slen) || slen < 0)
 			return false;
 
-		return this->buffer->seek(slen) == slen;
+		return this->seek(slen);
 	}
 	case TDT_STRUCT:
 	{
@@ -26,6 +26,8 @@
 namespace srpc
 {
 
+class RPCDecompressStream;
+
 static constexpr int32_t THRIFT_VERSION_MASK	=	((int32_t)0xffff0000);
 static constexpr int32_t THRIFT_VERSION_1		=	((int32_t)0x80010000);
 
@@ -62,6 +64,8 @@ class ThriftBuffer
 public:
 	ThriftMeta meta;
 	RPCBuffer *buffer;
+	// read from the decompressed stream instead of buffer if not NULL
+	RPCDecompressStream *stream = NULL;
 	size_t readbuf_size = 0;
 	size_t framesize_read_byte = 0;
 	int32_t framesize = 0;
@@ -69,6 +73,7 @@ public:
 
 public:
 	ThriftBuffer(RPCBuffer *buf): buffer(buf) { }
+	ThriftBuffer(RPCDecompressStream *stream): buffer(NULL), stream(stream) { }
 
 	ThriftBuffer(const ThriftBuffer&) = delete;
 	ThriftBuffer& operator= (const ThriftBuffer&) = delete;
@@ -97,6 +102,10 @@ public:
 	bool writeU64(uint64_t val);
 	bool writeString(const std::string& str);
 	bool writeStringBody(const std::string& str);
+
+private:
+	bool read(void *buf, size_t size);
+	bool seek(int32_t size);
 };
 
 } // end namespace srpc
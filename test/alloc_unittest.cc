@@ -0,0 +1,226 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#ifdef _WIN32
+#include <workflow/PlatformSocket.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+#include <gtest/gtest.h>
+#include "test_pb.srpc.h"
+
+using namespace srpc;
+using namespace unit;
+
+// every heap allocation of the process, from client and server threads
+static std::atomic<size_t> g_new_count(0);
+
+void *operator new(size_t size)
+{
+	void *ptr = malloc(size ? size : 1);
+
+	if (!ptr)
+		abort();
+
+	++g_new_count;
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+	free(ptr);
+}
+
+class ForceShutdown
+{
+public:
+	~ForceShutdown() { google::protobuf::ShutdownProtobufLibrary(); }
+} g_holder;
+
+class TestPBServiceImpl : public TestPB::Service
+{
+public:
+	void Add(AddRequest *request, AddResponse *response, RPCContext *ctx) override
+	{
+		response->set_c(request->a() + request->b());
+	}
+
+	void Substr(SubstrRequest *request, SubstrResponse *response, RPCContext *ctx) override
+	{
+		response->set_str(std::string(request->str(), request->idx()));
+	}
+};
+
+static const int WARMUP_TIMES = 100;
+static const int TEST_TIMES = 1000;
+
+// heap allocations of one request on the server after warming up:
+// the meta_buf arrays of request and response and a few of workflow
+static const size_t MAX_NEW_PER_REQUEST = 8;
+
+// the client talks on a plain socket so that only the server is counted
+static bool send_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		int ret = (int)send(fd, buf, len, 0);
+
+		if (ret <= 0)
+			return false;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+static bool recv_all(int fd, char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		int ret = (int)recv(fd, buf, len, 0);
+
+		if (ret <= 0)
+			return false;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+static int call_add(int fd, const std::string& request)
+{
+	char buf[1024];
+	AddResponse resp;
+	uint32_t meta_len;
+	uint32_t message_len;
+
+	if (!send_all(fd, request.data(), request.size()) ||
+		!recv_all(fd, buf, SRPC_HEADER_SIZE))
+	{
+		return -1;
+	}
+
+	meta_len = ntohl(*(uint32_t *)(buf + 4));
+	message_len = ntohl(*(uint32_t *)(buf + 8));
+	if (meta_len + message_len > sizeof buf ||
+		!recv_all(fd, buf, meta_len + message_len) ||
+		!resp.ParseFromArray(buf + meta_len, (int)message_len))
+	{
+		return -1;
+	}
+
+	return resp.c();
+}
+
+// server input and output of one request, after warming up
+TEST(RPCObjectRecycler, steady)
+{
+	std::string str(1000, 'x');
+	size_t count = 0;
+
+	for (int i = 0; i < WARMUP_TIMES + TEST_TIMES; i++)
+	{
+		if (i == WARMUP_TIMES)
+			count = g_new_count;
+
+		SubstrRequest *req = RPCObjectRecycler<SubstrRequest>::get();
+		SubstrResponse *resp = RPCObjectRecycler<SubstrResponse>::get();
+
+		req->mutable_str()->assign(str.data(), str.size());
+		req->set_idx(i % 100);
+		resp->mutable_str()->assign(req->str(), req->idx(), std::string::npos);
+		RPCObjectRecycler<SubstrRequest>::put(req);
+		RPCObjectRecycler<SubstrResponse>::put(resp);
+	}
+
+	EXPECT_EQ(g_new_count - count, (size_t)0);
+}
+
+TEST(SRPC, allocation)
+{
+	TestPBServiceImpl impl;
+	SRPCServer server;
+
+	server.add_service(&impl);
+	EXPECT_TRUE(server.start("127.0.0.1", 9970) == 0) << "server start failed";
+
+	// encode the request once, outside of the counting
+	SRPCStdRequest req;
+	AddRequest input;
+	struct iovec vectors[16];
+	std::string request;
+
+	input.set_a(123);
+	input.set_b(456);
+	req.set_service_name(impl.get_name());
+	req.set_method_name("Add");
+	req.set_data_type(RPCDataProtobuf);
+	EXPECT_EQ(req.serialize(&input), RPCStatusOK);
+	EXPECT_TRUE(req.serialize_meta());
+
+	int cnt = req.encode(vectors, 16);
+
+	EXPECT_GT(cnt, 0);
+	for (int i = 0; i < cnt; i++)
+		request.append((const char *)vectors[i].iov_base, vectors[i].iov_len);
+
+	struct sockaddr_in addr = { };
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(9970);
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	EXPECT_EQ(connect(fd, (struct sockaddr *)&addr, sizeof addr), 0);
+
+	size_t count = 0;
+	int i;
+
+	for (i = 0; i < WARMUP_TIMES + TEST_TIMES; i++)
+	{
+		if (i == WARMUP_TIMES)
+			count = g_new_count;
+
+		if (call_add(fd, request) != 123 + 456)
+			break;
+	}
+
+	count = g_new_count - count;
+	EXPECT_EQ(i, WARMUP_TIMES + TEST_TIMES) << "request failed";
+	EXPECT_LE(count, MAX_NEW_PER_REQUEST * TEST_TIMES)
+		<< count / TEST_TIMES << " allocations per request";
+
+#ifdef _WIN32
+	closesocket(fd);
+#else
+	close(fd);
+#endif
+	server.stop();
+}
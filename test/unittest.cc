@@ -23,6 +23,7 @@
 #include <gtest/gtest.h>
 #include "workflow/WFOperator.h"
 #include "workflow/WFFacilities.h"
+#include "srpc/rpc_compress.h"
 #include "test_pb.srpc.h"
 #include "test_thrift.srpc.h"
 
@@ -264,6 +265,16 @@ TEST(SRPC_COMPRESS, unittest)
 
 	auto& par = *t1 * t2 * t3 * t4;
 
+	// zstd is optional at build time
+	if (RPCCompressor::get_instance()->find_handler(RPCCompressZstd))
+	{
+		auto *t5 = client.create_Add_task(cb);
+
+		t5->set_compress_type(RPCCompressZstd);
+		t5->serialize_input(&req);
+		par.add_series(Workflow::create_series_work(t5, nullptr));
+	}
+
 	par.set_callback([&wg](const ParallelWork *par) {
 		wg.done();
 	});
@@ -273,3 +284,279 @@ TEST(SRPC_COMPRESS, unittest)
 	server.stop();
 }
 
+
+// reply with compression, leave the choice to policy of server
+class TestPBCompressServiceImpl : public TestPBServiceImpl
+{
+public:
+	void Add(AddRequest *request, AddResponse *response, RPCContext *ctx) override
+	{
+		ctx->set_compress_type(RPCCompressGzip);
+		TestPBServiceImpl::Add(request, response, ctx);
+	}
+
+	void Substr(SubstrRequest *request, SubstrResponse *response, RPCContext *ctx) override
+	{
+		ctx->set_compress_type(RPCCompressGzip);
+		TestPBServiceImpl::Substr(request, response, ctx);
+	}
+};
+
+TEST(SRPC_COMPRESS, policy)
+{
+	RPCServerParams server_params = RPC_SERVER_PARAMS_DEFAULT;
+	RPCClientParams client_params = RPC_CLIENT_PARAMS_DEFAULT;
+	SRPCServer server(&server_params);
+	RPCCompressPolicy server_policy;
+	RPCCompressPolicy client_policy;
+	TestPBCompressServiceImpl impl;
+
+	server.set_compress_policy(&server_policy);
+	server.add_service(&impl);
+	EXPECT_TRUE(server.start("127.0.0.1", 9964) == 0) << "server start failed";
+
+	client_params.host = "127.0.0.1";
+	client_params.port = 9964;
+	client_params.task_params.compress_type = RPCCompressGzip;
+	TestPB::SRPCClient client(&client_params);
+
+	client.set_compress_policy(&client_policy);
+
+	AddRequest add_req;
+	SubstrRequest substr_req;
+	std::string str;
+
+	add_req.set_a(123);
+	add_req.set_b(456);
+	for (int i = 0; i < 1000; i++)
+		str += "hello world!";
+
+	substr_req.set_str(str);
+	substr_req.set_idx(6);
+	for (int i = 0; i < 20; i++)
+	{
+		AddResponse add_resp;
+		SubstrResponse substr_resp;
+		RPCSyncContext ctx1;
+		RPCSyncContext ctx2;
+
+		client.Add(&add_req, &add_resp, &ctx1);
+		EXPECT_EQ(ctx1.success, true);
+		EXPECT_EQ(add_resp.c(), 123 + 456);
+
+		client.Substr(&substr_req, &substr_resp, &ctx2);
+		EXPECT_EQ(ctx2.success, true);
+		EXPECT_TRUE(substr_resp.str() == str.substr(6));
+	}
+
+	const std::string& service = client.get_service_name();
+	RPCCompressStats *stats;
+
+	// small ones are never compressed
+	stats = client_policy.find_stats(service, "Add");
+	EXPECT_EQ(stats->get_ratio(RPCCompressGzip), 0);
+	stats = client_policy.find_stats(service, "Substr");
+	EXPECT_GT(stats->get_ratio(RPCCompressGzip), 0);
+	EXPECT_LT(stats->get_ratio(RPCCompressGzip), 0.1);
+
+	stats = server_policy.find_stats(impl.get_name(), "Add");
+	EXPECT_EQ(stats->get_ratio(RPCCompressGzip), 0);
+	stats = server_policy.find_stats(impl.get_name(), "Substr");
+	EXPECT_GT(stats->get_ratio(RPCCompressGzip), 0);
+
+	server.stop();
+}
+
+TEST(SRPC_COMPRESS, zstd_chunk)
+{
+	RPCCompressor *compressor = RPCCompressor::get_instance();
+
+	if (!compressor->find_handler(RPCCompressZstd))
+		return;
+
+	EXPECT_EQ(compressor->set_chunk_size(RPCCompressZstd, 100), -1);
+	EXPECT_EQ(compressor->set_chunk_size(RPCCompressGzip, 65536), -2);
+	EXPECT_EQ(compressor->set_chunk_size(RPCCompressZstd, 65536), 0);
+
+	RPCServerParams server_params = RPC_SERVER_PARAMS_DEFAULT;
+	RPCClientParams client_params = RPC_CLIENT_PARAMS_DEFAULT;
+	SRPCServer server(&server_params);
+	TestPBServiceImpl impl;
+
+	server.add_service(&impl);
+	EXPECT_TRUE(server.start("127.0.0.1", 9964) == 0) << "server start failed";
+
+	client_params.host = "127.0.0.1";
+	client_params.port = 9964;
+	client_params.task_params.compress_type = RPCCompressZstd;
+	TestPB::SRPCClient client(&client_params);
+
+	SubstrRequest req;
+	SubstrResponse resp;
+	RPCSyncContext ctx;
+	std::string str;
+
+	// many chunks, the last one is not full
+	for (int i = 0; i < 100000; i++)
+		str += std::to_string(i) + " hello world!";
+
+	req.set_str(str);
+	req.set_idx(6);
+	client.Substr(&req, &resp, &ctx);
+	EXPECT_EQ(ctx.success, true);
+	EXPECT_TRUE(resp.str() == str.substr(6));
+
+	server.stop();
+	compressor->set_chunk_size(RPCCompressZstd, 0);
+}
+
+TEST(SRPC_COMPRESS, thrift)
+{
+	RPCServerParams server_params = RPC_SERVER_PARAMS_DEFAULT;
+	RPCClientParams client_params = RPC_CLIENT_PARAMS_DEFAULT;
+	SRPCServer server(&server_params);
+	TestThriftServiceImpl impl;
+
+	server.add_service(&impl);
+	EXPECT_TRUE(server.start("127.0.0.1", 9965) == 0) << "server start failed";
+
+	client_params.host = "127.0.0.1";
+	client_params.port = 9965;
+	client_params.task_params.compress_type = RPCCompressLz4;
+	TestThrift::SRPCClient client(&client_params);
+
+	std::string str;
+	std::string result;
+
+	// parsed by server while decompressing, in many windows
+	for (int i = 0; i < 100000; i++)
+		str += std::to_string(i) + " hello world!";
+
+	client.substr(result, str, 6, -1);
+	EXPECT_EQ(client.thrift_last_sync_success(), true);
+	EXPECT_TRUE(result == str.substr(6));
+
+	server.stop();
+}
+
+TEST(Thrift, compress)
+{
+	RPCServerParams server_params = RPC_SERVER_PARAMS_DEFAULT;
+	RPCClientParams client_params = RPC_CLIENT_PARAMS_DEFAULT;
+	ThriftServer server(&server_params);
+	TestThriftServiceImpl impl;
+
+	server.add_service(&impl);
+	EXPECT_TRUE(server.start("127.0.0.1", 9965) == 0) << "server start failed";
+
+	client_params.host = "127.0.0.1";
+	client_params.port = 9965;
+	client_params.task_params.compress_type = RPCCompressZlib;
+	TestThrift::ThriftClient client(&client_params);
+
+	std::string str;
+	std::string result;
+
+	// THeader with zlib transform both ways
+	for (int i = 0; i < 100000; i++)
+		str += std::to_string(i) + " hello world!";
+
+	client.substr(result, str, 6, -1);
+	EXPECT_EQ(client.thrift_last_sync_success(), true);
+	EXPECT_TRUE(result == str.substr(6));
+
+	// no THeader transform for gzip
+	client_params.task_params.compress_type = RPCCompressGzip;
+	TestThrift::ThriftClient client_gzip(&client_params);
+	WFFacilities::WaitGroup wg(1);
+	TestThrift::addRequest req;
+
+	req.a = 123;
+	req.b = 456;
+	client_gzip.add(&req, [&wg](TestThrift::addResponse *response, RPCContext *ctx) {
+		EXPECT_EQ(ctx->get_status_code(), RPCStatusReqCompressNotSupported);
+		wg.done();
+	});
+
+	wg.wait();
+	server.stop();
+}
+
+TEST(SRPC, offload)
+{
+	RPCServerParams server_params = RPC_SERVER_PARAMS_DEFAULT;
+	RPCClientParams client_params = RPC_CLIENT_PARAMS_DEFAULT;
+
+	server_params.offload_size = 64 * 1024;
+	SRPCServer server(&server_params);
+	TestPBServiceImpl impl;
+
+	impl.set_offload("Add");
+	server.add_service(&impl);
+	EXPECT_TRUE(server.start("127.0.0.1", 9964) == 0) << "server start failed";
+
+	client_params.host = "127.0.0.1";
+	client_params.port = 9964;
+	client_params.task_params.compress_type = RPCCompressGzip;
+	TestPB::SRPCClient client(&client_params);
+
+	AddRequest req1;
+	AddResponse resp1;
+	RPCSyncContext ctx1;
+
+	// offloaded by method
+	req1.set_a(123);
+	req1.set_b(456);
+	client.Add(&req1, &resp1, &ctx1);
+	EXPECT_EQ(ctx1.success, true);
+	EXPECT_EQ(resp1.c(), 123 + 456);
+
+	SubstrRequest req2;
+	SubstrResponse resp2;
+	RPCSyncContext ctx2;
+	std::string str;
+
+	// offloaded by size
+	for (int i = 0; i < 100000; i++)
+		str += std::to_string(i) + " hello world!";
+
+	req2.set_str(str);
+	req2.set_idx(6);
+	client.Substr(&req2, &resp2, &ctx2);
+	EXPECT_EQ(ctx2.success, true);
+	EXPECT_TRUE(resp2.str() == str.substr(6));
+
+	server.stop();
+}
+
+TEST(SRPC, arena)
+{
+	RPCClientParams client_params = RPC_CLIENT_PARAMS_DEFAULT;
+	SRPCServer server;
+	TestPBServiceImpl impl;
+
+	impl.set_arena(true);
+	server.add_service(&impl);
+	EXPECT_TRUE(server.start("127.0.0.1", 9964) == 0) << "server start failed";
+
+	client_params.host = "127.0.0.1";
+	client_params.port = 9964;
+	TestPB::SRPCClient client(&client_params);
+
+	// the arena is recycled with its first block after each call
+	for (int i = 0; i < 3; i++)
+	{
+		SubstrRequest req;
+		SubstrResponse resp;
+		RPCSyncContext ctx;
+		std::string str(100000 + i, 'a' + i);
+
+		req.set_str(str);
+		req.set_idx(i);
+		client.Substr(&req, &resp, &ctx);
+		EXPECT_EQ(ctx.success, true);
+		EXPECT_TRUE(resp.str() == str.substr(i));
+	}
+
+	server.stop();
+}
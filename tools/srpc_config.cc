@@ -158,6 +158,8 @@ const char *srpc_config::rpc_compress_string() const
 		return "RPCCompressZlib";
 	case COMPRESS_TYPE_LZ4:
 		return "RPCCompressLz4";
+	case COMPRESS_TYPE_ZSTD:
+		return "RPCCompressZstd";
 	default:
 		return "Unknown type";
 	}
@@ -230,6 +232,8 @@ void srpc_config::set_compress_type(const char *type)
 		this->compress_type = COMPRESS_TYPE_ZLIB;
 	else if (strcasecmp(type, "lz4") == 0)
 		this->compress_type = COMPRESS_TYPE_LZ4;
+	else if (strcasecmp(type, "zstd") == 0)
+		this->compress_type = COMPRESS_TYPE_ZSTD;
 	else
 		this->compress_type = COMPRESS_TYPE_MAX;
 }
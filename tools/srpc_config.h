@@ -171,6 +171,7 @@ enum
 	COMPRESS_TYPE_GZIP,
 	COMPRESS_TYPE_ZLIB,
 	COMPRESS_TYPE_LZ4,
+	COMPRESS_TYPE_ZSTD,
 	COMPRESS_TYPE_MAX
 };
 
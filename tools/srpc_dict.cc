@@ -0,0 +1,191 @@
+/*
+  Copyright (c) 2022 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "zstd.h"
+#include "zdict.h"
+
+// zstd dictionary for RPCCompressor::add_dict(RPCCompressZstd, ...)
+
+static const size_t DICT_SIZE_DEFAULT = 110 * 1024;
+
+static void usage(const char *name)
+{
+	printf("Usage:\n"
+		   "    %s -o <DICT_FILE> [FLAGS] <SAMPLE_FILE>...\n\n"
+		   "Train a zstd dictionary from captured payloads,\n"
+		   "such as the serialized messages of one service or method.\n\n"
+		   "Available Flags:\n"
+		   "    -o :    dictionary file to write\n"
+		   "    -s :    max size of dictionary (default: %zu)\n"
+		   "    -i :    dictionary id, 1 to 2147483647 (default: chosen by zstd)\n"
+		   "    -r :    each file is records of 4 bytes big-endian length and\n"
+		   "            payload, otherwise each file is one payload\n",
+		   name, DICT_SIZE_DEFAULT);
+}
+
+static bool read_file(const char *path, std::string& data)
+{
+	FILE *fp = fopen(path, "rb");
+	char buf[8192];
+	size_t n;
+
+	if (!fp)
+		return false;
+
+	while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+		data.append(buf, n);
+
+	n = ferror(fp);
+	fclose(fp);
+	return n == 0;
+}
+
+static bool add_records(const std::string& data, std::string& samples,
+						std::vector<size_t>& sizes)
+{
+	const unsigned char *p = (const unsigned char *)data.data();
+	size_t left = data.size();
+	size_t len;
+
+	while (left > 0)
+	{
+		if (left < 4)
+			return false;
+
+		len = ((size_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		if (len > left - 4)
+			return false;
+
+		samples.append((const char *)p + 4, len);
+		sizes.push_back(len);
+		p += 4 + len;
+		left -= 4 + len;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = NULL;
+	size_t dict_size = DICT_SIZE_DEFAULT;
+	unsigned long dict_id = 0;
+	bool records = false;
+	std::string samples;
+	std::vector<size_t> sizes;
+	int c;
+
+	while ((c = getopt(argc, argv, "o:s:i:r")) >= 0)
+	{
+		switch (c)
+		{
+		case 'o':
+			output = optarg;
+			break;
+		case 's':
+			dict_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			dict_id = strtoul(optarg, NULL, 10);
+			if (dict_id == 0 || dict_id > 0x7FFFFFFF)
+			{
+				fprintf(stderr, "Invalid dictionary id %s\n", optarg);
+				return 1;
+			}
+
+			break;
+		case 'r':
+			records = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!output || optind == argc || dict_size == 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; i++)
+	{
+		std::string data;
+
+		if (!read_file(argv[i], data))
+		{
+			fprintf(stderr, "Read %s failed\n", argv[i]);
+			return 1;
+		}
+
+		if (records)
+		{
+			if (!add_records(data, samples, sizes))
+			{
+				fprintf(stderr, "Broken record in %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (!data.empty())
+		{
+			samples += data;
+			sizes.push_back(data.size());
+		}
+	}
+
+	std::string dict(dict_size, '\0');
+	size_t ret = ZDICT_trainFromBuffer(&dict[0], dict.size(), samples.data(),
+									   sizes.data(), (unsigned int)sizes.size());
+
+	if (ZDICT_isError(ret))
+	{
+		fprintf(stderr, "Train failed with %zu samples: %s\n",
+				sizes.size(), ZDICT_getErrorName(ret));
+		return 1;
+	}
+
+	dict.resize(ret);
+	// dictionary id is the 4 bytes little-endian after the magic number
+	if (dict_id != 0)
+	{
+		for (int i = 0; i < 4; i++)
+			dict[4 + i] = (char)((dict_id >> (8 * i)) & 0xFF);
+	}
+
+	FILE *fp = fopen(output, "wb");
+
+	if (!fp || fwrite(dict.data(), 1, dict.size(), fp) != dict.size())
+	{
+		fprintf(stderr, "Write %s failed\n", output);
+		if (fp)
+			fclose(fp);
+
+		return 1;
+	}
+
+	fclose(fp);
+	printf("Dictionary %s: id %u, %zu bytes from %zu samples\n", output,
+		   ZDICT_getDictID(dict.data(), dict.size()), dict.size(), sizes.size());
+	return 0;
+}
+
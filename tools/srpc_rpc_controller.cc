@@ -80,7 +80,7 @@ void RPCController::print_usage(const char *name) const
 		   COLOR_WHITE": data type [ protobuf | thrift | json ] "
 		   "(default: idl type. json for http)\n"
 		   COLOR_FLAG"    -c "
-		   COLOR_WHITE": compress type [ gzip | zlib | snappy | lz4 ] "
+		   COLOR_WHITE": compress type [ gzip | zlib | snappy | lz4 | zstd ] "
 		   "(default: no compression)\n"
 		   COLOR_FLAG"    -d "
 		   COLOR_WHITE": path of dependencies (default: COMPILE_PATH)\n"